@@ -8,10 +8,13 @@
 #ifndef KLEIN_H
 #define KLEIN_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
 typedef struct Expression Expression;
 typedef struct BinaryExpression BinaryExpression;
 typedef struct TypeDeclaration TypeDeclaration;
-typedef struct Scope Scope;
 typedef struct ExpressionList ExpressionList;
 typedef struct StatementList StatementList;
 typedef struct UnaryExpression UnaryExpression;
@@ -21,35 +24,63 @@ typedef struct WhileLoop WhileLoop;
 typedef struct IfExpressionList IfExpressionList;
 typedef struct Function Function;
 typedef struct Value Value;
+typedef struct Shape Shape;
 
-#define DEFINE_KLEIN_LIST(type)                               \
-	typedef struct type##List type##List;                     \
-	struct type##List {                                       \
-		unsigned long size;                                   \
-		unsigned long capacity;                               \
-		type* data;                                           \
-	};                                                        \
-                                                              \
-	type##List empty##type##List();                           \
-	type##List* emptyHeap##type##List();                      \
-	void appendTo##type##List(type##List* list, type value);  \
-	void prependTo##type##List(type##List* list, type value); \
-	int is##type##ListEmpty(type##List list);                 \
-	void pop##type##List(type##List* list);                   \
+/**
+ * Defines a growable list of `type`. Empty lists don't allocate until their first
+ * element is added. A list can also start out in a buffer owned by someone else,
+ * such as a small array on the stack; it's only copied to the heap if it outgrows
+ * the buffer. Either way, `free##type##List()` releases whatever the list owns.
+ */
+#define DEFINE_KLEIN_LIST(type)                                                   \
+	typedef struct type##List type##List;                                         \
+	struct type##List {                                                           \
+		unsigned long size;                                                       \
+		unsigned long capacity;                                                   \
+		type* data;                                                               \
+                                                                                  \
+		/** Whether `data` is a buffer the list doesn't own. */                   \
+		bool isBorrowed;                                                          \
+	};                                                                            \
+                                                                                  \
+	type##List empty##type##List();                                               \
+	type##List empty##type##ListWithBuffer(type* buffer, unsigned long capacity); \
+	type##List* emptyHeap##type##List();                                          \
+	void free##type##List(type##List* list);                                      \
+	void appendTo##type##List(type##List* list, type value);                      \
+	void prependTo##type##List(type##List* list, type value);                     \
+	int is##type##ListEmpty(type##List list);                                     \
+	void pop##type##List(type##List* list);                                       \
 	type getFrom##type##ListUnchecked(type##List list, unsigned long index)
 
 // Enums --------------------------------------------------------------------------------------------------------------------------------------------
 
+/**
+ * The kind of a value that lives on the heap. Numbers, booleans and `null` are
+ * stored directly inside a `Value` and never have one of these.
+ */
 typedef enum {
-	INTERNAL_KEY_STRING,
-	INTERNAL_KEY_NUMBER,
-	INTERNAL_KEY_BOOLEAN,
-	INTERNAL_KEY_LIST,
-	INTERNAL_KEY_NULL,
-	INTERNAL_KEY_FUNCTION,
-	INTERNAL_KEY_THIS_OBJECT,
-	INTERNAL_KEY_BUILTIN_FUNCTION
-} InternalKey;
+	HEAP_OBJECT_STRING,
+	HEAP_OBJECT_ROPE,
+	HEAP_OBJECT_STRING_SLICE,
+	HEAP_OBJECT_STRING_BUILDER,
+	HEAP_OBJECT_LIST,
+	HEAP_OBJECT_RANGE,
+	HEAP_OBJECT_ITERATOR,
+	HEAP_OBJECT_MAP,
+	HEAP_OBJECT_VECTOR,
+	HEAP_OBJECT_PERSISTENT_MAP,
+	HEAP_OBJECT_RECORD,
+	HEAP_OBJECT_CLOSURE,
+	HEAP_OBJECT_BUILTIN_FUNCTION,
+	HEAP_OBJECT_BOUND_METHOD,
+
+	// Internal objects shared between values, which are never values themselves
+	HEAP_OBJECT_LIST_STORAGE,
+	HEAP_OBJECT_VECTOR_NODE,
+	HEAP_OBJECT_HAMT_NODE,
+	HEAP_OBJECT_UPVALUE
+} HeapObjectType;
 
 typedef enum {
 
@@ -128,18 +159,17 @@ typedef enum {
 	KLEIN_ERROR_ASSIGN_TO_NON_IDENTIFIER,
 	KLEIN_ERROR_INCORRECT_ARGUMENT_COUNT,
 	KLEIN_ERROR_INVALID_INDEX,
+	KLEIN_ERROR_UNHASHABLE_KEY,
+	KLEIN_ERROR_MUTATE_FROZEN_VALUE,
+	KLEIN_ERROR_INVALID_ARGUMENT,
 	KLEIN_ERROR_DUPLICATE_VARIABLE_DECLARATION,
-	KLEIN_ERROR_REFERENCE_UNDEFINED_VARIABLE
+	KLEIN_ERROR_REFERENCE_UNDEFINED_VARIABLE,
+	KLEIN_ERROR_DECLARATION_IN_STANDALONE_EXPRESSION
 
 } KleinResultType;
 
 // Errors -------------------------------------------------------------------------------------------------------------------------------------------
 
-typedef struct {
-	Value* value;
-	InternalKey* internal;
-} KleinValueMissingInternalError;
-
 typedef struct {
 	Value* value;
 	char* name;
@@ -167,7 +197,6 @@ typedef union {
 
 	// Runner errors
 
-	KleinValueMissingInternalError missingInternal;
 	KleinValueMissingFieldError missingField;
 	Expression* assignToNonIdentifier;
 	KleinIncorrectArgumentCountError incorrectArgumentCount;
@@ -243,7 +272,18 @@ typedef struct {
 
 typedef struct {
 	StatementList* statements;
-	Scope* innerScope;
+
+	/**
+	 * The first local variable slot owned by this block. Set by the resolver.
+	 */
+	unsigned long firstSlot;
+
+	/**
+	 * Whether any local declared in this block is captured by a closure, in
+	 * which case its upvalues must be closed when the block exits. Set by the
+	 * resolver.
+	 */
+	int closesUpvalues;
 } Block;
 
 typedef enum {
@@ -276,10 +316,41 @@ typedef struct {
 	/** The type of the parameter. */
 	Type type;
 
+	/** Whether the parameter is ever the target of an assignment. Set by the resolver. */
+	int isReassigned;
+
 } Parameter;
 
 DEFINE_KLEIN_LIST(Parameter);
 
+/**
+ * A variable that a function captures from the functions enclosing it.
+ */
+typedef struct {
+
+	/**
+	 * Whether the variable is a local of the directly enclosing function, as
+	 * opposed to one of the enclosing function's own captures.
+	 */
+	int isLocal;
+
+	/**
+	 * The slot of the enclosing function's local if `isLocal` is set, otherwise
+	 * the index of the enclosing function's capture.
+	 */
+	unsigned long index;
+
+	/**
+	 * Whether the local is never reassigned, so the closure can keep its own copy
+	 * of it instead of sharing it with the enclosing function. Only meaningful if
+	 * `isLocal` is set.
+	 */
+	int isCopy;
+
+} Capture;
+
+DEFINE_KLEIN_LIST(Capture);
+
 struct Function {
 
 	/**
@@ -293,6 +364,18 @@ struct Function {
 
 	/** The body of this function. */
 	Block body;
+
+	/**
+	 * The number of local variable slots a call to this function needs, including
+	 * its parameters. Set by the resolver.
+	 */
+	unsigned long slotCount;
+
+	/**
+	 * The variables this function captures from enclosing functions, in upvalue
+	 * index order. Set by the resolver.
+	 */
+	CaptureList captures;
 };
 
 typedef enum {
@@ -318,6 +401,28 @@ typedef enum {
 	UNARY_OPERATION_INDEX
 } UnaryOperationType;
 
+typedef enum {
+	VARIABLE_LOCAL,
+	VARIABLE_UPVALUE
+} VariableLocation;
+
+/**
+ * A reference to a variable by name. The resolver determines where the variable
+ * lives at runtime, so evaluating an identifier never searches by name.
+ */
+typedef struct {
+
+	/** The name of the variable. */
+	char* name;
+
+	/** Whether the variable is a local of the current function or one of its upvalues. */
+	VariableLocation location;
+
+	/** The local slot or upvalue index of the variable, depending on `location`. */
+	unsigned long index;
+
+} Identifier;
+
 struct TypeDeclaration {
 	ParameterList fields;
 };
@@ -330,12 +435,12 @@ typedef union {
 	Block* block;
 	int boolean;
 
-	/** A literal number expression. */
-	Function function;
+	/** A function literal expression. */
+	Function* function;
 
 	UnaryExpression* unary;
 
-	char* identifier;
+	Identifier identifier;
 
 	/** A binary expression. */
 	BinaryExpression* binary;
@@ -360,10 +465,23 @@ struct Expression {
 	ExpressionData data;
 };
 
+/**
+ * The inline cache of a `.` expression: the shape of the last record it read a
+ * field from, and the slot the field was in. While records reaching the
+ * expression keep that shape, the field is read without looking up its name.
+ */
+typedef struct {
+	Shape* shape;
+	unsigned long slot;
+} FieldCache;
+
 struct BinaryExpression {
 	Expression left;
 	BinaryOperation operation;
 	Expression right;
+
+	/** The field cache of a `.` expression. Unused for other operations. */
+	FieldCache cache;
 };
 
 DEFINE_KLEIN_LIST(Expression);
@@ -392,6 +510,9 @@ DEFINE_KLEIN_LIST(Field);
 
 struct Object {
 	FieldList fields;
+
+	/** The shape of the records this literal creates, once one has been created. */
+	Shape* shape;
 };
 
 typedef enum {
@@ -404,6 +525,19 @@ typedef struct {
 	char* name;
 	Type* type;
 	Expression value;
+
+	/** The local slot this declaration stores its value in. Set by the resolver. */
+	unsigned long slot;
+
+	/** Whether the variable is ever the target of an assignment. Set by the resolver. */
+	int isReassigned;
+
+	/**
+	 * Whether the variable is never reassigned and initialized with a literal, in
+	 * which case every use of it has been replaced with the literal and the
+	 * declaration itself doesn't need to be evaluated. Set by the resolver.
+	 */
+	int isConstant;
 } Declaration;
 
 typedef union {
@@ -428,6 +562,12 @@ struct ForLoop {
 	char* binding;
 	Expression list;
 	Block body;
+
+	/** The local slot the loop binding is stored in. Set by the resolver. */
+	unsigned long slot;
+
+	/** Whether the loop binding is ever the target of an assignment. Set by the resolver. */
+	int isBindingReassigned;
 };
 
 struct WhileLoop {
@@ -448,21 +588,55 @@ DEFINE_KLEIN_LIST(Statement);
 typedef struct {
 	/** The statements in the program. The elements in this list are of type `Statement`. */
 	StatementList statements;
+
+	/** The number of local variable slots the top level of the program needs. Set by the resolver. */
+	unsigned long slotCount;
 } Program;
 
+/**
+ * A runtime value, NaN-boxed into 64 bits. A fractional number is stored as its
+ * own IEEE 754 bits; every other value is hidden in the payload of a quiet NaN,
+ * which no arithmetic produces. Whole numbers are tagged integers, `null`,
+ * `true` and `false` are fixed payloads, and all other values are a tagged
+ * pointer to a `HeapObject`. Use the functions in `sugar.h` to create and inspect
+ * values rather than reading `bits` directly.
+ */
+struct Value {
+	uint64_t bits;
+};
+
+/**
+ * The header at the start of every heap-allocated value, and of the internal
+ * objects values share.
+ */
 typedef struct {
-	InternalKey key;
-	void* value;
-} Internal;
 
-typedef struct ValueFieldList ValueFieldList;
+	/** The object's `HeapObjectType`, kept small so the header fits in 8 bytes. */
+	uint8_t type;
 
-DEFINE_KLEIN_LIST(Internal);
+	/**
+	 * Whether the garbage collector has found the object to be reachable. This is
+	 * an atomic byte of its own rather than a bit, so that collector threads can set
+	 * it without disturbing the flags below.
+	 */
+	atomic_bool isMarked;
 
-struct Value {
-	ValueFieldList* fields;
-	InternalList internals;
-};
+	/**
+	 * Whether the object and everything it refers to can never change again. Frozen
+	 * objects can be shared freely, since nothing writes to them.
+	 */
+	bool isFrozen : 1;
+
+	/** Whether `hash` holds the hash of a frozen container. */
+	bool isHashed : 1;
+
+	/** Whether the object has survived a collection of the nursery. */
+	bool isOld : 1;
+
+	/** Whether the object is old and has been changed to refer to a nursery object. */
+	bool isRemembered : 1;
+	uint32_t hash;
+} HeapObject;
 
 typedef struct {
 	char* name;
@@ -488,6 +662,25 @@ KleinResult parseKleinExpression(char* code, Expression* output);
 
 KleinResult runKlein(char* code);
 
+/**
+ * Sets the longest the garbage collector of the running program may pause it for,
+ * in microseconds; the default is 1000. Increments of a major collection stop once
+ * the pause reaches it, though each one always makes some progress, and a minor
+ * collection or the end of marking may take longer. Klein code can set this with
+ * `set_maximum_pause()`.
+ */
+void setMaximumPause(unsigned long microseconds);
+
+/**
+ * Sets how many helper threads collect garbage alongside the running program's
+ * thread. With any, the old generation is marked by all of them at once and swept
+ * in the background; with none, which is the default, the program's thread does
+ * everything. The threads are started when a collection first needs them, and
+ * no more are started than there are processors to spare. Klein code can set this
+ * with `set_collector_threads()`.
+ */
+void setCollectorThreads(unsigned int count);
+
 // -------------------------------------------------------------------------------------------------------------------------------------------------
 
 #endif
@@ -1,41 +1,86 @@
 #ifndef CONTEXT_H
 #define CONTEXT_H
 
+#include "gc.h"
 #include "list.h"
 #include "parser.h"
 
-typedef struct Scope Scope;
+typedef struct Upvalue Upvalue;
 
-DEFINE_KLEIN_LIST(Scope);
+/**
+ * A variable captured by a closure. While the frame that owns the variable is
+ * alive, the upvalue is "open" and points directly at the frame's slot, so
+ * writes through either are visible to both. When the variable goes out of
+ * scope, the upvalue is "closed": the value is moved into the upvalue itself
+ * and `location` is pointed at it.
+ */
+struct Upvalue {
+	HeapObject header;
+
+	/** Where the captured variable currently lives. */
+	Value* location;
+
+	/** The storage for the variable once this upvalue has been closed, or `null` while open. */
+	Value closed;
+
+	/** The slot this upvalue refers to in its frame while open. */
+	unsigned long slot;
 
+	/** The next open upvalue of the same frame, in order of descending slot. */
+	Upvalue* next;
+};
+
+/**
+ * A function value together with the variables it captured when it was created.
+ */
 typedef struct {
-	String name;
-	Value value;
-} ScopeDeclaration;
+	HeapObject header;
+	Function* function;
+
+	/** One upvalue per entry of `function->captures`, in the same order. */
+	Upvalue** upvalues;
+} Closure;
 
-DEFINE_KLEIN_LIST(ScopeDeclaration);
+typedef struct Frame Frame;
 
-struct Scope {
-	Scope* parent;
-	ScopeList children;
-	ScopeDeclarationList variables;
+/**
+ * The runtime storage of a single function call (or of the top level of the
+ * program).
+ */
+struct Frame {
+
+	/** The local variables of the call, indexed by the slots assigned by the resolver. */
+	Value* slots;
+	unsigned long slotCount;
+
+	/** The closure being called, or `NULL` for the top level of the program. */
+	Closure* closure;
+
+	/** The upvalues still pointing into `slots`, in order of descending slot. */
+	Upvalue* openUpvalues;
+
+	/** The frame of the caller. */
+	Frame* parent;
 };
 
+typedef struct InternTable InternTable;
+
 typedef struct Context Context;
 struct Context {
-	Scope* scope;
-	Scope globalScope;
+	Frame* frame;
 	int debugIndent;
+
+	/** The canonical copies of names and string literals, created on first use. */
+	InternTable* strings;
+
+	/** Every value created while running. */
+	Heap heap;
 };
 
 /**
- * Creates a new context allocated on the heap, wrapped in a
- * `Result`. The caller is responsible for freeing the memory, most
- * likely using `freeContext()`.
- *
- * # Returns
- *
- * The context pointer wrapped in a result.
+ * Creates a new context with no active frame and an empty heap, and stores it in
+ * `output`. The caller is responsible for freeing it, and every value created
+ * with it, using `freeContext()`.
  *
  * # Errors
  *
@@ -44,59 +89,50 @@ struct Context {
 KleinResult newContext(Context* output);
 
 /**
- * Declares a new variable in the given scope with the given name and
- * value.
+ * Pushes a new frame with `slotCount` null slots for a call to the given
+ * closure onto the current context.
  *
  * # Parameters
  *
- * - `scope` - The scope to add the variable to, which will be mutated to
- *   reflect the added variable.
- * - `name` - The name of the variable as a null-terminated string that lives
- *   at least as long as the given scope object.
- * - `value` - The value of the variable.
- *
- * # Returns
- *
- * `NULL` wrapped in a `Result`, assuming success.
+ * - `closure` - The closure being called, or `NULL` for the top level of the program.
+ * - `slotCount` - The number of local variable slots the frame needs.
  *
  * # Errors
  *
- * If memory fails to allocate for the new variable, an error is returned.
- * If a variable already exists in the given scope (or any of its parent
- * scopes), an error is returned. If the given `scope` or `name` is `NULL`,
- * an error is returned.
+ * If memory fails to allocate, an error is returned.
  */
-KleinResult declareNewVariable(Scope* scope, ScopeDeclaration declaration);
+KleinResult enterFrame(Closure* closure, unsigned long slotCount);
 
 /**
- * Returns a pointer to the `Expression` value stored in the variable with the
- * given name in the given scope. This will traverse up the scope hierarchy
- * to the global scope until the variable is found.
- *
- * # Parameters
- *
- * - `scope` - The scope to search in.
- * - `name` - The name of the variable as a null-terminated string. It only
- *   needs to be valid for the duration of the function call; It can be safely
- *   freed as soon as this function is finished. Doing so will not invalidate
- *   the returned `Expression` pointer.
- *
- * # Returns
- *
- * The variable's `Expression` value, wrapped in a `Result`, assuming success.
+ * Closes every upvalue still pointing into the current frame and pops it,
+ * returning to the caller's frame.
  *
  * # Errors
  *
- * If the given `name` is `NULL`, an error is returned.
- * If no variable exists with the given name in the given scope,
- * an error is returned.
+ * If there is no current frame, an error is returned.
  */
-KleinResult getVariable(Scope scope, char* name, Value** output);
-KleinResult setVariable(Scope* scope, ScopeDeclaration declaration);
-KleinResult reassignVariable(Scope* scope, ScopeDeclaration declaration);
+KleinResult exitFrame(void);
 
-KleinResult enterNewScope(void);
-KleinResult exitScope(void);
+/**
+ * Returns the upvalue for the given slot of the current frame, creating it
+ * if no closure has captured that slot yet. Closures capturing the same
+ * variable share the same upvalue.
+ */
+KleinResult captureUpvalue(unsigned long slot, Upvalue** output);
+
+/**
+ * Creates an upvalue that is already closed over a copy of the given slot of the
+ * current frame. This is used for variables that are never reassigned, which
+ * don't need to be shared with the frame or closed when it exits.
+ */
+KleinResult copyUpvalue(unsigned long slot, Upvalue** output);
+
+/**
+ * Closes every open upvalue of the current frame whose slot is at or above
+ * `firstSlot`. This is called when the block owning those slots exits, so that
+ * each iteration of a loop gets fresh variables.
+ */
+void closeUpvalues(unsigned long firstSlot);
 
 void freeContext(Context context);
 
@@ -0,0 +1,24 @@
+#ifndef EQUALITY_H
+#define EQUALITY_H
+
+#include "sugar.h"
+
+/**
+ * Returns whether two values are equal, as `==` compares them.
+ *
+ * Numbers compare by value and strings by their characters. Lists compare
+ * element by element, records field by field regardless of field order, and maps
+ * entry by entry. Vectors and persistent maps compare the same way, but are
+ * never equal to a list or map. A list that contains itself is equal to another list with the
+ * same structure. Every other kind of value is only equal to itself.
+ */
+bool valuesEqual(Value left, Value right);
+
+/**
+ * Returns a hash of a value that's consistent with `valuesEqual()`: equal values
+ * always hash the same. Containers are only hashed a few levels deep, so hashing
+ * a value that contains itself terminates.
+ */
+uint32_t hashValue(Value value);
+
+#endif
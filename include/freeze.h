@@ -0,0 +1,29 @@
+#ifndef FREEZE_H
+#define FREEZE_H
+
+#include "sugar.h"
+
+/**
+ * Makes a value and everything reachable from it immutable, as the built-in
+ * `freeze` function does.
+ *
+ * Lists, records and maps are frozen in place, so every reference to them sees
+ * the change; changing them afterwards is an error. The contents of vectors and
+ * persistent maps are frozen too. A frozen list shares its
+ * storage with copies without counting them, and a frozen list or map can be used
+ * as a map key, with its hash computed once. Strings are flattened into a single
+ * frozen string. Functions, iterators and string builders are left as they are.
+ *
+ * # Parameters
+ *
+ * - `value` - The value to freeze.
+ * - `output` - Where to place the frozen value, which is `value` itself unless
+ *   it's a rope or string slice.
+ *
+ * # Errors
+ *
+ * If a string can't be flattened, an error is returned.
+ */
+KleinResult freezeValue(Value value, Value* output);
+
+#endif
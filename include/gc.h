@@ -0,0 +1,247 @@
+#ifndef GC_H
+#define GC_H
+
+#include "list.h"
+
+/**
+ * The helper threads of a heap that collects in parallel, private to the
+ * collector.
+ */
+typedef struct CollectorThreads CollectorThreads;
+
+/**
+ * A growable array of heap objects.
+ */
+typedef struct {
+	HeapObject** objects;
+	unsigned long count;
+	unsigned long capacity;
+} HeapObjectArray;
+
+/**
+ * An element of an old list's storage that was changed to refer to a nursery
+ * object. Lists can be long, so a minor collection only visits the elements that
+ * were written rather than the whole storage.
+ */
+typedef struct {
+	HeapObject* storage;
+	unsigned long index;
+} RememberedElement;
+
+DEFINE_KLEIN_LIST(RememberedElement);
+
+/**
+ * How far the heap is through collecting its old generation. A major collection
+ * is split into increments that each run after a minor collection, so the work
+ * of a large heap is spread across many short pauses.
+ */
+typedef enum {
+
+	/** No major collection is in progress. */
+	COLLECTION_PHASE_IDLE,
+
+	/** The old generation is being marked from the gray stack. */
+	COLLECTION_PHASE_MARKING,
+
+	/** Dead lists are being released from the storage they share. */
+	COLLECTION_PHASE_RELEASING,
+
+	/** Unmarked old objects are being freed, possibly on a background thread. */
+	COLLECTION_PHASE_SWEEPING,
+} CollectionPhase;
+
+/**
+ * The garbage-collected heap of a context, split into two generations.
+ *
+ * New objects go in the nursery. Once `NURSERY_SIZE` bytes have been allocated, a
+ * minor collection marks the nursery objects reachable from the roots and from
+ * the remembered set, frees the rest and promotes the survivors to the old
+ * generation. Most objects die young, so a minor collection only touches the
+ * few that didn't.
+ *
+ * The old generation is collected by an incremental mark and sweep, one bounded
+ * increment after each minor collection. Objects are never moved, since the
+ * interpreter holds pointers to them in locals. With helper threads, marking is
+ * shared between them and the program's thread, and sweeping happens on a
+ * background thread while the program runs.
+ *
+ * The roots are the slots, closures and open upvalues of every frame, the
+ * interned strings, the locations added with `addGlobalRoot()`, and the values on
+ * the root stack. The root stack holds the temporaries the interpreter is in the
+ * middle of using, such as the evaluated elements of a list literal, and any
+ * values an embedder wants kept alive between calls.
+ */
+typedef struct {
+
+	/** Objects allocated since the last minor collection. */
+	HeapObjectArray nursery;
+
+	/** The bytes allocated since the last minor collection. */
+	size_t nurseryBytes;
+
+	/** Objects that have survived a minor collection. */
+	HeapObjectArray old;
+
+	/** The bytes in the old generation, as of the last sweep plus any promoted since. */
+	size_t oldBytes;
+
+	/** How large the old generation can grow before a major collection starts. */
+	size_t threshold;
+
+	/** Old objects that may refer to nursery objects, which are roots of a minor collection. */
+	HeapObjectArray remembered;
+
+	/** Elements of old list storage that may refer to nursery objects. */
+	RememberedElementList rememberedElements;
+
+	/** The progress of the current major collection. */
+	CollectionPhase phase;
+
+	/** Old objects that have been marked but whose references haven't been followed yet. */
+	HeapObjectArray gray;
+
+	/**
+	 * List storage too long to trace in one step, and how many of its elements
+	 * marking has reached, or `NULL`.
+	 */
+	HeapObject* scanning;
+	unsigned long scanIndex;
+
+	/** Nursery objects that have been marked but whose references haven't been followed yet. */
+	HeapObjectArray youngGray;
+
+	/**
+	 * The old objects that existed when marking finished, which the releasing and
+	 * sweeping phases go through. Objects promoted after that go in `old`, and
+	 * aren't swept until the next major collection.
+	 */
+	HeapObjectArray sweeping;
+
+	/** The index in `sweeping` that the releasing or sweeping phase has reached. */
+	unsigned long sweepIndex;
+
+	/** How many of the objects swept so far survived, and so where the next survivor goes. */
+	unsigned long survivorCount;
+
+	/** The bytes of the old objects marked by the current major collection. */
+	size_t markedBytes;
+
+	/** The bytes promoted since marking finished. */
+	size_t promotedBytes;
+
+	/** The longest an increment of a major collection may take, in nanoseconds. */
+	unsigned long maximumPause;
+
+	/** How many helper threads collect garbage alongside the program's thread. */
+	unsigned int threadCount;
+
+	/** The running helper threads, or `NULL` until they're first needed. */
+	CollectorThreads* threads;
+
+	/** Values kept alive by the interpreter or the host, pushed and popped in stack order. */
+	ValueList roots;
+
+	/** Locations that always hold a live value, such as the pending return value. */
+	Value** globalRoots;
+	unsigned long globalRootCount;
+	unsigned long globalRootCapacity;
+} Heap;
+
+/**
+ * A minor collection happens each time this many bytes have been allocated.
+ */
+#define NURSERY_SIZE ((size_t) 256 << 10)
+
+/**
+ * Major collections never happen until the old generation is at least this big.
+ */
+#define MINIMUM_HEAP_THRESHOLD ((size_t) 1 << 20)
+
+/**
+ * How long a collection pauses the program for by default, in microseconds.
+ */
+#define DEFAULT_MAXIMUM_PAUSE 1000
+
+/**
+ * Creates an empty heap.
+ */
+Heap newHeap(void);
+
+/**
+ * Frees every object in a heap, reachable or not, along with the heap's own
+ * bookkeeping, stopping its helper threads.
+ */
+void freeHeap(Heap* heap);
+
+/**
+ * Records a newly allocated object of `size` bytes in the current context's
+ * nursery.
+ */
+void trackObject(HeapObject* object, size_t size);
+
+/**
+ * Counts memory allocated on behalf of an object that's already tracked, such as
+ * the elements of a list, towards the next minor collection.
+ */
+void countAllocation(size_t size);
+
+/**
+ * Records that `object` has been changed to refer to `value`. This must be called
+ * after every write of a value into an object that may have survived a
+ * collection, except for writes into objects that were just allocated. Elements
+ * of list storage use `writeElementBarrier()` instead.
+ *
+ * An old object that comes to refer to a nursery object is remembered, so that
+ * the next minor collection keeps the nursery object alive. While the old
+ * generation is being marked, an old object written into an already marked
+ * object is marked too, so that it isn't missed.
+ */
+void writeBarrier(HeapObject* object, Value value);
+
+/**
+ * Records that the element at `index` of a list's storage has been set to
+ * `value`. This is `writeBarrier()` for list storage, which remembers just the
+ * element instead of the whole storage.
+ */
+void writeElementBarrier(HeapObject* storage, unsigned long index, Value value);
+
+/**
+ * Keeps a value alive until the root stack is restored to a count from before it
+ * was pushed.
+ */
+void pushRoot(Value value);
+
+/**
+ * Returns the current height of the root stack, to be passed to `restoreRoots()`.
+ */
+unsigned long saveRoots(void);
+
+/**
+ * Pops every value pushed onto the root stack since `saveRoots()` returned `count`.
+ */
+void restoreRoots(unsigned long count);
+
+/**
+ * Adds a location whose value is always kept alive, for as long as the context
+ * exists.
+ */
+void addGlobalRoot(Value* location);
+
+/**
+ * Frees every object that isn't reachable from the roots, finishing any major
+ * collection in progress and then running a whole one. This must only be called
+ * when every value the interpreter still needs is reachable, which is the case at
+ * the start of a statement.
+ */
+void collectGarbage(void);
+
+/**
+ * Runs a minor collection if the nursery is full, followed by an increment of the
+ * major collection in progress. A major collection starts once the old generation
+ * has doubled since the last one finished, so the time spent collecting stays
+ * proportional to the amount allocated.
+ */
+void collectGarbageIfNeeded(void);
+
+
+#endif
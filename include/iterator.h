@@ -0,0 +1,124 @@
+#ifndef ITERATOR_H
+#define ITERATOR_H
+
+#include "sugar.h"
+#include <stdio.h>
+
+typedef enum {
+
+	// Sources
+	ITERATOR_LIST,
+	ITERATOR_RANGE,
+	ITERATOR_STRING,
+	ITERATOR_LINES,
+	ITERATOR_VECTOR,
+	ITERATOR_MAP_KEYS,
+	ITERATOR_MAP_VALUES,
+	ITERATOR_MAP_ENTRIES,
+
+	// Combinators
+	ITERATOR_MAP,
+	ITERATOR_FILTER,
+	ITERATOR_TAKE,
+	ITERATOR_SKIP,
+	ITERATOR_ZIP,
+	ITERATOR_ENUMERATE
+} IteratorKind;
+
+typedef struct HeapIterator HeapIterator;
+
+/**
+ * A lazy sequence of values. Sources walk a list, vector, range, string, map or
+ * file, and combinators pull from another iterator one value at a time, so a
+ * chain such as `numbers.map(f).filter(g).take(10)` runs in a single pass
+ * without building any intermediate lists.
+ */
+struct HeapIterator {
+	HeapObject header;
+	IteratorKind kind;
+
+	/** The iterator a combinator pulls from. */
+	HeapIterator* source;
+
+	/**
+	 * The list, vector, string or map a source walks, the function of `map` and
+	 * `filter`, or the second iterator of `zip`.
+	 */
+	Value value;
+
+	/** The position in a list, vector, string or map, or the count of `take`, `skip` and `enumerate`. */
+	unsigned long index;
+
+	/** The next number and last number of a range. */
+	double current;
+	double high;
+
+	/** The file read by a `lines` iterator, or `NULL` once it's been closed. */
+	FILE* file;
+};
+
+bool isIterator(Value value);
+
+/**
+ * Returns an iterator over the given value. Lists, vectors, ranges, strings and
+ * maps get a new iterator from their start, with maps producing their keys;
+ * iterators are returned as-is.
+ *
+ * # Errors
+ *
+ * If the value can't be iterated over, an error is returned.
+ */
+KleinResult iteratorOf(Value value, HeapIterator** output);
+
+/**
+ * Creates an iterator over the lines of the file at the given path, without the
+ * line breaks. The file is read one line at a time.
+ *
+ * # Errors
+ *
+ * If the file can't be opened, an error is returned.
+ */
+KleinResult linesIterator(String path, Value* output);
+
+/**
+ * Creates an iterator over the keys, values or `[key, value]` entries of a map,
+ * depending on `kind`.
+ */
+KleinResult mapIterator(IteratorKind kind, Value map, Value* output);
+
+/**
+ * Creates an iterator over the keys, values or `[key, value]` entries of a
+ * persistent map, depending on `kind`. Since the map can't change, its entries
+ * are gathered up front.
+ */
+KleinResult persistentMapIterator(IteratorKind kind, Value map, Value* output);
+
+/**
+ * Creates a combinator of the given kind that pulls from `source`.
+ *
+ * # Parameters
+ *
+ * - `kind` - The kind of combinator.
+ * - `source` - The iterator to pull from.
+ * - `value` - The function of `map` and `filter`, or the other iterator of `zip`.
+ * - `count` - The count of `take` and `skip`.
+ * - `output` - Where to place the new iterator.
+ */
+KleinResult combinatorIterator(IteratorKind kind, HeapIterator* source, Value value, unsigned long count, Value* output);
+
+/**
+ * Produces the next value of an iterator.
+ *
+ * # Parameters
+ *
+ * - `iterator` - The iterator to advance.
+ * - `output` - Where to place the next value, if there is one.
+ * - `isDone` - Set to whether the iterator has run out of values.
+ *
+ * # Errors
+ *
+ * If a function called by a combinator returns an error, it's returned.
+ */
+KleinResult advanceIterator(HeapIterator* iterator, Value* output, bool* isDone);
+
+#endif
@@ -4,66 +4,96 @@
 #include "./klein.h"
 #include "result.h"
 #include "util.h"
+#include <string.h>
 
 typedef char Char;
 
-#define IMPLEMENT_KLEIN_LIST(type)                                                   \
-	type##List empty##type##List() {                                                 \
-		return (type##List) {                                                        \
-			.size = 0,                                                               \
-			.capacity = 8,                                                           \
-			.data = malloc(sizeof(type) * 8),                                        \
-		};                                                                           \
-	}                                                                                \
-                                                                                     \
-	type##List* emptyHeap##type##List() {                                            \
-		type##List* output = malloc(sizeof(type##List));                             \
-		*output = (type##List) {                                                     \
-			.size = 0,                                                               \
-			.capacity = 8,                                                           \
-			.data = malloc(sizeof(type) * 8),                                        \
-		};                                                                           \
-		return output;                                                               \
-	}                                                                                \
-                                                                                     \
-	void appendTo##type##List(type##List* list, type value) {                        \
-		if (list->size == list->capacity) {                                          \
-			list->capacity *= 2;                                                     \
-			list->data = (type*) realloc(list->data, sizeof(type) * list->capacity); \
-		}                                                                            \
-                                                                                     \
-		list->data[list->size] = value;                                              \
-		list->size++;                                                                \
-	}                                                                                \
-                                                                                     \
-	void prependTo##type##List(type##List* list, type value) {                       \
-		if (list->size == list->capacity) {                                          \
-			list->capacity *= 2;                                                     \
-			list->data = realloc(list->data, sizeof(type) * list->capacity);         \
-		}                                                                            \
-                                                                                     \
-		for (unsigned long index = list->size; index > 0; index--) {                 \
-			list->data[index] = list->data[index - 1];                               \
-		}                                                                            \
-                                                                                     \
-		list->data[0] = value;                                                       \
-		list->size++;                                                                \
-	}                                                                                \
-                                                                                     \
-	void pop##type##List(type##List* list) {                                         \
-		for (unsigned long index = 0; index < list->size - 1; index++) {             \
-			list->data[index] = list->data[index + 1];                               \
-		}                                                                            \
-                                                                                     \
-		list->size--;                                                                \
-	}                                                                                \
-                                                                                     \
-	int is##type##ListEmpty(type##List list) {                                       \
-		return list.size == 0;                                                       \
-	}                                                                                \
-                                                                                     \
-	type getFrom##type##ListUnchecked(type##List list, unsigned long index) {        \
-		return list.data[index];                                                     \
+/**
+ * A good size for a stack buffer backing a list that's usually short, such as the
+ * arguments of a call. Such lists still grow onto the heap if they need to.
+ */
+#define SMALL_LIST_CAPACITY 8
+
+#define IMPLEMENT_KLEIN_LIST(type)                                                 \
+	type##List empty##type##List() {                                               \
+		return (type##List) {                                                      \
+			.size = 0,                                                             \
+			.capacity = 0,                                                         \
+			.data = NULL,                                                          \
+			.isBorrowed = false,                                                   \
+		};                                                                         \
+	}                                                                              \
+                                                                                   \
+	type##List empty##type##ListWithBuffer(type* buffer, unsigned long capacity) { \
+		return (type##List) {                                                      \
+			.size = 0,                                                             \
+			.capacity = capacity,                                                  \
+			.data = buffer,                                                        \
+			.isBorrowed = true,                                                    \
+		};                                                                         \
+	}                                                                              \
+                                                                                   \
+	type##List* emptyHeap##type##List() {                                          \
+		type##List* output = malloc(sizeof(type##List));                           \
+		*output = empty##type##List();                                             \
+		return output;                                                             \
+	}                                                                              \
+                                                                                   \
+	void free##type##List(type##List* list) {                                      \
+		if (!list->isBorrowed) {                                                   \
+			free(list->data);                                                      \
+		}                                                                          \
+	}                                                                              \
+                                                                                   \
+	/* Makes room for one more element, moving a borrowed buffer to the heap */    \
+	PRIVATE void grow##type##List(type##List* list) {                              \
+		if (list->size < list->capacity) {                                         \
+			return;                                                                \
+		}                                                                          \
+                                                                                   \
+		list->capacity = list->capacity == 0 ? 8 : list->capacity * 2;             \
+		if (list->isBorrowed) {                                                    \
+			type* data = malloc(sizeof(type) * list->capacity);                    \
+			memcpy(data, list->data, sizeof(type) * list->size);                   \
+			list->data = data;                                                     \
+			list->isBorrowed = false;                                              \
+			return;                                                                \
+		}                                                                          \
+                                                                                   \
+		list->data = (type*) realloc(list->data, sizeof(type) * list->capacity);   \
+	}                                                                              \
+                                                                                   \
+	void appendTo##type##List(type##List* list, type value) {                      \
+		grow##type##List(list);                                                    \
+		list->data[list->size] = value;                                            \
+		list->size++;                                                              \
+	}                                                                              \
+                                                                                   \
+	void prependTo##type##List(type##List* list, type value) {                     \
+		grow##type##List(list);                                                    \
+                                                                                   \
+		for (unsigned long index = list->size; index > 0; index--) {               \
+			list->data[index] = list->data[index - 1];                             \
+		}                                                                          \
+                                                                                   \
+		list->data[0] = value;                                                     \
+		list->size++;                                                              \
+	}                                                                              \
+                                                                                   \
+	void pop##type##List(type##List* list) {                                       \
+		for (unsigned long index = 0; index < list->size - 1; index++) {           \
+			list->data[index] = list->data[index + 1];                             \
+		}                                                                          \
+                                                                                   \
+		list->size--;                                                              \
+	}                                                                              \
+                                                                                   \
+	int is##type##ListEmpty(type##List list) {                                     \
+		return list.size == 0;                                                     \
+	}                                                                              \
+                                                                                   \
+	type getFrom##type##ListUnchecked(type##List list, unsigned long index) {      \
+		return list.data[index];                                                   \
 	}
 
 /**
@@ -0,0 +1,81 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include "sugar.h"
+
+/**
+ * A slot of a map's entry array.
+ */
+typedef struct {
+	Value key;
+	Value value;
+	uint32_t hash;
+
+	/**
+	 * One more than how far this entry sits from the slot its hash prefers, or `0`
+	 * if the slot is empty.
+	 */
+	uint32_t distance;
+} MapEntry;
+
+/**
+ * A hash map from any value other than an unfrozen list or map to any value,
+ * created by `hash_map()`. Keys compare with `valuesEqual()`. Entries live in a single
+ * open-addressing array using Robin Hood hashing: an entry being inserted takes
+ * the slot of any entry that's closer to its preferred slot than the new one is,
+ * which keeps every probe sequence short.
+ */
+typedef struct {
+	HeapObject header;
+	MapEntry* entries;
+
+	/** The length of `entries`; always a power of two. */
+	unsigned long capacity;
+	unsigned long count;
+} HeapMap;
+
+KleinResult mapValue(Value* output);
+
+/**
+ * Hashes a value that's about to be added as a key of a map.
+ *
+ * # Errors
+ *
+ * If the value can't be a key, an error is returned.
+ */
+KleinResult hashMapKey(Value key, uint32_t* output);
+KleinResult getMap(Value value, HeapMap** output);
+bool isMap(Value value);
+
+/**
+ * Looks up a key in a map. Any value can be looked up, including ones that can't
+ * be added as keys.
+ *
+ * # Parameters
+ *
+ * - `map` - The map to look in.
+ * - `key` - The key to look up.
+ * - `output` - Where to place the value, if the key is present.
+ * - `isFound` - Set to whether the key is present.
+ */
+KleinResult mapGet(HeapMap* map, Value key, Value* output, bool* isFound);
+
+/**
+ * Sets the value of a key in a map, adding the key if it isn't present.
+ *
+ * # Errors
+ *
+ * If the key can't be hashed or the map is frozen, an error is returned.
+ */
+KleinResult mapSet(HeapMap* map, Value key, Value value);
+
+/**
+ * Removes a key from a map, setting `wasPresent` to whether it was there.
+ *
+ * # Errors
+ *
+ * If the map is frozen, an error is returned.
+ */
+KleinResult mapDelete(HeapMap* map, Value key, bool* wasPresent);
+
+#endif
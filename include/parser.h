@@ -4,8 +4,5 @@
 #include "./klein.h"
 #include "util.h"
 
-bool hasInternal(Value value, InternalKey key);
-KleinResult getValueInternal(Value value, InternalKey key, void** output);
-KleinResult getValueField(Value value, String name, Value** output);
 
 #endif
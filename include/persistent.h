@@ -0,0 +1,167 @@
+#ifndef PERSISTENT_H
+#define PERSISTENT_H
+
+#include "sugar.h"
+
+// Vectors -----------------------------------------------------------------------------------------------------------------------------------------
+
+#define VECTOR_BITS 5
+#define VECTOR_BRANCHING (1 << VECTOR_BITS)
+#define VECTOR_MASK (VECTOR_BRANCHING - 1)
+
+/**
+ * A node of a vector's trie. Nodes at the bottom level hold elements, and the
+ * rest hold child nodes. Nodes are never changed once they're part of a vector,
+ * so any number of vectors can share them.
+ */
+typedef struct VectorNode {
+	HeapObject header;
+	union {
+		struct VectorNode* children[VECTOR_BRANCHING];
+		Value values[VECTOR_BRANCHING];
+	};
+} VectorNode;
+
+/**
+ * An immutable list created by `vector()`. "Changing" a vector creates a new one
+ * that shares all but the path to the changed element with the old one, so
+ * keeping every version of a vector around costs little more than keeping the
+ * latest.
+ *
+ * Elements live in a 32-way trie, so reading or replacing one takes
+ * `O(log32 n)`. The last 32 elements are kept outside the trie in `tail`, so
+ * adding and removing at the end usually only copies the tail.
+ */
+typedef struct {
+	HeapObject header;
+	unsigned long count;
+
+	/** How far the index of an element is shifted to find its slot in `root`. */
+	unsigned int shift;
+	VectorNode* root;
+
+	/**
+	 * The last elements, of which there are `count - vectorTailOffset()`. Slots
+	 * after them may hold elements another vector has added or removed.
+	 */
+	VectorNode* tail;
+} HeapVector;
+
+/**
+ * Creates an empty vector.
+ */
+KleinResult vectorValue(Value* output);
+KleinResult getVector(Value value, HeapVector** output);
+bool isVector(Value value);
+
+/**
+ * Gets the element at the given index of a vector.
+ *
+ * # Errors
+ *
+ * If the index isn't a whole number within the bounds of the vector, an error is returned.
+ */
+KleinResult vectorGet(HeapVector* vector, double index, Value* output);
+
+/**
+ * Creates a vector like the given one with a value added to its end.
+ */
+KleinResult vectorConj(HeapVector* vector, Value value, Value* output);
+
+/**
+ * Creates a vector like the given one with the element at an index replaced. An
+ * index equal to the vector's length adds the value to the end.
+ *
+ * # Errors
+ *
+ * If the index isn't a whole number from `0` to the vector's length, an error is returned.
+ */
+KleinResult vectorAssoc(HeapVector* vector, double index, Value value, Value* output);
+
+/**
+ * Creates a vector like the given one without its last element.
+ *
+ * # Errors
+ *
+ * If the vector is empty, an error is returned.
+ */
+KleinResult vectorPop(HeapVector* vector, Value* output);
+
+// Persistent maps ---------------------------------------------------------------------------------------------------------------------------------
+
+typedef struct HamtNode HamtNode;
+
+/**
+ * A slot of a `HamtNode`: either an entry or, if `node` isn't `NULL`, a child
+ * node holding every entry whose hash continues the path to this slot.
+ */
+typedef struct {
+	Value key;
+	Value value;
+	HamtNode* node;
+	uint32_t hash;
+} HamtSlot;
+
+/**
+ * A node of a persistent map's hash array mapped trie. Each level of the trie
+ * uses the next 5 bits of a key's hash to pick one of 32 slots, and `bitmap`
+ * records which slots are present so only those are stored, in order. Below the
+ * last level, keys whose hashes are all equal share a node whose slots are
+ * searched in turn.
+ */
+struct HamtNode {
+	HeapObject header;
+	uint32_t bitmap;
+	uint32_t length;
+	HamtSlot slots[];
+};
+
+/**
+ * An immutable map created by `persistent_map()`. Like vectors, adding or
+ * removing a key creates a new map that shares everything but the path to the
+ * key's entry with the old one, taking `O(log32 n)`. Keys compare and hash as
+ * they do in a `HeapMap`.
+ */
+typedef struct {
+	HeapObject header;
+
+	/** The root node, or `NULL` if the map is empty. */
+	HamtNode* root;
+	unsigned long count;
+} HeapPersistentMap;
+
+/**
+ * Creates an empty persistent map.
+ */
+KleinResult persistentMapValue(Value* output);
+KleinResult getPersistentMap(Value value, HeapPersistentMap** output);
+bool isPersistentMap(Value value);
+
+/**
+ * Looks up a key in a persistent map, setting `isFound` to whether it's present.
+ * Any value can be looked up, including ones that can't be added as keys.
+ */
+KleinResult persistentMapGet(HeapPersistentMap* map, Value key, Value* output, bool* isFound);
+
+/**
+ * Creates a persistent map like the given one with a key set to a value.
+ *
+ * # Errors
+ *
+ * If the key can't be hashed, an error is returned.
+ */
+KleinResult persistentMapAssoc(HeapPersistentMap* map, Value key, Value value, Value* output);
+
+/**
+ * Creates a persistent map like the given one without a key. If the key isn't
+ * present, the map itself is returned.
+ */
+KleinResult persistentMapDissoc(HeapPersistentMap* map, Value key, Value* output);
+
+/**
+ * Appends the keys and values of a persistent map to `keys` and `values`, in the
+ * same order. Either list may be `NULL` if it isn't needed.
+ */
+void persistentMapEntries(HeapPersistentMap* map, ValueList* keys, ValueList* values);
+
+#endif
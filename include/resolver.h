@@ -0,0 +1,30 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include "./klein.h"
+
+/**
+ * Resolves every variable reference in the given program to a local slot or an
+ * upvalue, and records which variables each function captures. This must run
+ * once after parsing and before the program is evaluated.
+ *
+ * # Errors
+ *
+ * If a variable is referenced that isn't declared in any enclosing scope, an
+ * error is returned.
+ */
+KleinResult resolveProgram(Program* program);
+
+/**
+ * Resolves a standalone expression, as parsed by `parseKleinExpression()`. The
+ * expression can't refer to any variables outside of itself.
+ *
+ * # Errors
+ *
+ * If a variable is referenced that isn't declared within the expression, an error
+ * is returned. If the expression declares variables outside of a function body,
+ * an error is returned, since it has no frame of its own to store them in.
+ */
+KleinResult resolveStandaloneExpression(Expression* expression);
+
+#endif
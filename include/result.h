@@ -10,6 +10,19 @@
 bool isOk(KleinResult result);
 bool isError(KleinResult result);
 
+/**
+ * Frees whatever an error allocated to describe itself, for errors that are
+ * ignored rather than reported. Does nothing for successful results.
+ */
+void freeResult(KleinResult result);
+
+/**
+ * Prints a one-line description of an error, like `Error: Undefined variable "x".`,
+ * to standard error. Standard output is flushed first so that the error appears
+ * after everything the program printed before it.
+ */
+void printError(KleinResult result);
+
 extern KleinResult OK;
 
 #define TRY(expression__)                     \
@@ -5,6 +5,33 @@
 #include "result.h"
 
 KleinResult evaluateExpression(Expression expression, Value* output);
+
+/**
+ * Calls a function value, whether it's a Klein closure, a built-in function, or a
+ * built-in method bound to a receiver.
+ *
+ * # Parameters
+ *
+ * - `function` - The function to call.
+ * - `arguments` - The arguments to call it with. A bound method's receiver is
+ *   prepended to this list.
+ * - `output` - Where to place the function's return value.
+ *
+ * # Errors
+ *
+ * If `function` isn't callable, or is called with the wrong number of arguments,
+ * an error is returned.
+ */
+KleinResult callFunction(Value function, ValueList* arguments, Value* output);
+
+/**
+ * Runs a resolved program, stopping at the first statement that fails.
+ *
+ * # Errors
+ *
+ * If a statement fails, including one inside a called function, its error is
+ * returned.
+ */
 KleinResult run(Program program);
 
 #endif
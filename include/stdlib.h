@@ -4,6 +4,14 @@
 #define STDLIB                                                             \
 	"let print = builtin(\"print\");"                                      \
 	"let input = builtin(\"input\");"                                      \
+	"let string_builder = builtin(\"string_builder\");"                    \
+	"let lines = builtin(\"lines\");"                                      \
+	"let hash_map = builtin(\"hash_map\");"                                \
+	"let freeze = builtin(\"freeze\");"                                    \
+	"let vector = builtin(\"vector\");"                                    \
+	"let persistent_map = builtin(\"persistent_map\");"                    \
+	"let set_maximum_pause = builtin(\"set_maximum_pause\");"              \
+	"let set_collector_threads = builtin(\"set_collector_threads\");"      \
 	""                                                                     \
 	""                                                                     \
 	"let list_contains = function(list: List, value: Anything): Boolean {" \
@@ -1,30 +1,592 @@
 #ifndef SUGAR_H
 #define SUGAR_H
 
+#include "builtin.h"
+#include "context.h"
 #include "parser.h"
 #include "result.h"
 
+/*
+ * Value encoding.
+ *
+ * A `Value` whose quiet NaN bits aren't all set is a `double`. Otherwise, if the
+ * sign bit is set, the low 48 bits are a pointer to a `HeapObject`; if it isn't and
+ * `INTEGER_TAG` is set, the low 48 bits are a two's complement integer; and if
+ * neither is set, the low bits are one of the fixed tags below. Numbers that are
+ * themselves NaN are canonicalized when boxed so they can't be mistaken for
+ * anything else.
+ *
+ * Every whole number that fits in 48 bits is stored as an integer, and every
+ * other number as a `double`, so each number has exactly one encoding.
+ */
+
+#define SIGN_BIT ((uint64_t) 0x8000000000000000)
+#define QUIET_NAN ((uint64_t) 0x7ffc000000000000)
+#define INTEGER_TAG ((uint64_t) 0x0001000000000000)
+#define PAYLOAD_MASK ((uint64_t) 0x0000ffffffffffff)
+
+#define NULL_TAG ((uint64_t) 1)
+#define FALSE_TAG ((uint64_t) 2)
+#define TRUE_TAG ((uint64_t) 3)
+#define UNDECLARED_TAG ((uint64_t) 4)
+
+#define NULL_VALUE ((Value) {.bits = QUIET_NAN | NULL_TAG})
+#define FALSE_VALUE ((Value) {.bits = QUIET_NAN | FALSE_TAG})
+#define TRUE_VALUE ((Value) {.bits = QUIET_NAN | TRUE_TAG})
+
+/** Held by a top-level variable's slot until its declaration runs. Klein code never sees it. */
+#define UNDECLARED_VALUE ((Value) {.bits = QUIET_NAN | UNDECLARED_TAG})
+
+#define MAX_INTEGER ((int64_t) 0x00007fffffffffff)
+#define MIN_INTEGER (-MAX_INTEGER - 1)
+
+#define IS_DOUBLE(value__) (((value__).bits & QUIET_NAN) != QUIET_NAN)
+#define IS_INTEGER(value__) (((value__).bits & (SIGN_BIT | QUIET_NAN | INTEGER_TAG)) == (QUIET_NAN | INTEGER_TAG))
+#define IS_NUMBER(value__) (IS_DOUBLE(value__) || IS_INTEGER(value__))
+#define AS_INTEGER(value__) (((int64_t) ((value__).bits << 16)) >> 16)
+#define INTEGER_VALUE(integer__) ((Value) {.bits = QUIET_NAN | INTEGER_TAG | ((uint64_t) (integer__) & PAYLOAD_MASK)})
+#define IS_OBJECT(value__) (((value__).bits & (QUIET_NAN | SIGN_BIT)) == (QUIET_NAN | SIGN_BIT))
+#define AS_OBJECT(value__) ((HeapObject*) (uintptr_t) ((value__).bits & ~(SIGN_BIT | QUIET_NAN)))
+#define OBJECT_VALUE(object__) ((Value) {.bits = SIGN_BIT | QUIET_NAN | (uint64_t) (uintptr_t) (object__)})
+
+/**
+ * Returns an error from the current function if a heap object is frozen.
+ */
+#define EXPECT_UNFROZEN(object__)                        \
+	do {                                                 \
+		if ((object__)->header.isFrozen) {               \
+			return (KleinResult) {                       \
+				.type = KLEIN_ERROR_MUTATE_FROZEN_VALUE, \
+			};                                           \
+		}                                                \
+	} while (false)
+
+// Shapes ------------------------------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+	String name;
+	Shape* shape;
+} ShapeTransition;
+
+DEFINE_KLEIN_LIST(ShapeTransition);
+
+/**
+ * The layout of a record: which field lives in which slot. Records created with
+ * the same field names in the same order share a shape, because shapes are only
+ * ever created by adding a field to an existing shape through `shapeWithField()`,
+ * which reuses the result for the same name.
+ */
+struct Shape {
+
+	/** The names of the fields of records with this shape, indexed by slot. */
+	StringList fieldNames;
+
+	/** The shapes made by adding one more field to this one. */
+	ShapeTransitionList transitions;
+};
+
+/**
+ * Returns the shape of records with no fields.
+ */
+Shape* emptyShape(void);
+
+/**
+ * Returns the shape made by adding a field with the given name after the fields
+ * of `shape`, creating it the first time it's asked for.
+ */
+Shape* shapeWithField(Shape* shape, String name);
+
+/**
+ * Finds the slot of the field with the given name in records of the given shape.
+ *
+ * # Returns
+ *
+ * Whether the shape has a field with that name.
+ */
+bool getShapeSlot(Shape* shape, String name, unsigned long* output);
+
+// Heap objects ------------------------------------------------------------------------------------------------------------------------------------
+
+/**
+ * An immutable string. The characters are stored inline after the header, so a
+ * string is a single allocation however long it is. The hash is computed the
+ * first time it's needed and cached.
+ */
+typedef struct {
+	HeapObject header;
+	unsigned long length;
+	uint32_t hash;
+	bool isHashed;
+	char characters[];
+} HeapString;
+
+/**
+ * The concatenation of two strings, created by `+`. The characters aren't copied
+ * until something needs to read them, at which point the rope is flattened into
+ * a `HeapString` once and remembers it. Repeatedly appending to a string in a
+ * loop therefore takes linear rather than quadratic time.
+ */
+typedef struct {
+	HeapObject header;
+	unsigned long length;
+
+	/** The halves of the rope, or `NULL_VALUE` once it has been flattened. */
+	Value left;
+	Value right;
+
+	/** The flattened string, or `NULL` if it hasn't been read yet. */
+	HeapString* flattened;
+} HeapRope;
+
+/**
+ * Part of another string, created by `String.slice`. The characters are read from
+ * the parent string in place; like a rope, the slice is only copied into a
+ * `HeapString` of its own when something needs a null-terminated string, after
+ * which it no longer keeps its parent alive.
+ */
+typedef struct {
+	HeapObject header;
+
+	/** The string the slice is part of, or the slice's own copy once it has been flattened. */
+	HeapString* parent;
+	unsigned long offset;
+	unsigned long length;
+} HeapStringSlice;
+
+/**
+ * A mutable buffer for building up a string, created by `string_builder()`.
+ */
+typedef struct {
+	HeapObject header;
+	char* characters;
+	unsigned long length;
+	unsigned long capacity;
+} HeapStringBuilder;
+
+/**
+ * What the elements of a list are known to be. Numbers are stored unboxed, so a
+ * list of numbers is a packed array of 8-byte values that can be formatted or
+ * summed without checking each element's type. Booleans are packed further, into
+ * a single bit each.
+ */
+typedef enum {
+	LIST_ELEMENTS_NUMBERS,
+	LIST_ELEMENTS_BOOLEANS,
+	LIST_ELEMENTS_VALUES
+} ListElementKind;
+
+#define BITS_PER_WORD 64
+
+/**
+ * A growable array of bits, with `size` and `capacity` counted in bits.
+ * `capacity` is always a multiple of `BITS_PER_WORD`.
+ */
+typedef struct {
+	uint64_t* words;
+	unsigned long size;
+	unsigned long capacity;
+} BitList;
+
+/**
+ * The elements of one or more lists. Copying a list shares its storage, and a
+ * list only copies the storage when it's changed while shared, so a copy costs
+ * the same however long the list is. Storage is freed by the garbage collector
+ * once no list uses it.
+ */
+typedef struct {
+	HeapObject header;
+
+	/**
+	 * The number of lists sharing this storage, or `FROZEN_REFERENCES` if it
+	 * belongs to a frozen list and so is never changed.
+	 */
+	unsigned long references;
+
+	/**
+	 * `LIST_ELEMENTS_NUMBERS` until the first element that isn't a number is added,
+	 * or `LIST_ELEMENTS_BOOLEANS` for a list that has only ever held booleans.
+	 */
+	ListElementKind kind;
+
+	/** The elements, unless they're booleans. */
+	ValueList elements;
+
+	/** The elements of a `LIST_ELEMENTS_BOOLEANS` storage, with `1` for `true`. */
+	BitList bits;
+} ListStorage;
+
+#define FROZEN_REFERENCES ((unsigned long) -1)
+
+/**
+ * A list, or a view of part of another list's storage created by `List.slice`.
+ * A list only changes its storage in place when it's the only list using the
+ * storage; otherwise it first copies its own elements out.
+ *
+ * The storage can have free room both before and after the list's elements, so
+ * adding or removing elements at either end takes amortized constant time while
+ * the elements stay contiguous for indexing.
+ */
+typedef struct {
+	HeapObject header;
+	ListStorage* storage;
+
+	/** The position of the list's first element in the storage. */
+	unsigned long offset;
+	unsigned long length;
+} HeapList;
+
+/**
+ * The numbers from `low` up to `high` in steps of one, created by `Number.to`.
+ * `for` loops count through a range without creating its elements; anything
+ * else that needs it as a list materializes it once.
+ */
+typedef struct {
+	HeapObject header;
+	double low;
+	double high;
+
+	/** The range as a list, or `NULL` if it hasn't been needed as one yet. */
+	HeapList* materialized;
+} HeapRange;
+
+/**
+ * A value created by an object literal. Field values are stored in `slots` in the
+ * order given by `shape`.
+ */
+typedef struct {
+	HeapObject header;
+	Shape* shape;
+	Value slots[];
+} HeapRecord;
+
+typedef struct {
+	HeapObject header;
+	BuiltinFunction function;
+} HeapBuiltinFunction;
+
+/**
+ * A built-in method read off of a value, such as `list.append`, which passes the
+ * value it was read from as the first argument when called.
+ */
+typedef struct {
+	HeapObject header;
+	Value receiver;
+	Value method;
+} HeapBoundMethod;
+
+/**
+ * Allocates a heap object of the given type and size, with its header filled in,
+ * and records it in the current context's heap. `size` is the size of the whole
+ * object, including the header.
+ */
+HeapObject* allocateObject(HeapObjectType type, size_t size);
+bool isObjectOfType(Value value, HeapObjectType type);
+
+/**
+ * Marks a single object as frozen, without touching anything it refers to. A
+ * frozen list's storage is marked too, so every view of it copies before writing.
+ * Use `freezeValue()` to freeze a value deeply.
+ */
+void freezeObject(HeapObject* object);
+
+/**
+ * Returns whether a value can never change. Values that aren't heap objects are
+ * always frozen.
+ */
+bool isFrozen(Value value);
+
+// Interning ---------------------------------------------------------------------------------------------------------------------------------------
+
+/**
+ * An open-addressing hash set of strings, holding one canonical copy of each
+ * name or string literal in the program. Two interned strings are equal exactly
+ * when they're the same pointer, so lookups by interned name never compare
+ * characters. The table is a root of the garbage collector, so interned
+ * strings live as long as the context.
+ */
+struct InternTable {
+	HeapString** entries;
+	unsigned long capacity;
+	unsigned long count;
+};
+
+/**
+ * Returns the canonical string with the given characters, adding it to the
+ * current context's intern table the first time it's seen. Interned strings
+ * always have their hash computed.
+ */
+HeapString* internString(const char* characters, unsigned long length);
+
+/**
+ * Returns the characters of the canonical copy of `name`. Names returned from
+ * here can be compared with `==`.
+ */
+String internName(String name);
+
+/**
+ * Returns the string object that an interned name is the characters of.
+ * `name` must have been returned by `internName()`.
+ */
+HeapString* internedString(String name);
+
+void freeInternTable(InternTable* table);
+
+// Values ------------------------------------------------------------------------------------------------------------------------------------------
+
 KleinResult stringValue(String value, Value* output);
-KleinResult getString(Value value, String** output);
+
+/**
+ * Creates a string value from the first `length` characters of `characters`,
+ * which don't need to be null-terminated.
+ */
+KleinResult stringValueOfLength(const char* characters, unsigned long length, Value* output);
+
+/**
+ * Returns the characters of a string value. Ropes are flattened first.
+ */
+KleinResult getString(Value value, String* output);
+KleinResult getStringObject(Value value, HeapString** output);
+
+/**
+ * Returns the characters of a string value without requiring them to be
+ * null-terminated, so slices are read in place. Ropes are flattened first.
+ * There are `stringValueLength()` characters.
+ */
+KleinResult getStringCharacters(Value value, const char** output);
+
+/**
+ * Returns whether the value is a string, either flat, a rope or a slice.
+ */
 bool isString(Value value);
 
+/**
+ * Returns the length of a string value without flattening it.
+ */
+unsigned long stringValueLength(Value value);
+
+/**
+ * Returns the characters of a string value from `start` up to but not including
+ * `end`. Long results share the characters of the string; short ones are copied.
+ *
+ * # Errors
+ *
+ * If the bounds aren't whole numbers with `0 <= start <= end <= length`, an error is returned.
+ */
+KleinResult sliceString(Value string, double start, double end, Value* output);
+
+/**
+ * Concatenates two string values. Short results are copied into a new string
+ * straight away; longer ones become a rope.
+ */
+KleinResult concatenateStrings(Value left, Value right, Value* output);
+
+/**
+ * Returns the FNV-1a hash of the given string, computing it on first use.
+ */
+uint32_t stringHash(HeapString* string);
+
+/**
+ * Returns whether two strings have the same characters. Strings of different
+ * lengths, or whose hashes are both known and differ, are rejected without
+ * comparing characters.
+ */
+bool stringsAreEqual(HeapString* left, HeapString* right);
+
+/**
+ * Creates a number value, storing it as an integer if it's a whole number in the
+ * integer range.
+ */
 KleinResult numberValue(double value, Value* output);
-KleinResult getNumber(Value value, double** output);
+
+/**
+ * Creates a number value from an integer, storing it as a `double` if it's
+ * outside the integer range.
+ */
+KleinResult integerValue(int64_t value, Value* output);
+
+/**
+ * Returns the value of a number, whichever way it's stored.
+ */
+KleinResult getNumber(Value value, double* output);
 bool isNumber(Value value);
 
+/**
+ * Returns whether the value is a number stored as an integer. Whole numbers
+ * outside the integer range are stored as `double`s and aren't.
+ */
+bool isInteger(Value value);
+
+KleinResult stringBuilderValue(Value* output);
+KleinResult getStringBuilder(Value value, HeapStringBuilder** output);
+bool isStringBuilder(Value value);
+void appendToStringBuilder(HeapStringBuilder* builder, const char* characters, unsigned long length);
+
 KleinResult listValue(ValueList values, Value* output);
-KleinResult getList(Value value, ValueList** output);
+
+/**
+ * Returns the list a value is. Ranges are materialized first.
+ */
+KleinResult getList(Value value, HeapList** output);
+
+/**
+ * Returns whether the value is a list, including a range.
+ */
 bool isList(Value value);
 
+KleinResult rangeValue(double low, double high, Value* output);
+
+/**
+ * Returns the range a value is, or `NULL` if it isn't a range or has already
+ * been materialized into a list.
+ */
+HeapRange* getUnmaterializedRange(Value value);
+
+/**
+ * Creates a list with the same elements as the given one. The two share storage
+ * until either is changed.
+ */
+KleinResult copyList(HeapList* list, Value* output);
+
+/**
+ * Creates a view of the elements of a list from `start` up to but not including
+ * `end`, sharing the list's storage.
+ *
+ * # Errors
+ *
+ * If the bounds aren't whole numbers with `0 <= start <= end <= length`, an error is returned.
+ */
+KleinResult sliceList(HeapList* list, double start, double end, Value* output);
+
+/**
+ * Returns the elements of a list. There are `list->length` of them. A list of
+ * booleans packed into bits has no array of values, so read it with
+ * `listElement()` instead.
+ */
+Value* listElements(HeapList* list);
+
+/**
+ * Returns the element at an index of a list, which must be less than its length.
+ */
+Value listElement(HeapList* list, unsigned long index);
+
+/**
+ * Counts the elements of a list that are `true`. Booleans packed into bits are
+ * counted a word at a time.
+ */
+unsigned long countTrueInList(HeapList* list);
+
+/**
+ * An operation applied to each element of a list of booleans, or to each pair
+ * of elements at the same index of two such lists.
+ */
+typedef enum {
+	BOOLEAN_OPERATION_AND,
+	BOOLEAN_OPERATION_OR,
+	BOOLEAN_OPERATION_XOR,
+	BOOLEAN_OPERATION_NOT
+} BooleanOperation;
+
+/**
+ * Creates a list of booleans by applying an operation to the elements of `left`
+ * and, unless the operation is `BOOLEAN_OPERATION_NOT`, `right`. The elements
+ * are combined 64 at a time.
+ *
+ * # Errors
+ *
+ * If either list has an element that isn't a boolean, or the lists' lengths
+ * differ, an error is returned.
+ */
+KleinResult combineBooleanLists(BooleanOperation operation, HeapList* left, HeapList* right, Value* output);
+
+/**
+ * Appends a value to a list, generalizing its element kind if needed.
+ *
+ * # Errors
+ *
+ * If the list is frozen, an error is returned.
+ */
+KleinResult appendToList(HeapList* list, Value value);
+
+/**
+ * Adds a value to the front of a list, generalizing its element kind if needed.
+ *
+ * # Errors
+ *
+ * If the list is frozen, an error is returned.
+ */
+KleinResult prependToList(HeapList* list, Value value);
+
+/**
+ * Removes and returns the first element of a list.
+ *
+ * # Errors
+ *
+ * If the list is empty or frozen, an error is returned.
+ */
+KleinResult popFrontOfList(HeapList* list, Value* output);
+
+/**
+ * Removes and returns the last element of a list.
+ *
+ * # Errors
+ *
+ * If the list is empty or frozen, an error is returned.
+ */
+KleinResult popBackOfList(HeapList* list, Value* output);
+
+/**
+ * Reads the element at the given index of a list.
+ *
+ * # Errors
+ *
+ * If the index isn't a whole number within the bounds of the list, an error is returned.
+ */
+KleinResult getListElement(HeapList* list, double index, Value* output);
+
+/**
+ * Replaces the element at the given index of a list.
+ *
+ * # Errors
+ *
+ * If the index isn't a whole number within the bounds of the list, or the list
+ * is frozen, an error is returned.
+ */
+KleinResult setListElement(HeapList* list, double index, Value value);
+
 KleinResult booleanValue(bool value, Value* output);
-KleinResult getBoolean(Value value, bool** output);
+KleinResult getBoolean(Value value, bool* output);
 bool isBoolean(Value vaue);
 
-KleinResult functionValue(Function value, Value* output);
-KleinResult getFunction(Value value, Function** output);
+/**
+ * Creates a record of the given shape, with one value per field of the shape
+ * copied from `slots`.
+ */
+KleinResult recordValue(Shape* shape, Value* slots, Value* output);
+bool isRecord(Value value);
+
+KleinResult functionValue(Closure* value, Value* output);
+KleinResult getFunction(Value value, Closure** output);
+
+KleinResult builtinFunctionValue(BuiltinFunction function, Value* output);
+KleinResult getBuiltinFunction(Value value, BuiltinFunction* output);
 bool isBuiltinFunction(Value value);
 
+KleinResult boundMethodValue(Value receiver, Value method, Value* output);
+KleinResult getBoundMethod(Value value, HeapBoundMethod** output);
+bool isBoundMethod(Value value);
+
 KleinResult nullValue(Value* output);
 bool isNull(Value value);
 
+/**
+ * Reads the field with the given name off of a value. For records, this is one of
+ * the fields the record was created with; for other values, it's one of the
+ * built-in methods shared by every value of its type. `name` must be interned.
+ *
+ * # Errors
+ *
+ * If the value has no field with the given name, an error is returned.
+ */
+KleinResult getValueField(Value value, String name, Value* output);
+
 #endif
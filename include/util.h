@@ -2,6 +2,7 @@
 #define UTIL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -53,6 +54,11 @@ typedef char* String;
 
 void debug(String message);
 
+/**
+ * Returns the number of bits that are set in `word`.
+ */
+unsigned int countSetBits(uint64_t word);
+
 typedef struct Context Context;
 extern Context* CONTEXT;
 
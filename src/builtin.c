@@ -1,8 +1,17 @@
 #include "../include/builtin.h"
+#include "../include/equality.h"
+#include "../include/freeze.h"
+#include "../include/gc.h"
+#include "../include/iterator.h"
 #include "../include/list.h"
+#include "../include/map.h"
 #include "../include/parser.h"
+#include "../include/persistent.h"
 #include "../include/result.h"
+#include "../include/runner.h"
 #include "../include/sugar.h"
+#include <inttypes.h>
+#include <limits.h>
 #include <math.h>
 #include <string.h>
 
@@ -41,14 +50,13 @@ PRIVATE KleinResult input(ValueList* arguments, Value* output) {
 		};
 	}
 
-	String defaultPrompt = "";
-	String* prompt = &defaultPrompt;
+	String prompt = "";
 	if (arguments->size == 1) {
 		TRY(getString(arguments->data[0], &prompt));
 	};
 
 	// Print prompt
-	printf("%s", *prompt);
+	printf("%s", prompt);
 	fflush(stdout);
 
 	// Read from stdin
@@ -75,76 +83,197 @@ PRIVATE KleinResult stringLength(ValueList* arguments, Value* output) {
 		};
 	}
 
-	TRY_LET(String * stringValue, getString(arguments->data[0], &stringValue));
-	TRY_LET(Value number, numberValue(strlen(*stringValue), &number));
+	if (!isString(arguments->data[0])) {
+		UNREACHABLE;
+	}
+	TRY_LET(Value number, numberValue(stringValueLength(arguments->data[0]), &number));
 
 	RETURN_OK(output, number);
 }
 
-PRIVATE KleinResult listAppend(ValueList* arguments, Value* output) {
-	SUPPRESS_UNUSED(output);
-
-	if (arguments->size != 2) {
+/**
+ * Returns an error unless exactly `expected` arguments were passed.
+ */
+PRIVATE KleinResult expectArgumentCount(ValueList* arguments, unsigned long expected) {
+	if (arguments->size != expected) {
 		return (KleinResult) {
 			.type = KLEIN_ERROR_INCORRECT_ARGUMENT_COUNT,
 			.data = (KleinResultData) {
 				.incorrectArgumentCount = (KleinIncorrectArgumentCountError) {
-					.expected = 2,
+					.expected = expected,
 					.actual = arguments->size,
 				},
 			},
 		};
 	}
 
-	TRY_LET(ValueList * elements, getList(arguments->data[0], &elements));
-	appendToValueList(elements, arguments->data[1]);
-
 	return OK;
 }
 
+PRIVATE KleinResult listAppend(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 2));
+	TRY_LET(HeapList * list, getList(arguments->data[0], &list));
+	TRY(appendToList(list, arguments->data[1]));
+
+	return nullValue(output);
+}
+
+/**
+ * Writes a number the way Klein prints it into `buffer`, returning the number of
+ * characters written (or that would have been, if `size` is too small).
+ */
+PRIVATE int formatNumber(Value value, char* buffer, size_t size) {
+	if (isInteger(value)) {
+		return snprintf(buffer, size, "%" PRId64, AS_INTEGER(value));
+	}
+
+	UNWRAP_LET(double number, getNumber(value, &number));
+
+	// Integer
+	if (floor(number) == number) {
+		return snprintf(buffer, size, "%.0f", number);
+	}
+
+	return snprintf(buffer, size, "%f", number);
+}
+
+/**
+ * Converts a value into the string that Klein prints for it. The characters belong
+ * to an object on the heap, so the caller must not free them. They stay valid until
+ * the next collection, which can't happen before the current statement finishes.
+ */
 KleinResult valueToString(Value value, String* output) {
 	if (isNumber(value)) {
-		UNWRAP_LET(double* number, getNumber(value, &number));
-
-		// Integer
-		if (floor(*number) == *number) {
-			String result;
-			FORMAT(result, "%d", (int) *number);
-			RETURN_OK(output, result);
+		char buffer[32];
+		int length = formatNumber(value, buffer, sizeof(buffer));
+		Value string;
+		if ((size_t) length < sizeof(buffer)) {
+			TRY(stringValueOfLength(buffer, (unsigned long) length, &string));
 		}
 
-		int len = snprintf(NULL, 0, "%f", *number);
-		String result = malloc((unsigned long) len + 1);
-		snprintf(result, (unsigned long) len + 1, "%f", *number);
+		// Huge numbers don't fit in the buffer
+		else {
+			char* characters = malloc((unsigned long) length + 1);
+			formatNumber(value, characters, (unsigned long) length + 1);
+			KleinResult result = stringValueOfLength(characters, (unsigned long) length, &string);
+			free(characters);
+			TRY(result);
+		}
 
-		RETURN_OK(output, result);
+		return getString(string, output);
 	}
 
 	if (isString(value)) {
-		UNWRAP_LET(String * result, getString(value, &result));
-		RETURN_OK(output, *result);
+		UNWRAP_LET(String result, getString(value, &result));
+		RETURN_OK(output, result);
 	}
 
 	if (isList(value)) {
-		StringList strings = emptyStringList();
-		appendToStringList(&strings, "[");
-		UNWRAP_LET(ValueList * elements, getList(value, &elements));
-		size_t length = 0;
-		FOR_EACHP(Value element, elements) {
+		UNWRAP_LET(HeapList * list, getList(value, &list));
+		TRY_LET(Value builderValue, stringBuilderValue(&builderValue));
+		UNWRAP_LET(HeapStringBuilder * builder, getStringBuilder(builderValue, &builder));
+
+		appendToStringBuilder(builder, "[", 1);
+		for (unsigned long index = 0; index < list->length; index++) {
+			if (index > 0) {
+				appendToStringBuilder(builder, ", ", 2);
+			}
+
+			// Numbers are formatted straight into the buffer, unless they're huge
+			if (list->storage->kind == LIST_ELEMENTS_NUMBERS) {
+				char number[32];
+				int length = formatNumber(listElement(list, index), number, sizeof(number));
+				if ((size_t) length < sizeof(number)) {
+					appendToStringBuilder(builder, number, (unsigned long) length);
+					continue;
+				}
+			}
+
+			TRY_LET(String string, valueToString(listElement(list, index), &string));
+			appendToStringBuilder(builder, string, strlen(string));
+		}
+		appendToStringBuilder(builder, "]\0", 2);
+
+		RETURN_OK(output, builder->characters);
+	}
+
+	if (isMap(value)) {
+		UNWRAP_LET(HeapMap * map, getMap(value, &map));
+		TRY_LET(Value builderValue, stringBuilderValue(&builderValue));
+		UNWRAP_LET(HeapStringBuilder * builder, getStringBuilder(builderValue, &builder));
+
+		appendToStringBuilder(builder, "{", 1);
+		bool isFirst = true;
+		for (unsigned long index = 0; index < map->capacity; index++) {
+			MapEntry entry = map->entries[index];
+			if (entry.distance == 0) {
+				continue;
+			}
+			if (!isFirst) {
+				appendToStringBuilder(builder, ", ", 2);
+			}
+			isFirst = false;
+
+			TRY_LET(String key, valueToString(entry.key, &key));
+			TRY_LET(String entryValue, valueToString(entry.value, &entryValue));
+			appendToStringBuilder(builder, key, strlen(key));
+			appendToStringBuilder(builder, ": ", 2);
+			appendToStringBuilder(builder, entryValue, strlen(entryValue));
+		}
+		appendToStringBuilder(builder, "}\0", 2);
+
+		RETURN_OK(output, builder->characters);
+	}
+
+	if (isVector(value)) {
+		UNWRAP_LET(HeapVector * vector, getVector(value, &vector));
+		TRY_LET(Value builderValue, stringBuilderValue(&builderValue));
+		UNWRAP_LET(HeapStringBuilder * builder, getStringBuilder(builderValue, &builder));
+
+		appendToStringBuilder(builder, "[", 1);
+		for (unsigned long index = 0; index < vector->count; index++) {
+			if (index > 0) {
+				appendToStringBuilder(builder, ", ", 2);
+			}
+			TRY_LET(Value element, vectorGet(vector, (double) index, &element));
 			TRY_LET(String string, valueToString(element, &string));
-			appendToStringList(&strings, string);
-			length += strlen(string);
+			appendToStringBuilder(builder, string, strlen(string));
 		}
-		END;
+		appendToStringBuilder(builder, "]\0", 2);
+
+		RETURN_OK(output, builder->characters);
+	}
 
-		String result = malloc(sizeof(char) * (length + 1));
-		*result = '\0';
-		FOR_EACH(String element, strings) {
-			strcat(result, element);
+	if (isPersistentMap(value)) {
+		UNWRAP_LET(HeapPersistentMap * map, getPersistentMap(value, &map));
+		TRY_LET(Value builderValue, stringBuilderValue(&builderValue));
+		UNWRAP_LET(HeapStringBuilder * builder, getStringBuilder(builderValue, &builder));
+
+		ValueList keys = emptyValueList();
+		ValueList values = emptyValueList();
+		persistentMapEntries(map, &keys, &values);
+		appendToStringBuilder(builder, "{", 1);
+		FOR_EACH(Value key, keys) {
+			if (index__ > 0) {
+				appendToStringBuilder(builder, ", ", 2);
+			}
+			TRY_LET(String keyString, valueToString(key, &keyString));
+			TRY_LET(String valueString, valueToString(values.data[index__], &valueString));
+			appendToStringBuilder(builder, keyString, strlen(keyString));
+			appendToStringBuilder(builder, ": ", 2);
+			appendToStringBuilder(builder, valueString, strlen(valueString));
 		}
 		END;
+		appendToStringBuilder(builder, "}\0", 2);
+		freeValueList(&keys);
+		freeValueList(&values);
 
-		RETURN_OK(output, result);
+		RETURN_OK(output, builder->characters);
+	}
+
+	if (isBoolean(value)) {
+		UNWRAP_LET(bool boolean, getBoolean(value, &boolean));
+		RETURN_OK(output, boolean ? "true" : "false");
 	}
 
 	if (isNull(value)) {
@@ -155,14 +284,7 @@ KleinResult valueToString(Value value, String* output) {
 }
 
 KleinResult valuesAreEqual(Value left, Value right, Value* output) {
-	if (isNumber(left) && isNumber(right)) {
-		UNWRAP_LET(double* leftNumber, getNumber(left, &leftNumber));
-		UNWRAP_LET(double* rightNumber, getNumber(right, &rightNumber));
-		TRY_LET(Value result, booleanValue(*leftNumber == *rightNumber, &result));
-		RETURN_OK(output, result);
-	}
-
-	UNREACHABLE;
+	return booleanValue(valuesEqual(left, right), output);
 }
 
 PRIVATE KleinResult numberMod(ValueList* arguments, Value* output) {
@@ -178,11 +300,16 @@ PRIVATE KleinResult numberMod(ValueList* arguments, Value* output) {
 		};
 	}
 
-	TRY_LET(double* leftNumber, getNumber(arguments->data[0], &leftNumber));
-	TRY_LET(double* rightNumber, getNumber(arguments->data[1], &rightNumber));
+	// Integers take the remainder without converting to floating point
+	Value left = arguments->data[0];
+	Value right = arguments->data[1];
+	if (isInteger(left) && isInteger(right) && AS_INTEGER(right) != 0) {
+		return integerValue(AS_INTEGER(left) % AS_INTEGER(right), output);
+	}
 
-	double result = (int) *leftNumber % (int) *rightNumber;
-	return numberValue(result, output);
+	TRY_LET(double leftNumber, getNumber(left, &leftNumber));
+	TRY_LET(double rightNumber, getNumber(right, &rightNumber));
+	return numberValue(fmod(leftNumber, rightNumber), output);
 }
 
 /**
@@ -223,36 +350,601 @@ PRIVATE KleinResult print(ValueList* arguments, Value* output) {
 		};
 	}
 
-	// Default options
-	Value defaultOptions;
-	ValueFieldList* fields = emptyHeapValueFieldList();
-	TRY_LET(Value trueValue, booleanValue(true, &trueValue));
-	appendToValueFieldList(fields, (ValueField) {.name = "newline", .value = trueValue});
-	defaultOptions = (Value) {
-		.fields = fields,
-	};
+	TRY_LET(String stringValue, valueToString(arguments->data[0], &stringValue));
 
-	Value options;
+	// Options
+	String newline = "\n";
 	if (arguments->size == 2) {
-		options = arguments->data[1];
-	} else {
-		options = defaultOptions;
+		TRY_LET(Value useNewline, getValueField(arguments->data[1], internName("newline"), &useNewline));
+		TRY_LET(bool newlineBoolean, getBoolean(useNewline, &newlineBoolean));
+		if (!newlineBoolean) {
+			newline = "";
+		}
 	}
 
-	TRY_LET(String stringValue, valueToString(arguments->data[0], &stringValue));
+	printf("%s%s", stringValue, newline);
 
-	String newline = "\n";
-	TRY_LET(Value * useNewline, getValueField(options, "newline", &useNewline));
-	TRY_LET(bool* newlineBoolean, getBoolean(*useNewline, &newlineBoolean));
-	if (!*newlineBoolean) {
-		newline = "";
+	return OK;
+}
+
+/**
+ * `List.prepend(value)`. Like `append`, returns `null`.
+ */
+PRIVATE KleinResult listPrepend(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 2));
+	TRY_LET(HeapList * list, getList(arguments->data[0], &list));
+	TRY(prependToList(list, arguments->data[1]));
+	return nullValue(output);
+}
+
+PRIVATE KleinResult listPopFront(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	TRY_LET(HeapList * list, getList(arguments->data[0], &list));
+	return popFrontOfList(list, output);
+}
+
+PRIVATE KleinResult listPopBack(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	TRY_LET(HeapList * list, getList(arguments->data[0], &list));
+	return popBackOfList(list, output);
+}
+
+/**
+ * `List.copy()`. The copy shares the list's elements until either list changes,
+ * so copying takes constant time.
+ */
+PRIVATE KleinResult listCopy(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	TRY_LET(HeapList * list, getList(arguments->data[0], &list));
+	return copyList(list, output);
+}
+
+/**
+ * Reads the `start` and `end` arguments of `List.slice` and `String.slice`.
+ */
+PRIVATE KleinResult getSliceBounds(ValueList* arguments, double* start, double* end) {
+	TRY(expectArgumentCount(arguments, 3));
+	if (!isNumber(arguments->data[1]) || !isNumber(arguments->data[2])) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_INVALID_INDEX,
+		};
 	}
+	TRY(getNumber(arguments->data[1], start));
+	return getNumber(arguments->data[2], end);
+}
 
-	printf("%s%s", stringValue, newline);
+/**
+ * `List.slice(start, end)`. Returns a view of the elements from `start` up to but
+ * not including `end`, without copying them.
+ */
+PRIVATE KleinResult listSlice(ValueList* arguments, Value* output) {
+	double start;
+	double end;
+	TRY(getSliceBounds(arguments, &start, &end));
+	TRY_LET(HeapList * list, getList(arguments->data[0], &list));
+	return sliceList(list, start, end, output);
+}
+
+/**
+ * `List.count()`. Returns how many elements are `true`.
+ */
+PRIVATE KleinResult listCount(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	TRY_LET(HeapList * list, getList(arguments->data[0], &list));
+	return numberValue((double) countTrueInList(list), output);
+}
+
+/**
+ * Applies a boolean operation to the list a method was called on and, for the
+ * binary operations, the list passed to it.
+ */
+PRIVATE KleinResult combineListArguments(ValueList* arguments, BooleanOperation operation, Value* output) {
+	TRY(expectArgumentCount(arguments, operation == BOOLEAN_OPERATION_NOT ? 1 : 2));
+	TRY_LET(HeapList * left, getList(arguments->data[0], &left));
+	if (operation == BOOLEAN_OPERATION_NOT) {
+		return combineBooleanLists(operation, left, NULL, output);
+	}
+
+	if (!isList(arguments->data[1])) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_INVALID_ARGUMENT,
+		};
+	}
+	TRY_LET(HeapList * right, getList(arguments->data[1], &right));
+	return combineBooleanLists(operation, left, right, output);
+}
+
+/**
+ * `List.bitwise_and(other)`. Returns a new list that's `true` where both lists are.
+ */
+PRIVATE KleinResult listBitwiseAnd(ValueList* arguments, Value* output) {
+	return combineListArguments(arguments, BOOLEAN_OPERATION_AND, output);
+}
+
+PRIVATE KleinResult listBitwiseOr(ValueList* arguments, Value* output) {
+	return combineListArguments(arguments, BOOLEAN_OPERATION_OR, output);
+}
+
+PRIVATE KleinResult listBitwiseXor(ValueList* arguments, Value* output) {
+	return combineListArguments(arguments, BOOLEAN_OPERATION_XOR, output);
+}
+
+PRIVATE KleinResult listBitwiseNot(ValueList* arguments, Value* output) {
+	return combineListArguments(arguments, BOOLEAN_OPERATION_NOT, output);
+}
+
+/**
+ * `String.slice(start, end)`. Returns the characters from `start` up to but not
+ * including `end`.
+ */
+PRIVATE KleinResult stringSlice(ValueList* arguments, Value* output) {
+	double start;
+	double end;
+	TRY(getSliceBounds(arguments, &start, &end));
+	return sliceString(arguments->data[0], start, end, output);
+}
+
+/**
+ * The built-in `string_builder` function, which creates an empty string builder.
+ */
+PRIVATE KleinResult stringBuilder(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 0));
+	return stringBuilderValue(output);
+}
+
+/**
+ * `StringBuilder.append(string)`. Returns the builder, so calls can be chained.
+ */
+PRIVATE KleinResult stringBuilderAppend(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 2));
+	TRY_LET(HeapStringBuilder * builder, getStringBuilder(arguments->data[0], &builder));
+	TRY_LET(HeapString * string, getStringObject(arguments->data[1], &string));
+	appendToStringBuilder(builder, string->characters, string->length);
+	RETURN_OK(output, arguments->data[0]);
+}
+
+/**
+ * `StringBuilder.append_number(number)`. Returns the builder, so calls can be chained.
+ */
+PRIVATE KleinResult stringBuilderAppendNumber(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 2));
+	TRY_LET(HeapStringBuilder * builder, getStringBuilder(arguments->data[0], &builder));
+	if (!isNumber(arguments->data[1])) {
+		UNREACHABLE;
+	}
+	TRY_LET(String string, valueToString(arguments->data[1], &string));
+	appendToStringBuilder(builder, string, strlen(string));
+	RETURN_OK(output, arguments->data[0]);
+}
+
+PRIVATE KleinResult stringBuilderLength(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	TRY_LET(HeapStringBuilder * builder, getStringBuilder(arguments->data[0], &builder));
+	return numberValue(builder->length, output);
+}
+
+/**
+ * `StringBuilder.build()`. Copies the characters appended so far into a new
+ * string; the builder can keep being appended to afterwards.
+ */
+PRIVATE KleinResult stringBuilderBuild(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	TRY_LET(HeapStringBuilder * builder, getStringBuilder(arguments->data[0], &builder));
+	return stringValueOfLength(builder->characters, builder->length, output);
+}
+
+/**
+ * `Number.to(low, high)`. Returns the numbers from `low` up to `high` as a lazy
+ * range; the number it's called on is ignored.
+ */
+PRIVATE KleinResult numberTo(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 3));
+	TRY_LET(double low, getNumber(arguments->data[1], &low));
+	TRY_LET(double high, getNumber(arguments->data[2], &high));
+	return rangeValue(low, high, output);
+}
+
+/**
+ * The built-in `lines` function, which iterates over the lines of a file.
+ */
+PRIVATE KleinResult lines(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	TRY_LET(String path, getString(arguments->data[0], &path));
+	return linesIterator(path, output);
+}
+
+/**
+ * `.iterate()` on lists, strings and iterators.
+ */
+PRIVATE KleinResult iteratorIterate(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	TRY_LET(HeapIterator * iterator, iteratorOf(arguments->data[0], &iterator));
+	RETURN_OK(output, OBJECT_VALUE(iterator));
+}
+
+/**
+ * Shared by `.map(function)` and `.filter(function)`.
+ */
+PRIVATE KleinResult iteratorWithFunction(IteratorKind kind, ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 2));
+	TRY_LET(HeapIterator * source, iteratorOf(arguments->data[0], &source));
+	return combinatorIterator(kind, source, arguments->data[1], 0, output);
+}
+
+PRIVATE KleinResult iteratorMap(ValueList* arguments, Value* output) {
+	return iteratorWithFunction(ITERATOR_MAP, arguments, output);
+}
+
+PRIVATE KleinResult iteratorFilter(ValueList* arguments, Value* output) {
+	return iteratorWithFunction(ITERATOR_FILTER, arguments, output);
+}
+
+/**
+ * Shared by `.take(count)` and `.skip(count)`.
+ */
+PRIVATE KleinResult iteratorWithCount(IteratorKind kind, ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 2));
+	TRY_LET(HeapIterator * source, iteratorOf(arguments->data[0], &source));
+	TRY_LET(double count, getNumber(arguments->data[1], &count));
+	return combinatorIterator(kind, source, NULL_VALUE, count < 0 ? 0 : (unsigned long) count, output);
+}
+
+PRIVATE KleinResult iteratorTake(ValueList* arguments, Value* output) {
+	return iteratorWithCount(ITERATOR_TAKE, arguments, output);
+}
+
+PRIVATE KleinResult iteratorSkip(ValueList* arguments, Value* output) {
+	return iteratorWithCount(ITERATOR_SKIP, arguments, output);
+}
+
+/**
+ * `.zip(other)`. Produces `[a, b]` pairs until either side runs out.
+ */
+PRIVATE KleinResult iteratorZip(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 2));
+	TRY_LET(HeapIterator * source, iteratorOf(arguments->data[0], &source));
+	TRY_LET(HeapIterator * other, iteratorOf(arguments->data[1], &other));
+	return combinatorIterator(ITERATOR_ZIP, source, OBJECT_VALUE(other), 0, output);
+}
+
+/**
+ * `.enumerate()`. Produces `[index, value]` pairs, counting from zero.
+ */
+PRIVATE KleinResult iteratorEnumerate(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	TRY_LET(HeapIterator * source, iteratorOf(arguments->data[0], &source));
+	return combinatorIterator(ITERATOR_ENUMERATE, source, NULL_VALUE, 0, output);
+}
+
+/**
+ * `.reduce(initial, function)`. Folds every value into an accumulator by calling
+ * `function(accumulator, value)`, and returns the final accumulator.
+ */
+PRIVATE KleinResult iteratorReduce(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 3));
+	TRY_LET(HeapIterator * iterator, iteratorOf(arguments->data[0], &iterator));
+	Value accumulator = arguments->data[1];
+	Value function = arguments->data[2];
+
+	// The accumulator is only referenced from here, so it's rooted while the
+	// iterator and the function run
+	unsigned long roots = saveRoots();
+	pushRoot(OBJECT_VALUE(iterator));
+	unsigned long iterationRoots = saveRoots();
+	ValueList callArguments = emptyValueList();
+	KleinResult result = OK;
+	while (true) {
+		restoreRoots(iterationRoots);
+		pushRoot(accumulator);
+		bool isDone;
+		Value value;
+		result = advanceIterator(iterator, &value, &isDone);
+		if (!isOk(result) || isDone) {
+			break;
+		}
+		pushRoot(value);
+
+		callArguments.size = 0;
+		appendToValueList(&callArguments, accumulator);
+		appendToValueList(&callArguments, value);
+		result = callFunction(function, &callArguments, &accumulator);
+		if (!isOk(result)) {
+			break;
+		}
+	}
+	freeValueList(&callArguments);
+	restoreRoots(roots);
+	TRY(result);
+
+	RETURN_OK(output, accumulator);
+}
+
+/**
+ * `.collect()`. Runs an iterator to the end and returns its values as a list.
+ */
+PRIVATE KleinResult iteratorCollect(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	TRY_LET(HeapIterator * iterator, iteratorOf(arguments->data[0], &iterator));
+
+	unsigned long roots = saveRoots();
+	pushRoot(OBJECT_VALUE(iterator));
+	ValueList values = emptyValueList();
+	while (true) {
+		bool isDone;
+		TRY_LET(Value value, advanceIterator(iterator, &value, &isDone));
+		if (isDone) {
+			break;
+		}
+		pushRoot(value);
+		appendToValueList(&values, value);
+	}
+
+	KleinResult result = listValue(values, output);
+	restoreRoots(roots);
+	return result;
+}
+
+/**
+ * The built-in `hash_map` function, which creates an empty map.
+ */
+PRIVATE KleinResult hashMap(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 0));
+	return mapValue(output);
+}
+
+/**
+ * The built-in `freeze` function, which makes its argument deeply immutable and
+ * returns it.
+ */
+PRIVATE KleinResult freeze(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	return freezeValue(arguments->data[0], output);
+}
+
+/**
+ * Returns the whole, non-negative number an argument holds, or an error if it
+ * holds anything else.
+ */
+PRIVATE KleinResult getCount(Value value, unsigned long* output) {
+	TRY_LET(double number, getNumber(value, &number));
+	if (number < 0 || floor(number) != number) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_INVALID_ARGUMENT,
+		};
+	}
+
+	RETURN_OK(output, (unsigned long) number);
+}
 
+/**
+ * The built-in `set_maximum_pause` function, which sets the longest the garbage
+ * collector may pause the program for, in microseconds. Returns `null`.
+ */
+PRIVATE KleinResult setMaximumPauseBuiltin(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	TRY_LET(unsigned long microseconds, getCount(arguments->data[0], &microseconds));
+	setMaximumPause(microseconds);
+	return nullValue(output);
+}
+
+/**
+ * The built-in `set_collector_threads` function, which sets how many helper
+ * threads collect garbage alongside the program. Returns `null`.
+ */
+PRIVATE KleinResult setCollectorThreadsBuiltin(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	TRY_LET(unsigned long count, getCount(arguments->data[0], &count));
+	if (count > UINT_MAX) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_INVALID_ARGUMENT,
+		};
+	}
+
+	setCollectorThreads((unsigned int) count);
+	return nullValue(output);
+}
+
+/**
+ * `Map.get(key)`. Returns `null` if the key isn't present.
+ */
+PRIVATE KleinResult mapGetMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 2));
+	TRY_LET(HeapMap * map, getMap(arguments->data[0], &map));
+	bool isFound;
+	TRY(mapGet(map, arguments->data[1], output, &isFound));
+	if (!isFound) {
+		return nullValue(output);
+	}
 	return OK;
 }
 
+/**
+ * `Map.set(key, value)`. Returns the map, so calls can be chained.
+ */
+PRIVATE KleinResult mapSetMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 3));
+	TRY_LET(HeapMap * map, getMap(arguments->data[0], &map));
+	TRY(mapSet(map, arguments->data[1], arguments->data[2]));
+	RETURN_OK(output, arguments->data[0]);
+}
+
+/**
+ * `Map.delete(key)`. Returns whether the key was present.
+ */
+PRIVATE KleinResult mapDeleteMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 2));
+	TRY_LET(HeapMap * map, getMap(arguments->data[0], &map));
+	TRY_LET(bool wasPresent, mapDelete(map, arguments->data[1], &wasPresent));
+	return booleanValue(wasPresent, output);
+}
+
+PRIVATE KleinResult mapContainsMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 2));
+	TRY_LET(HeapMap * map, getMap(arguments->data[0], &map));
+	Value value;
+	TRY_LET(bool isFound, mapGet(map, arguments->data[1], &value, &isFound));
+	return booleanValue(isFound, output);
+}
+
+PRIVATE KleinResult mapSizeMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	TRY_LET(HeapMap * map, getMap(arguments->data[0], &map));
+	return numberValue(map->count, output);
+}
+
+PRIVATE KleinResult mapKeysMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	return mapIterator(ITERATOR_MAP_KEYS, arguments->data[0], output);
+}
+
+PRIVATE KleinResult mapValuesMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	return mapIterator(ITERATOR_MAP_VALUES, arguments->data[0], output);
+}
+
+/**
+ * `Map.entries()`. Iterates over `[key, value]` pairs.
+ */
+PRIVATE KleinResult mapEntriesMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	return mapIterator(ITERATOR_MAP_ENTRIES, arguments->data[0], output);
+}
+
+/**
+ * The built-in `vector` function, which creates a vector of its arguments.
+ */
+PRIVATE KleinResult vector(ValueList* arguments, Value* output) {
+	TRY_LET(Value result, vectorValue(&result));
+	FOR_EACHP(Value argument, arguments) {
+		UNWRAP_LET(HeapVector * partial, getVector(result, &partial));
+		TRY(vectorConj(partial, argument, &result));
+	}
+	END;
+	RETURN_OK(output, result);
+}
+
+/**
+ * Reads an index argument of a vector method.
+ */
+PRIVATE KleinResult getIndexArgument(Value argument, double* output) {
+	if (!isNumber(argument)) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_INVALID_INDEX,
+		};
+	}
+	return getNumber(argument, output);
+}
+
+PRIVATE KleinResult vectorGetMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 2));
+	TRY_LET(HeapVector * vector, getVector(arguments->data[0], &vector));
+	TRY_LET(double index, getIndexArgument(arguments->data[1], &index));
+	return vectorGet(vector, index, output);
+}
+
+/**
+ * `Vector.conj(value)`. Returns a new vector with `value` at the end.
+ */
+PRIVATE KleinResult vectorConjMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 2));
+	TRY_LET(HeapVector * vector, getVector(arguments->data[0], &vector));
+	return vectorConj(vector, arguments->data[1], output);
+}
+
+/**
+ * `Vector.assoc(index, value)`. Returns a new vector with the element at `index`
+ * replaced.
+ */
+PRIVATE KleinResult vectorAssocMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 3));
+	TRY_LET(HeapVector * vector, getVector(arguments->data[0], &vector));
+	TRY_LET(double index, getIndexArgument(arguments->data[1], &index));
+	return vectorAssoc(vector, index, arguments->data[2], output);
+}
+
+/**
+ * `Vector.pop()`. Returns a new vector without the last element.
+ */
+PRIVATE KleinResult vectorPopMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	TRY_LET(HeapVector * vector, getVector(arguments->data[0], &vector));
+	return vectorPop(vector, output);
+}
+
+PRIVATE KleinResult vectorLengthMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	TRY_LET(HeapVector * vector, getVector(arguments->data[0], &vector));
+	return numberValue((double) vector->count, output);
+}
+
+/**
+ * The built-in `persistent_map` function, which creates an empty persistent map.
+ */
+PRIVATE KleinResult persistentMap(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 0));
+	return persistentMapValue(output);
+}
+
+/**
+ * `PersistentMap.get(key)`. Returns `null` if the key isn't present.
+ */
+PRIVATE KleinResult persistentMapGetMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 2));
+	TRY_LET(HeapPersistentMap * map, getPersistentMap(arguments->data[0], &map));
+	TRY_LET(bool isFound, persistentMapGet(map, arguments->data[1], output, &isFound));
+	if (!isFound) {
+		return nullValue(output);
+	}
+	return OK;
+}
+
+/**
+ * `PersistentMap.assoc(key, value)`. Returns a new map with `key` set to `value`.
+ */
+PRIVATE KleinResult persistentMapAssocMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 3));
+	TRY_LET(HeapPersistentMap * map, getPersistentMap(arguments->data[0], &map));
+	return persistentMapAssoc(map, arguments->data[1], arguments->data[2], output);
+}
+
+/**
+ * `PersistentMap.dissoc(key)`. Returns a new map without `key`.
+ */
+PRIVATE KleinResult persistentMapDissocMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 2));
+	TRY_LET(HeapPersistentMap * map, getPersistentMap(arguments->data[0], &map));
+	return persistentMapDissoc(map, arguments->data[1], output);
+}
+
+PRIVATE KleinResult persistentMapContainsMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 2));
+	TRY_LET(HeapPersistentMap * map, getPersistentMap(arguments->data[0], &map));
+	Value value;
+	TRY_LET(bool isFound, persistentMapGet(map, arguments->data[1], &value, &isFound));
+	return booleanValue(isFound, output);
+}
+
+PRIVATE KleinResult persistentMapSizeMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	TRY_LET(HeapPersistentMap * map, getPersistentMap(arguments->data[0], &map));
+	return numberValue((double) map->count, output);
+}
+
+PRIVATE KleinResult persistentMapKeysMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	return persistentMapIterator(ITERATOR_MAP_KEYS, arguments->data[0], output);
+}
+
+PRIVATE KleinResult persistentMapValuesMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	return persistentMapIterator(ITERATOR_MAP_VALUES, arguments->data[0], output);
+}
+
+PRIVATE KleinResult persistentMapEntriesMethod(ValueList* arguments, Value* output) {
+	TRY(expectArgumentCount(arguments, 1));
+	return persistentMapIterator(ITERATOR_MAP_ENTRIES, arguments->data[0], output);
+}
+
 KleinResult getBuiltin(String name, BuiltinFunction* output) {
 	if (strcmp(name, "print") == 0) {
 		RETURN_OK(output, &print);
@@ -270,19 +962,225 @@ KleinResult getBuiltin(String name, BuiltinFunction* output) {
 		RETURN_OK(output, &listAppend);
 	}
 
+	if (strcmp(name, "List.prepend") == 0) {
+		RETURN_OK(output, &listPrepend);
+	}
+
+	if (strcmp(name, "List.pop_front") == 0) {
+		RETURN_OK(output, &listPopFront);
+	}
+
+	if (strcmp(name, "List.pop_back") == 0) {
+		RETURN_OK(output, &listPopBack);
+	}
+
+	if (strcmp(name, "List.copy") == 0) {
+		RETURN_OK(output, &listCopy);
+	}
+
+	if (strcmp(name, "List.slice") == 0) {
+		RETURN_OK(output, &listSlice);
+	}
+
+	if (strcmp(name, "List.count") == 0) {
+		RETURN_OK(output, &listCount);
+	}
+
+	if (strcmp(name, "List.bitwise_and") == 0) {
+		RETURN_OK(output, &listBitwiseAnd);
+	}
+
+	if (strcmp(name, "List.bitwise_or") == 0) {
+		RETURN_OK(output, &listBitwiseOr);
+	}
+
+	if (strcmp(name, "List.bitwise_xor") == 0) {
+		RETURN_OK(output, &listBitwiseXor);
+	}
+
+	if (strcmp(name, "List.bitwise_not") == 0) {
+		RETURN_OK(output, &listBitwiseNot);
+	}
+
+	if (strcmp(name, "String.slice") == 0) {
+		RETURN_OK(output, &stringSlice);
+	}
+
+	if (strcmp(name, "Number.to") == 0) {
+		RETURN_OK(output, &numberTo);
+	}
+
 	if (strcmp(name, "Number.mod") == 0) {
 		RETURN_OK(output, &numberMod);
 	}
 
-	UNREACHABLE;
-}
+	if (strcmp(name, "lines") == 0) {
+		RETURN_OK(output, &lines);
+	}
+
+	if (strcmp(name, "Iterator.iterate") == 0) {
+		RETURN_OK(output, &iteratorIterate);
+	}
+
+	if (strcmp(name, "Iterator.map") == 0) {
+		RETURN_OK(output, &iteratorMap);
+	}
 
-KleinResult builtinFunctionToValue(BuiltinFunction function, Value* output) {
-	InternalList internals = emptyInternalList();
-	appendToInternalList(&internals, (Internal) {.key = INTERNAL_KEY_BUILTIN_FUNCTION, .value = (void*) function});
+	if (strcmp(name, "Iterator.filter") == 0) {
+		RETURN_OK(output, &iteratorFilter);
+	}
 
-	ValueFieldList* fields = emptyHeapValueFieldList();
+	if (strcmp(name, "Iterator.take") == 0) {
+		RETURN_OK(output, &iteratorTake);
+	}
 
-	Value result = (Value) {.fields = fields, .internals = internals};
-	RETURN_OK(output, result);
+	if (strcmp(name, "Iterator.skip") == 0) {
+		RETURN_OK(output, &iteratorSkip);
+	}
+
+	if (strcmp(name, "Iterator.zip") == 0) {
+		RETURN_OK(output, &iteratorZip);
+	}
+
+	if (strcmp(name, "Iterator.enumerate") == 0) {
+		RETURN_OK(output, &iteratorEnumerate);
+	}
+
+	if (strcmp(name, "Iterator.reduce") == 0) {
+		RETURN_OK(output, &iteratorReduce);
+	}
+
+	if (strcmp(name, "Iterator.collect") == 0) {
+		RETURN_OK(output, &iteratorCollect);
+	}
+
+	if (strcmp(name, "hash_map") == 0) {
+		RETURN_OK(output, &hashMap);
+	}
+
+	if (strcmp(name, "freeze") == 0) {
+		RETURN_OK(output, &freeze);
+	}
+
+	if (strcmp(name, "set_maximum_pause") == 0) {
+		RETURN_OK(output, &setMaximumPauseBuiltin);
+	}
+
+	if (strcmp(name, "set_collector_threads") == 0) {
+		RETURN_OK(output, &setCollectorThreadsBuiltin);
+	}
+
+	if (strcmp(name, "Map.get") == 0) {
+		RETURN_OK(output, &mapGetMethod);
+	}
+
+	if (strcmp(name, "Map.set") == 0) {
+		RETURN_OK(output, &mapSetMethod);
+	}
+
+	if (strcmp(name, "Map.delete") == 0) {
+		RETURN_OK(output, &mapDeleteMethod);
+	}
+
+	if (strcmp(name, "Map.contains") == 0) {
+		RETURN_OK(output, &mapContainsMethod);
+	}
+
+	if (strcmp(name, "Map.size") == 0) {
+		RETURN_OK(output, &mapSizeMethod);
+	}
+
+	if (strcmp(name, "Map.keys") == 0) {
+		RETURN_OK(output, &mapKeysMethod);
+	}
+
+	if (strcmp(name, "Map.values") == 0) {
+		RETURN_OK(output, &mapValuesMethod);
+	}
+
+	if (strcmp(name, "Map.entries") == 0) {
+		RETURN_OK(output, &mapEntriesMethod);
+	}
+
+	if (strcmp(name, "vector") == 0) {
+		RETURN_OK(output, &vector);
+	}
+
+	if (strcmp(name, "Vector.get") == 0) {
+		RETURN_OK(output, &vectorGetMethod);
+	}
+
+	if (strcmp(name, "Vector.conj") == 0) {
+		RETURN_OK(output, &vectorConjMethod);
+	}
+
+	if (strcmp(name, "Vector.assoc") == 0) {
+		RETURN_OK(output, &vectorAssocMethod);
+	}
+
+	if (strcmp(name, "Vector.pop") == 0) {
+		RETURN_OK(output, &vectorPopMethod);
+	}
+
+	if (strcmp(name, "Vector.length") == 0) {
+		RETURN_OK(output, &vectorLengthMethod);
+	}
+
+	if (strcmp(name, "persistent_map") == 0) {
+		RETURN_OK(output, &persistentMap);
+	}
+
+	if (strcmp(name, "PersistentMap.get") == 0) {
+		RETURN_OK(output, &persistentMapGetMethod);
+	}
+
+	if (strcmp(name, "PersistentMap.assoc") == 0) {
+		RETURN_OK(output, &persistentMapAssocMethod);
+	}
+
+	if (strcmp(name, "PersistentMap.dissoc") == 0) {
+		RETURN_OK(output, &persistentMapDissocMethod);
+	}
+
+	if (strcmp(name, "PersistentMap.contains") == 0) {
+		RETURN_OK(output, &persistentMapContainsMethod);
+	}
+
+	if (strcmp(name, "PersistentMap.size") == 0) {
+		RETURN_OK(output, &persistentMapSizeMethod);
+	}
+
+	if (strcmp(name, "PersistentMap.keys") == 0) {
+		RETURN_OK(output, &persistentMapKeysMethod);
+	}
+
+	if (strcmp(name, "PersistentMap.values") == 0) {
+		RETURN_OK(output, &persistentMapValuesMethod);
+	}
+
+	if (strcmp(name, "PersistentMap.entries") == 0) {
+		RETURN_OK(output, &persistentMapEntriesMethod);
+	}
+
+	if (strcmp(name, "string_builder") == 0) {
+		RETURN_OK(output, &stringBuilder);
+	}
+
+	if (strcmp(name, "StringBuilder.append") == 0) {
+		RETURN_OK(output, &stringBuilderAppend);
+	}
+
+	if (strcmp(name, "StringBuilder.append_number") == 0) {
+		RETURN_OK(output, &stringBuilderAppendNumber);
+	}
+
+	if (strcmp(name, "StringBuilder.length") == 0) {
+		RETURN_OK(output, &stringBuilderLength);
+	}
+
+	if (strcmp(name, "StringBuilder.build") == 0) {
+		RETURN_OK(output, &stringBuilderBuild);
+	}
+
+	UNREACHABLE;
 }
@@ -1,198 +1,161 @@
 #include "../include/context.h"
+#include "../include/sugar.h"
 #include <stdlib.h>
 #include <string.h>
 
 /**
- * Declares a new variable in the given scope with the given name and
- * value.
+ * Pushes a new frame with `slotCount` null slots for a call to the given
+ * closure onto the current context.
  *
  * # Parameters
  *
- * - `scope` - The scope to add the variable to, which will be mutated to
- *   reflect the added variable.
- * - `name` - The name of the variable as a null-terminated string that lives
- *   at least as long as the given scope object.
- * - `value` - The value of the variable.
- *
- * # Returns
- *
- * `NULL` wrapped in a `Result`, assuming success.
+ * - `closure` - The closure being called, or `NULL` for the top level of the program.
+ * - `slotCount` - The number of local variable slots the frame needs.
  *
  * # Errors
  *
- * If memory fails to allocate for the new variable, an error is returned.
- * If a variable already exists in the given scope (or any of its parent
- * scopes), an error is returned. If the given `scope` or `name` is `NULL`,
- * an error is returned.
+ * If memory fails to allocate, an error is returned.
  */
-KleinResult declareNewVariable(Scope* scope, ScopeDeclaration declaration) {
-	// Error - Variable already exists
-	Value* value = NULL;
-	if (isOk(getVariable(*scope, declaration.name, &value))) {
-		return (KleinResult) {
-			.type = KLEIN_ERROR_DUPLICATE_VARIABLE_DECLARATION,
-			.data = (KleinResultData) {
-				.duplicateVariableDeclaration = declaration.name,
-			},
-		};
+KleinResult enterFrame(Closure* closure, unsigned long slotCount) {
+	Frame* frame = malloc(sizeof(Frame));
+	Value* slots = malloc(sizeof(Value) * MAX(slotCount, 1));
+	if (frame == NULL || slots == NULL) {
+		free(frame);
+		free(slots);
+		UNREACHABLE;
 	}
 
-	// Add the variable
-	appendToScopeDeclarationList(&scope->variables, declaration);
-
-	// Return ok
-	return OK;
-}
-
-KleinResult reassignVariable(Scope* scope, ScopeDeclaration declaration) {
-	// Variable already exists
-	Value* value = NULL;
-	if (isError(getVariable(*scope, declaration.name, &value))) {
-		return (KleinResult) {
-			.type = KLEIN_ERROR_REFERENCE_UNDEFINED_VARIABLE,
-			.data = (KleinResultData) {
-				.referenceUndefinedVariable = declaration.name,
-			},
-		};
+	for (unsigned long slot = 0; slot < slotCount; slot++) {
+		slots[slot] = NULL_VALUE;
 	}
 
-	// Add the variable
-	*value = declaration.value;
-
-	// Return ok
-	return OK;
-}
-
-KleinResult setVariable(Scope* scope, ScopeDeclaration declaration) {
-	// Variable already exists
-	Value* value = NULL;
-	getVariable(*scope, declaration.name, &value);
-
-	// Add the variable
-	if (value == NULL) {
-		appendToScopeDeclarationList(&scope->variables, declaration);
-	} else {
-		*value = declaration.value;
-	}
+	*frame = (Frame) {
+		.slots = slots,
+		.slotCount = slotCount,
+		.closure = closure,
+		.openUpvalues = NULL,
+		.parent = CONTEXT->frame,
+	};
+	CONTEXT->frame = frame;
 
-	// Return ok
 	return OK;
 }
 
 /**
- * Returns a pointer to the `Expression` value stored in the variable with the
- * given name in the given scope. This will traverse up the scope hierarchy
- * to the global scope until the variable is found.
- *
- * # Parameters
- *
- * - `scope` - The scope to search in.
- * - `name` - The name of the variable as a null-terminated string. It only
- *   needs to be valid for the duration of the function call; It can be safely
- *   freed as soon as this function is finished. Doing so will not invalidate
- *   the returned `Expression` pointer.
- *
- * # Returns
- *
- * The variable's `Expression` value, wrapped in a `Result`, assuming success.
+ * Closes every upvalue still pointing into the current frame and pops it,
+ * returning to the caller's frame.
  *
  * # Errors
  *
- * If the given `name` is `NULL`, an error is returned.
- * If no variable exists with the given name in the given scope,
- * an error is returned.
+ * If there is no current frame, an error is returned.
  */
-KleinResult getVariable(Scope scope, String name, Value** output) {
-	Scope* current = &scope;
-	while (current != NULL) {
-		FOR_EACH_REF(ScopeDeclaration * variable, current->variables) {
-			if (strcmp(variable->name, name) == 0) {
-				RETURN_OK(output, &variable->value);
-			}
-		}
-		END;
-		current = current->parent;
+KleinResult exitFrame(void) {
+	Frame* frame = CONTEXT->frame;
+	if (frame == NULL) {
+		UNREACHABLE;
 	}
 
-	return (KleinResult) {
-		.type = KLEIN_ERROR_REFERENCE_UNDEFINED_VARIABLE,
-		.data = (KleinResultData) {
-			.referenceUndefinedVariable = name,
-		},
-	};
-}
-
-KleinResult enterNewScope(void) {
-	ScopeList children = emptyScopeList();
-	ScopeDeclarationList variables = emptyScopeDeclarationList();
+	closeUpvalues(0);
+	CONTEXT->frame = frame->parent;
 
-	Scope scope = (Scope) {
-		.parent = CONTEXT->scope,
-		.children = children,
-		.variables = variables,
-	};
-
-	appendToScopeList(&CONTEXT->scope->children, scope);
-	CONTEXT->scope = &CONTEXT->scope->children.data[CONTEXT->scope->children.size - 1];
+	free(frame->slots);
+	free(frame);
 
 	return OK;
 }
 
-KleinResult exitScope(void) {
-	if (CONTEXT->scope->parent == NULL) {
-		UNREACHABLE;
+/**
+ * Returns the upvalue for the given slot of the current frame, creating it
+ * if no closure has captured that slot yet. Closures capturing the same
+ * variable share the same upvalue.
+ */
+KleinResult captureUpvalue(unsigned long slot, Upvalue** output) {
+	Frame* frame = CONTEXT->frame;
+
+	// Find the insertion point; the open list is sorted by descending slot
+	Upvalue** link = &frame->openUpvalues;
+	while (*link != NULL && (*link)->slot > slot) {
+		link = &(*link)->next;
 	}
 
-	CONTEXT->scope = CONTEXT->scope->parent;
+	// Already captured
+	if (*link != NULL && (*link)->slot == slot) {
+		RETURN_OK(output, *link);
+	}
 
-	return OK;
+	// New upvalue
+	Upvalue* upvalue = (Upvalue*) allocateObject(HEAP_OBJECT_UPVALUE, sizeof(Upvalue));
+	upvalue->location = &frame->slots[slot];
+	upvalue->closed = NULL_VALUE;
+	upvalue->slot = slot;
+	upvalue->next = *link;
+	*link = upvalue;
+
+	RETURN_OK(output, upvalue);
 }
 
 /**
- * Creates a new context allocated on the heap, wrapped in a
- * `Result`. The caller is responsible for freeing the memory, most
- * likely using `freeContext()`.
- *
- * # Returns
- *
- * The context pointer wrapped in a result.
+ * Creates an upvalue that is already closed over a copy of the given slot of the
+ * current frame. This is used for variables that are never reassigned, which
+ * don't need to be shared with the frame or closed when it exits.
+ */
+KleinResult copyUpvalue(unsigned long slot, Upvalue** output) {
+	Upvalue* upvalue = (Upvalue*) allocateObject(HEAP_OBJECT_UPVALUE, sizeof(Upvalue));
+	upvalue->closed = CONTEXT->frame->slots[slot];
+	upvalue->location = &upvalue->closed;
+	upvalue->slot = slot;
+	upvalue->next = NULL;
+
+	RETURN_OK(output, upvalue);
+}
+
+/**
+ * Closes every open upvalue of the current frame whose slot is at or above
+ * `firstSlot`. This is called when the block owning those slots exits, so that
+ * each iteration of a loop gets fresh variables.
+ */
+void closeUpvalues(unsigned long firstSlot) {
+	Frame* frame = CONTEXT->frame;
+	while (frame->openUpvalues != NULL && frame->openUpvalues->slot >= firstSlot) {
+		Upvalue* upvalue = frame->openUpvalues;
+		upvalue->closed = *upvalue->location;
+		writeBarrier(&upvalue->header, upvalue->closed);
+		upvalue->location = &upvalue->closed;
+		frame->openUpvalues = upvalue->next;
+	}
+}
+
+/**
+ * Creates a new context with no active frame and an empty heap, and stores it in
+ * `output`. The caller is responsible for freeing it, and every value created
+ * with it, using `freeContext()`.
  *
  * # Errors
  *
  * If memory fails to allocate, an error is returned.
  */
 KleinResult newContext(Context* output) {
-	ScopeList children = emptyScopeList();
-	ScopeDeclarationList variables = emptyScopeDeclarationList();
-
-	Scope globalScope = (Scope) {
-		.parent = NULL,
-		.children = children,
-		.variables = variables,
-	};
-
 	*output = (Context) {
-		.globalScope = globalScope,
+		.frame = NULL,
 		.debugIndent = 0,
+		.strings = NULL,
+		.heap = newHeap(),
 	};
-	output->scope = &output->globalScope;
 
 	return OK;
 }
 
-PRIVATE void freeScope(Scope scope) {
-	FOR_EACH(Scope child, scope.children) {
-		freeScope(child);
+void freeContext(Context context) {
+	Frame* frame = context.frame;
+	while (frame != NULL) {
+		Frame* parent = frame->parent;
+		free(frame->slots);
+		free(frame);
+		frame = parent;
 	}
-	END;
-
-	free(scope.children.data);
-	free(scope.variables.data);
-}
 
-void freeContext(Context context) {
-	freeScope(context.globalScope);
+	if (context.strings != NULL) {
+		freeInternTable(context.strings);
+	}
+	freeHeap(&context.heap);
 }
-
-IMPLEMENT_KLEIN_LIST(Scope)
-IMPLEMENT_KLEIN_LIST(ScopeDeclaration)
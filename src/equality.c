@@ -0,0 +1,379 @@
+#include "../include/equality.h"
+#include "../include/list.h"
+#include "../include/map.h"
+#include "../include/persistent.h"
+#include <math.h>
+#include <string.h>
+
+/**
+ * Containers nested deeper than this don't contribute their contents to a hash.
+ */
+#define MAX_HASH_DEPTH 4
+
+/**
+ * A pair of containers whose comparison is in progress.
+ */
+typedef struct {
+	HeapObject* left;
+	HeapObject* right;
+} Comparison;
+
+DEFINE_KLEIN_LIST(Comparison);
+
+PRIVATE bool valuesEqualWithin(Value left, Value right, ComparisonList* comparisons);
+
+/**
+ * Mixes the bits of a 64-bit integer into a 32-bit hash.
+ */
+PRIVATE uint32_t mixBits(uint64_t bits) {
+	bits ^= bits >> 33;
+	bits *= 0xff51afd7ed558ccdULL;
+	bits ^= bits >> 33;
+	return (uint32_t) bits;
+}
+
+PRIVATE bool stringValuesEqual(Value left, Value right) {
+	unsigned long length = stringValueLength(left);
+	if (length != stringValueLength(right)) {
+		return false;
+	}
+
+	// Cached hashes rule out most unequal strings without reading them
+	if (isObjectOfType(left, HEAP_OBJECT_STRING) && isObjectOfType(right, HEAP_OBJECT_STRING)) {
+		return stringsAreEqual((HeapString*) AS_OBJECT(left), (HeapString*) AS_OBJECT(right));
+	}
+
+	UNWRAP_LET(const char* leftCharacters, getStringCharacters(left, &leftCharacters));
+	UNWRAP_LET(const char* rightCharacters, getStringCharacters(right, &rightCharacters));
+	return memcmp(leftCharacters, rightCharacters, length) == 0;
+}
+
+PRIVATE bool listsEqual(Value left, Value right, ComparisonList* comparisons) {
+
+	// Ranges that haven't been materialized compare by their bounds
+	HeapRange* leftRange = getUnmaterializedRange(left);
+	HeapRange* rightRange = getUnmaterializedRange(right);
+	if (leftRange != NULL && rightRange != NULL) {
+		return leftRange->low == rightRange->low && leftRange->high == rightRange->high;
+	}
+
+	UNWRAP_LET(HeapList * leftList, getList(left, &leftList));
+	UNWRAP_LET(HeapList * rightList, getList(right, &rightList));
+	if (leftList->length != rightList->length) {
+		return false;
+	}
+	if (leftList->storage == rightList->storage && leftList->offset == rightList->offset) {
+		return true;
+	}
+
+	for (unsigned long index = 0; index < leftList->length; index++) {
+		if (!valuesEqualWithin(listElement(leftList, index), listElement(rightList, index), comparisons)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+PRIVATE bool recordsEqual(HeapRecord* left, HeapRecord* right, ComparisonList* comparisons) {
+	if (left->shape->fieldNames.size != right->shape->fieldNames.size) {
+		return false;
+	}
+
+	// Records with the same fields in a different order have different shapes
+	bool isSameShape = left->shape == right->shape;
+	FOR_EACH(String name, left->shape->fieldNames) {
+		unsigned long rightSlot = index__;
+		if (!isSameShape && !getShapeSlot(right->shape, name, &rightSlot)) {
+			return false;
+		}
+		if (!valuesEqualWithin(left->slots[index__], right->slots[rightSlot], comparisons)) {
+			return false;
+		}
+	}
+	END;
+
+	return true;
+}
+
+PRIVATE bool mapsEqual(HeapMap* left, HeapMap* right, ComparisonList* comparisons) {
+	if (left->count != right->count) {
+		return false;
+	}
+
+	for (unsigned long index = 0; index < left->capacity; index++) {
+		MapEntry entry = left->entries[index];
+		if (entry.distance == 0) {
+			continue;
+		}
+
+		Value rightValue;
+		bool isFound;
+		if (mapGet(right, entry.key, &rightValue, &isFound).type != KLEIN_OK || !isFound) {
+			return false;
+		}
+		if (!valuesEqualWithin(entry.value, rightValue, comparisons)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+PRIVATE bool vectorsEqual(HeapVector* left, HeapVector* right, ComparisonList* comparisons) {
+	if (left->count != right->count) {
+		return false;
+	}
+	if (left->root == right->root && left->tail == right->tail) {
+		return true;
+	}
+
+	for (unsigned long index = 0; index < left->count; index++) {
+		UNWRAP_LET(Value leftElement, vectorGet(left, (double) index, &leftElement));
+		UNWRAP_LET(Value rightElement, vectorGet(right, (double) index, &rightElement));
+		if (!valuesEqualWithin(leftElement, rightElement, comparisons)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+PRIVATE bool persistentMapsEqual(HeapPersistentMap* left, HeapPersistentMap* right, ComparisonList* comparisons) {
+	if (left->count != right->count) {
+		return false;
+	}
+	if (left->root == right->root) {
+		return true;
+	}
+
+	ValueList keys = emptyValueList();
+	ValueList values = emptyValueList();
+	persistentMapEntries(left, &keys, &values);
+	bool isEqual = true;
+	FOR_EACH(Value key, keys) {
+		Value rightValue;
+		bool isFound;
+		if (persistentMapGet(right, key, &rightValue, &isFound).type != KLEIN_OK || !isFound || !valuesEqualWithin(values.data[index__], rightValue, comparisons)) {
+			isEqual = false;
+			break;
+		}
+	}
+	END;
+	freeValueList(&keys);
+	freeValueList(&values);
+
+	return isEqual;
+}
+
+/**
+ * Compares two containers, treating a pair that's already being compared further
+ * up the stack as equal. If they differ, that shows up elsewhere in the comparison.
+ */
+PRIVATE bool containersEqual(Value left, Value right, ComparisonList* comparisons) {
+	HeapObject* leftObject = AS_OBJECT(left);
+	HeapObject* rightObject = AS_OBJECT(right);
+	FOR_EACHP(Comparison comparison, comparisons) {
+		if (comparison.left == leftObject && comparison.right == rightObject) {
+			return true;
+		}
+	}
+	END;
+
+	appendToComparisonList(comparisons, (Comparison) {.left = leftObject, .right = rightObject});
+	bool isEqual;
+	if (isList(left)) {
+		isEqual = listsEqual(left, right, comparisons);
+	} else if (isRecord(left)) {
+		isEqual = recordsEqual((HeapRecord*) leftObject, (HeapRecord*) rightObject, comparisons);
+	} else if (isVector(left)) {
+		isEqual = vectorsEqual((HeapVector*) leftObject, (HeapVector*) rightObject, comparisons);
+	} else if (isPersistentMap(left)) {
+		isEqual = persistentMapsEqual((HeapPersistentMap*) leftObject, (HeapPersistentMap*) rightObject, comparisons);
+	} else {
+		isEqual = mapsEqual((HeapMap*) leftObject, (HeapMap*) rightObject, comparisons);
+	}
+	comparisons->size--;
+
+	return isEqual;
+}
+
+PRIVATE bool valuesEqualWithin(Value left, Value right, ComparisonList* comparisons) {
+
+	// Identical values, except NaN
+	if (left.bits == right.bits) {
+		if (!IS_DOUBLE(left)) {
+			return true;
+		}
+		UNWRAP_LET(double number, getNumber(left, &number));
+		return !isnan(number);
+	}
+
+	if (isNumber(left) && isNumber(right)) {
+
+		// Each whole number has one encoding, so differing integers differ
+		if (IS_INTEGER(left) && IS_INTEGER(right)) {
+			return false;
+		}
+		UNWRAP_LET(double leftNumber, getNumber(left, &leftNumber));
+		UNWRAP_LET(double rightNumber, getNumber(right, &rightNumber));
+		return leftNumber == rightNumber;
+	}
+
+	if (!IS_OBJECT(left) || !IS_OBJECT(right)) {
+		return false;
+	}
+
+	if (isString(left) && isString(right)) {
+		return stringValuesEqual(left, right);
+	}
+
+	if (isList(left) && isList(right)) {
+		return containersEqual(left, right, comparisons);
+	}
+
+	HeapObjectType type = AS_OBJECT(left)->type;
+	if (type != AS_OBJECT(right)->type) {
+		return false;
+	}
+
+	switch (type) {
+		case HEAP_OBJECT_RECORD:
+		case HEAP_OBJECT_MAP:
+		case HEAP_OBJECT_VECTOR:
+		case HEAP_OBJECT_PERSISTENT_MAP:
+			return containersEqual(left, right, comparisons);
+
+		// Reading the same method off the same value twice gives equal methods
+		case HEAP_OBJECT_BOUND_METHOD: {
+			HeapBoundMethod* leftMethod = (HeapBoundMethod*) AS_OBJECT(left);
+			HeapBoundMethod* rightMethod = (HeapBoundMethod*) AS_OBJECT(right);
+			return leftMethod->receiver.bits == rightMethod->receiver.bits && leftMethod->method.bits == rightMethod->method.bits;
+		}
+		case HEAP_OBJECT_BUILTIN_FUNCTION:
+			return ((HeapBuiltinFunction*) AS_OBJECT(left))->function == ((HeapBuiltinFunction*) AS_OBJECT(right))->function;
+		default:
+			return false;
+	}
+}
+
+bool valuesEqual(Value left, Value right) {
+	ComparisonList comparisons = emptyComparisonList();
+	bool isEqual = valuesEqualWithin(left, right, &comparisons);
+	freeComparisonList(&comparisons);
+	return isEqual;
+}
+
+PRIVATE uint32_t hashValueWithin(Value value, unsigned int depth) {
+	if (isNumber(value)) {
+		UNWRAP_LET(double number, getNumber(value, &number));
+
+		// `0` and `-0` are equal, so they must hash the same
+		if (number == 0) {
+			return 0;
+		}
+		return mixBits(value.bits);
+	}
+
+	if (!IS_OBJECT(value)) {
+		return mixBits(value.bits);
+	}
+
+	if (isString(value)) {
+		UNWRAP_LET(HeapString * string, getStringObject(value, &string));
+		return stringHash(string);
+	}
+
+	if (isList(value)) {
+		UNWRAP_LET(HeapList * list, getList(value, &list));
+		uint32_t hash = (uint32_t) list->length;
+		if (depth < MAX_HASH_DEPTH) {
+			for (unsigned long index = 0; index < list->length; index++) {
+				hash = hash * 31 + hashValueWithin(listElement(list, index), depth + 1);
+			}
+		}
+		return hash;
+	}
+
+	// Fields and entries are summed, since their order doesn't affect equality
+	switch (AS_OBJECT(value)->type) {
+		case HEAP_OBJECT_RECORD: {
+			HeapRecord* record = (HeapRecord*) AS_OBJECT(value);
+			uint32_t hash = (uint32_t) record->shape->fieldNames.size;
+			if (depth < MAX_HASH_DEPTH) {
+				FOR_EACH(String name, record->shape->fieldNames) {
+					hash += stringHash(internedString(name)) * 31 + hashValueWithin(record->slots[index__], depth + 1);
+				}
+				END;
+			}
+			return hash;
+		}
+		case HEAP_OBJECT_MAP: {
+			HeapMap* map = (HeapMap*) AS_OBJECT(value);
+			uint32_t hash = (uint32_t) map->count;
+			if (depth < MAX_HASH_DEPTH) {
+				for (unsigned long index = 0; index < map->capacity; index++) {
+					MapEntry entry = map->entries[index];
+					if (entry.distance != 0) {
+						hash += entry.hash * 31 + hashValueWithin(entry.value, depth + 1);
+					}
+				}
+			}
+			return hash;
+		}
+		case HEAP_OBJECT_VECTOR: {
+			HeapVector* vector = (HeapVector*) AS_OBJECT(value);
+			uint32_t hash = (uint32_t) vector->count;
+			if (depth < MAX_HASH_DEPTH) {
+				for (unsigned long index = 0; index < vector->count; index++) {
+					UNWRAP_LET(Value element, vectorGet(vector, (double) index, &element));
+					hash = hash * 31 + hashValueWithin(element, depth + 1);
+				}
+			}
+			return hash;
+		}
+		case HEAP_OBJECT_PERSISTENT_MAP: {
+			HeapPersistentMap* map = (HeapPersistentMap*) AS_OBJECT(value);
+			uint32_t hash = (uint32_t) map->count;
+			if (depth < MAX_HASH_DEPTH) {
+				ValueList keys = emptyValueList();
+				ValueList values = emptyValueList();
+				persistentMapEntries(map, &keys, &values);
+				FOR_EACH(Value key, keys) {
+					hash += hashValue(key) * 31 + hashValueWithin(values.data[index__], depth + 1);
+				}
+				END;
+				freeValueList(&keys);
+				freeValueList(&values);
+			}
+			return hash;
+		}
+		case HEAP_OBJECT_BOUND_METHOD: {
+			HeapBoundMethod* method = (HeapBoundMethod*) AS_OBJECT(value);
+			return mixBits(method->receiver.bits) ^ mixBits(method->method.bits);
+		}
+		case HEAP_OBJECT_BUILTIN_FUNCTION:
+			return mixBits((uint64_t) (uintptr_t) ((HeapBuiltinFunction*) AS_OBJECT(value))->function);
+		default:
+			return mixBits(value.bits);
+	}
+}
+
+uint32_t hashValue(Value value) {
+
+	// A frozen container's hash can't change, so it's only computed once. Strings cache their own.
+	if (IS_OBJECT(value) && !isString(value)) {
+		HeapObject* object = AS_OBJECT(value);
+		if (object->isFrozen) {
+			if (!object->isHashed) {
+				object->hash = hashValueWithin(value, 0);
+				object->isHashed = true;
+			}
+			return object->hash;
+		}
+	}
+
+	return hashValueWithin(value, 0);
+}
+
+IMPLEMENT_KLEIN_LIST(Comparison)
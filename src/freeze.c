@@ -0,0 +1,103 @@
+#include "../include/freeze.h"
+#include "../include/gc.h"
+#include "../include/map.h"
+#include "../include/persistent.h"
+
+KleinResult freezeValue(Value value, Value* output) {
+
+	// Already frozen values include ones being frozen further up the stack, so cycles end here
+	if (isFrozen(value)) {
+		RETURN_OK(output, value);
+	}
+
+	HeapObject* object = AS_OBJECT(value);
+	switch (object->type) {
+
+		// Strings can't change anyway, but a flat one reads and hashes fastest
+		case HEAP_OBJECT_STRING:
+		case HEAP_OBJECT_ROPE:
+		case HEAP_OBJECT_STRING_SLICE: {
+			TRY_LET(HeapString * string, getStringObject(value, &string));
+			freezeObject(&string->header);
+			RETURN_OK(output, OBJECT_VALUE(string));
+		}
+
+		case HEAP_OBJECT_LIST: {
+			HeapList* list = (HeapList*) object;
+			freezeObject(object);
+
+			// Numbers and booleans are frozen already
+			if (list->storage->kind != LIST_ELEMENTS_VALUES) {
+				break;
+			}
+			for (unsigned long index = 0; index < list->length; index++) {
+				TRY(freezeValue(listElements(list)[index], &listElements(list)[index]));
+				writeElementBarrier(&list->storage->header, list->offset + index, listElements(list)[index]);
+			}
+			break;
+		}
+
+		case HEAP_OBJECT_RANGE: {
+			HeapRange* range = (HeapRange*) object;
+			freezeObject(object);
+			if (range->materialized != NULL) {
+				freezeObject(&range->materialized->header);
+			}
+			break;
+		}
+
+		case HEAP_OBJECT_RECORD: {
+			HeapRecord* record = (HeapRecord*) object;
+			freezeObject(object);
+			for (unsigned long slot = 0; slot < record->shape->fieldNames.size; slot++) {
+				TRY(freezeValue(record->slots[slot], &record->slots[slot]));
+				writeBarrier(object, record->slots[slot]);
+			}
+			break;
+		}
+
+		// Flattening a key keeps its hash, so entries stay where they are
+		case HEAP_OBJECT_MAP: {
+			HeapMap* map = (HeapMap*) object;
+			freezeObject(object);
+			for (unsigned long index = 0; index < map->capacity; index++) {
+				MapEntry* entry = &map->entries[index];
+				if (entry->distance != 0) {
+					TRY(freezeValue(entry->key, &entry->key));
+					TRY(freezeValue(entry->value, &entry->value));
+					writeBarrier(object, entry->key);
+					writeBarrier(object, entry->value);
+				}
+			}
+			break;
+		}
+
+		// Vectors and persistent maps can't change already, but what they hold might
+		case HEAP_OBJECT_VECTOR: {
+			HeapVector* vector = (HeapVector*) object;
+			freezeObject(object);
+			for (unsigned long index = 0; index < vector->count; index++) {
+				UNWRAP_LET(Value element, vectorGet(vector, (double) index, &element));
+				TRY_LET(Value frozen, freezeValue(element, &frozen));
+			}
+			break;
+		}
+
+		case HEAP_OBJECT_PERSISTENT_MAP: {
+			ValueList values = emptyValueList();
+			freezeObject(object);
+			persistentMapEntries((HeapPersistentMap*) object, NULL, &values);
+			FOR_EACH(Value element, values) {
+				TRY_LET(Value frozen, freezeValue(element, &frozen));
+			}
+			END;
+			freeValueList(&values);
+			break;
+		}
+
+		default:
+			break;
+	}
+
+	RETURN_OK(output, value);
+}
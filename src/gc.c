@@ -0,0 +1,1227 @@
+#include "../include/gc.h"
+#include "../include/context.h"
+#include "../include/iterator.h"
+#include "../include/map.h"
+#include "../include/persistent.h"
+#include "../include/sugar.h"
+#include <stdatomic.h>
+#include <threads.h>
+#include <time.h>
+
+// Only needed to find how many processors there are, which standard C can't
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+/**
+ * How many units of work an increment does between reads of the clock. This is
+ * also the least an increment does, so every increment makes progress.
+ */
+#define WORK_PER_CLOCK_CHECK 256
+
+/**
+ * How many elements of a list's storage an increment marks as one unit of work.
+ * Longer storage is marked a chunk at a time, so it doesn't stretch the pause.
+ */
+#define ELEMENTS_PER_SCAN 64
+
+/**
+ * The most objects a marking thread steals from another at once.
+ */
+#define MAXIMUM_STOLEN_OBJECTS 256
+
+/**
+ * Marks one generation, following references only into objects of that
+ * generation. A minor collection marks the nursery and a major collection marks
+ * the old generation, each with its own gray stack; when marking in parallel,
+ * each thread has a gray stack of its own.
+ */
+typedef struct {
+	HeapObjectArray* gray;
+
+	/** The lock guarding `gray` from other threads, or `NULL` if only one thread marks. */
+	mtx_t* lock;
+	bool isOld;
+
+	/** Where to count the bytes of the objects marked, or `NULL` not to. */
+	size_t* markedBytes;
+} Marker;
+
+/**
+ * A marking thread's share of the gray stack. Threads that run out of work
+ * steal from the stacks of the others, so each is guarded by a lock.
+ */
+typedef struct {
+	mtx_t lock;
+	HeapObjectArray gray;
+	size_t markedBytes;
+	CollectorThreads* threads;
+	unsigned int index;
+} MarkStack;
+
+struct CollectorThreads {
+	thrd_t* helpers;
+	unsigned int helperCount;
+
+	/** A stack for each helper, followed by one for the program's thread. */
+	MarkStack* stacks;
+
+	/** Guards `round`, `runningHelpers` and `isStopping`. */
+	mtx_t lock;
+
+	/** Signalled when a round of marking starts or the helpers should stop. */
+	cnd_t roundStarted;
+
+	/** Signalled when the last helper finishes a round of marking. */
+	cnd_t roundFinished;
+
+	/** How many rounds of marking have started. */
+	unsigned long round;
+	unsigned int runningHelpers;
+	bool isStopping;
+
+	/** When the current round of marking has to stop, in nanoseconds. */
+	uint64_t deadline;
+
+	/** How many threads have run out of work in the current round. */
+	atomic_uint idleCount;
+
+	/** Whether the current round ran out of time. */
+	atomic_bool isOutOfTime;
+
+	/** The background sweep, if one has been started and not yet waited for. */
+	thrd_t sweeper;
+	bool isSweeperRunning;
+
+	/** Whether the background sweep has finished. */
+	atomic_bool isSweepDone;
+
+	/** The objects given to the background sweep, which shares their array with the heap. */
+	HeapObjectArray sweeping;
+
+	/** How many objects the background sweep kept, at the start of `sweeping`. */
+	unsigned long sweptSurvivorCount;
+};
+
+IMPLEMENT_KLEIN_LIST(RememberedElement)
+
+PRIVATE HeapObjectArray emptyHeapObjectArray(void) {
+	return (HeapObjectArray) {
+		.objects = NULL,
+		.count = 0,
+		.capacity = 0,
+	};
+}
+
+PRIVATE void appendToHeapObjectArray(HeapObjectArray* array, HeapObject* object) {
+	if (array->count == array->capacity) {
+		array->capacity = MAX(array->capacity * 2, 256);
+		array->objects = realloc(array->objects, sizeof(HeapObject*) * array->capacity);
+	}
+	array->objects[array->count++] = object;
+}
+
+Heap newHeap(void) {
+	return (Heap) {
+		.nursery = emptyHeapObjectArray(),
+		.nurseryBytes = 0,
+		.old = emptyHeapObjectArray(),
+		.oldBytes = 0,
+		.threshold = MINIMUM_HEAP_THRESHOLD,
+		.remembered = emptyHeapObjectArray(),
+		.rememberedElements = emptyRememberedElementList(),
+		.phase = COLLECTION_PHASE_IDLE,
+		.gray = emptyHeapObjectArray(),
+		.scanning = NULL,
+		.scanIndex = 0,
+		.youngGray = emptyHeapObjectArray(),
+		.sweeping = emptyHeapObjectArray(),
+		.sweepIndex = 0,
+		.survivorCount = 0,
+		.markedBytes = 0,
+		.promotedBytes = 0,
+		.maximumPause = DEFAULT_MAXIMUM_PAUSE * 1000,
+		.threadCount = 0,
+		.threads = NULL,
+		.roots = emptyValueList(),
+		.globalRoots = NULL,
+		.globalRootCount = 0,
+		.globalRootCapacity = 0,
+	};
+}
+
+/**
+ * Returns the number of bytes an object and the buffers it owns take up.
+ */
+PRIVATE size_t objectSize(HeapObject* object) {
+	switch ((HeapObjectType) object->type) {
+		case HEAP_OBJECT_STRING:
+			return sizeof(HeapString) + ((HeapString*) object)->length + 1;
+		case HEAP_OBJECT_ROPE:
+			return sizeof(HeapRope);
+		case HEAP_OBJECT_STRING_SLICE:
+			return sizeof(HeapStringSlice);
+		case HEAP_OBJECT_STRING_BUILDER:
+			return sizeof(HeapStringBuilder) + ((HeapStringBuilder*) object)->capacity;
+		case HEAP_OBJECT_LIST:
+			return sizeof(HeapList);
+		case HEAP_OBJECT_RANGE:
+			return sizeof(HeapRange);
+		case HEAP_OBJECT_ITERATOR:
+			return sizeof(HeapIterator);
+		case HEAP_OBJECT_MAP:
+			return sizeof(HeapMap) + sizeof(MapEntry) * ((HeapMap*) object)->capacity;
+		case HEAP_OBJECT_VECTOR:
+			return sizeof(HeapVector);
+		case HEAP_OBJECT_PERSISTENT_MAP:
+			return sizeof(HeapPersistentMap);
+		case HEAP_OBJECT_RECORD:
+			return sizeof(HeapRecord) + sizeof(Value) * ((HeapRecord*) object)->shape->fieldNames.size;
+		case HEAP_OBJECT_CLOSURE:
+			return sizeof(Closure) + sizeof(Upvalue*) * ((Closure*) object)->function->captures.size;
+		case HEAP_OBJECT_BUILTIN_FUNCTION:
+			return sizeof(HeapBuiltinFunction);
+		case HEAP_OBJECT_BOUND_METHOD:
+			return sizeof(HeapBoundMethod);
+		case HEAP_OBJECT_LIST_STORAGE: {
+			ListStorage* storage = (ListStorage*) object;
+			return sizeof(ListStorage) + sizeof(Value) * storage->elements.capacity + storage->bits.capacity / 8;
+		}
+		case HEAP_OBJECT_VECTOR_NODE:
+			return sizeof(VectorNode);
+		case HEAP_OBJECT_HAMT_NODE:
+			return sizeof(HamtNode) + sizeof(HamtSlot) * ((HamtNode*) object)->length;
+		case HEAP_OBJECT_UPVALUE:
+			return sizeof(Upvalue);
+	}
+
+	return 0;
+}
+
+/**
+ * Frees an object along with the buffers it owns. Nothing else the object
+ * refers to is touched, since it may already have been freed.
+ */
+PRIVATE void freeObject(HeapObject* object) {
+	switch ((HeapObjectType) object->type) {
+		case HEAP_OBJECT_STRING_BUILDER:
+			free(((HeapStringBuilder*) object)->characters);
+			break;
+		case HEAP_OBJECT_LIST_STORAGE: {
+			ListStorage* storage = (ListStorage*) object;
+			freeValueList(&storage->elements);
+			free(storage->bits.words);
+			break;
+		}
+		case HEAP_OBJECT_MAP:
+			free(((HeapMap*) object)->entries);
+			break;
+		case HEAP_OBJECT_CLOSURE:
+			free(((Closure*) object)->upvalues);
+			break;
+		case HEAP_OBJECT_ITERATOR: {
+			HeapIterator* iterator = (HeapIterator*) object;
+			if (iterator->file != NULL) {
+				fclose(iterator->file);
+			}
+			break;
+		}
+		default:
+			break;
+	}
+
+	free(object);
+}
+
+void trackObject(HeapObject* object, size_t size) {
+	Heap* heap = &CONTEXT->heap;
+	appendToHeapObjectArray(&heap->nursery, object);
+	heap->nurseryBytes += size;
+}
+
+void countAllocation(size_t size) {
+	CONTEXT->heap.nurseryBytes += size;
+}
+
+void pushRoot(Value value) {
+	appendToValueList(&CONTEXT->heap.roots, value);
+}
+
+unsigned long saveRoots(void) {
+	return CONTEXT->heap.roots.size;
+}
+
+void restoreRoots(unsigned long count) {
+	CONTEXT->heap.roots.size = count;
+}
+
+void addGlobalRoot(Value* location) {
+	Heap* heap = &CONTEXT->heap;
+	if (heap->globalRootCount == heap->globalRootCapacity) {
+		heap->globalRootCapacity = MAX(heap->globalRootCapacity * 2, 8);
+		heap->globalRoots = realloc(heap->globalRoots, sizeof(Value*) * heap->globalRootCapacity);
+	}
+	heap->globalRoots[heap->globalRootCount++] = location;
+}
+
+PRIVATE bool isObjectMarked(HeapObject* object) {
+	return atomic_load_explicit(&object->isMarked, memory_order_relaxed);
+}
+
+PRIVATE void unmarkObject(HeapObject* object) {
+	atomic_store_explicit(&object->isMarked, false, memory_order_relaxed);
+}
+
+/**
+ * Marks an object of the marker's generation, returning whether it wasn't marked
+ * already. When threads race to mark the same object, exactly one of them wins.
+ */
+PRIVATE bool claimObject(Marker* marker, HeapObject* object) {
+	if (object == NULL || object->isOld != marker->isOld) {
+		return false;
+	}
+
+	if (isObjectMarked(object) || atomic_exchange_explicit(&object->isMarked, true, memory_order_relaxed)) {
+		return false;
+	}
+
+	if (marker->markedBytes != NULL) {
+		*marker->markedBytes += objectSize(object);
+	}
+	return true;
+}
+
+/**
+ * Marks an object of the marker's generation as reachable, queueing it to have
+ * its references followed if it wasn't already.
+ */
+PRIVATE void markObject(Marker* marker, HeapObject* object) {
+	if (!claimObject(marker, object)) {
+		return;
+	}
+
+	if (marker->lock != NULL) {
+		mtx_lock(marker->lock);
+	}
+	appendToHeapObjectArray(marker->gray, object);
+	if (marker->lock != NULL) {
+		mtx_unlock(marker->lock);
+	}
+}
+
+PRIVATE void markValue(Marker* marker, Value value) {
+	if (IS_OBJECT(value)) {
+		markObject(marker, AS_OBJECT(value));
+	}
+}
+
+/**
+ * Marks a node of a vector's trie and everything under it. Nodes don't record
+ * their level, so it's passed down from the vector; every slot is marked, since
+ * slots past a vector's end may belong to another vector sharing the node. The
+ * trie is only a few levels deep, so this recurses.
+ */
+PRIVATE void markVectorNode(Marker* marker, VectorNode* node, unsigned int level) {
+	if (node == NULL || !claimObject(marker, &node->header)) {
+		return;
+	}
+
+	for (unsigned int index = 0; index < VECTOR_BRANCHING; index++) {
+		if (level == 0) {
+			markValue(marker, node->values[index]);
+		} else {
+			markVectorNode(marker, node->children[index], level - VECTOR_BITS);
+		}
+	}
+}
+
+/**
+ * Marks a node of a persistent map's trie and every entry under it.
+ */
+PRIVATE void markHamtNode(Marker* marker, HamtNode* node) {
+	if (node == NULL || !claimObject(marker, &node->header)) {
+		return;
+	}
+
+	for (uint32_t index = 0; index < node->length; index++) {
+		HamtSlot slot = node->slots[index];
+		if (slot.node != NULL) {
+			markHamtNode(marker, slot.node);
+		} else {
+			markValue(marker, slot.key);
+			markValue(marker, slot.value);
+		}
+	}
+}
+
+/**
+ * Marks everything of the marker's generation that an object refers to.
+ */
+PRIVATE void traceObject(Marker* marker, HeapObject* object) {
+	switch ((HeapObjectType) object->type) {
+		case HEAP_OBJECT_ROPE: {
+			HeapRope* rope = (HeapRope*) object;
+			markValue(marker, rope->left);
+			markValue(marker, rope->right);
+			markObject(marker, (HeapObject*) rope->flattened);
+			return;
+		}
+		case HEAP_OBJECT_STRING_SLICE: {
+			markObject(marker, (HeapObject*) ((HeapStringSlice*) object)->parent);
+			return;
+		}
+		case HEAP_OBJECT_LIST: {
+			markObject(marker, (HeapObject*) ((HeapList*) object)->storage);
+			return;
+		}
+		case HEAP_OBJECT_LIST_STORAGE: {
+
+			// Numbers and booleans never refer to anything
+			ListStorage* storage = (ListStorage*) object;
+			if (storage->kind == LIST_ELEMENTS_VALUES) {
+				FOR_EACH(Value element, storage->elements) {
+					markValue(marker, element);
+				}
+				END;
+			}
+			return;
+		}
+		case HEAP_OBJECT_RANGE: {
+			markObject(marker, (HeapObject*) ((HeapRange*) object)->materialized);
+			return;
+		}
+		case HEAP_OBJECT_ITERATOR: {
+			HeapIterator* iterator = (HeapIterator*) object;
+			markObject(marker, (HeapObject*) iterator->source);
+			markValue(marker, iterator->value);
+			return;
+		}
+		case HEAP_OBJECT_MAP: {
+			HeapMap* map = (HeapMap*) object;
+			for (unsigned long index = 0; index < map->capacity; index++) {
+				if (map->entries[index].distance != 0) {
+					markValue(marker, map->entries[index].key);
+					markValue(marker, map->entries[index].value);
+				}
+			}
+			return;
+		}
+		case HEAP_OBJECT_VECTOR: {
+			HeapVector* vector = (HeapVector*) object;
+			markVectorNode(marker, vector->root, vector->shift);
+			markVectorNode(marker, vector->tail, 0);
+			return;
+		}
+		case HEAP_OBJECT_PERSISTENT_MAP: {
+			markHamtNode(marker, ((HeapPersistentMap*) object)->root);
+			return;
+		}
+		case HEAP_OBJECT_RECORD: {
+			HeapRecord* record = (HeapRecord*) object;
+			for (unsigned long slot = 0; slot < record->shape->fieldNames.size; slot++) {
+				markValue(marker, record->slots[slot]);
+			}
+			return;
+		}
+		case HEAP_OBJECT_CLOSURE: {
+			Closure* closure = (Closure*) object;
+			for (unsigned long index = 0; index < closure->function->captures.size; index++) {
+				markObject(marker, (HeapObject*) closure->upvalues[index]);
+			}
+			return;
+		}
+		case HEAP_OBJECT_BOUND_METHOD: {
+			HeapBoundMethod* bound = (HeapBoundMethod*) object;
+			markValue(marker, bound->receiver);
+			markValue(marker, bound->method);
+			return;
+		}
+		case HEAP_OBJECT_UPVALUE: {
+
+			// An open upvalue points into a frame, which is marked as a root
+			markValue(marker, ((Upvalue*) object)->closed);
+			return;
+		}
+		default:
+			return;
+	}
+}
+
+/**
+ * Marks the roots of the marker's generation, without following their
+ * references.
+ */
+PRIVATE void markRoots(Heap* heap, Marker* marker) {
+	for (Frame* frame = CONTEXT->frame; frame != NULL; frame = frame->parent) {
+		for (unsigned long slot = 0; slot < frame->slotCount; slot++) {
+			markValue(marker, frame->slots[slot]);
+		}
+		markObject(marker, (HeapObject*) frame->closure);
+		for (Upvalue* upvalue = frame->openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+			markObject(marker, (HeapObject*) upvalue);
+		}
+	}
+
+	InternTable* strings = CONTEXT->strings;
+	if (strings != NULL) {
+		for (unsigned long index = 0; index < strings->capacity; index++) {
+			markObject(marker, (HeapObject*) strings->entries[index]);
+		}
+	}
+
+	for (unsigned long index = 0; index < heap->globalRootCount; index++) {
+		markValue(marker, *heap->globalRoots[index]);
+	}
+
+	FOR_EACH(Value root, heap->roots) {
+		markValue(marker, root);
+	}
+	END;
+}
+
+PRIVATE void drainGrayStack(Marker* marker) {
+	while (marker->gray->count > 0) {
+		traceObject(marker, marker->gray->objects[--marker->gray->count]);
+	}
+}
+
+PRIVATE Marker majorMarker(Heap* heap) {
+	return (Marker) {
+		.gray = &heap->gray,
+		.lock = NULL,
+		.isOld = true,
+		.markedBytes = &heap->markedBytes,
+	};
+}
+
+/**
+ * Marks an old object written into another old object while the old generation
+ * is being marked. A marked object is never traced again, so whatever it now
+ * refers to has to be marked for it.
+ */
+PRIVATE void markWrittenObject(Heap* heap, HeapObject* object, HeapObject* target) {
+	if (heap->phase == COLLECTION_PHASE_MARKING && isObjectMarked(object)) {
+		Marker marker = majorMarker(heap);
+		markObject(&marker, target);
+	}
+}
+
+void writeBarrier(HeapObject* object, Value value) {
+	if (!object->isOld || !IS_OBJECT(value)) {
+		return;
+	}
+
+	Heap* heap = &CONTEXT->heap;
+	HeapObject* target = AS_OBJECT(value);
+	if (target->isOld) {
+		markWrittenObject(heap, object, target);
+		return;
+	}
+
+	if (!object->isRemembered) {
+		object->isRemembered = true;
+		appendToHeapObjectArray(&heap->remembered, object);
+	}
+}
+
+void writeElementBarrier(HeapObject* storage, unsigned long index, Value value) {
+	if (!storage->isOld || !IS_OBJECT(value)) {
+		return;
+	}
+
+	Heap* heap = &CONTEXT->heap;
+	HeapObject* target = AS_OBJECT(value);
+	if (target->isOld) {
+		markWrittenObject(heap, storage, target);
+		return;
+	}
+
+	// An element written more than once is remembered more than once, which is harmless
+	appendToRememberedElementList(&heap->rememberedElements, (RememberedElement) {.storage = storage, .index = index});
+}
+
+/**
+ * Stops a dead list from counting towards its storage's references, so that
+ * storage it shared with a live list isn't copied needlessly. This must happen
+ * before the storage could be freed.
+ */
+PRIVATE void releaseDeadList(HeapObject* object) {
+	if (isObjectMarked(object) || object->type != HEAP_OBJECT_LIST) {
+		return;
+	}
+
+	// Storage of another generation is only freed by that generation's collection
+	ListStorage* storage = ((HeapList*) object)->storage;
+	bool isLive = storage->header.isOld != object->isOld || isObjectMarked(&storage->header);
+	if (isLive && storage->references != FROZEN_REFERENCES) {
+		storage->references--;
+	}
+}
+
+/**
+ * Moves a nursery object that survived a minor collection into the old
+ * generation. While the old generation is being marked, it's marked too, since
+ * it may refer to old objects that nothing marked refers to anymore.
+ */
+PRIVATE void promoteObject(Heap* heap, HeapObject* object) {
+	object->isOld = true;
+	unmarkObject(object);
+	size_t size = objectSize(object);
+	heap->oldBytes += size;
+	heap->promotedBytes += size;
+	appendToHeapObjectArray(&heap->old, object);
+
+	// Trie nodes are marked through their vector or map, which tells them their level
+	bool isNode = object->type == HEAP_OBJECT_VECTOR_NODE || object->type == HEAP_OBJECT_HAMT_NODE;
+	if (heap->phase == COLLECTION_PHASE_MARKING && !isNode) {
+		Marker marker = majorMarker(heap);
+		markObject(&marker, object);
+	}
+}
+
+/**
+ * Frees the dead objects of the nursery and promotes the rest, leaving it empty.
+ * Nursery objects are kept alive by the roots and by remembered old objects,
+ * which are the only old objects that can refer to them.
+ */
+PRIVATE void collectNursery(Heap* heap) {
+	Marker marker = {
+		.gray = &heap->youngGray,
+		.lock = NULL,
+		.isOld = false,
+		.markedBytes = NULL,
+	};
+	markRoots(heap, &marker);
+	for (unsigned long index = 0; index < heap->remembered.count; index++) {
+		HeapObject* object = heap->remembered.objects[index];
+		object->isRemembered = false;
+		traceObject(&marker, object);
+	}
+	heap->remembered.count = 0;
+
+	// The storage may have shrunk or been packed into bits since the element was written
+	FOR_EACH(RememberedElement element, heap->rememberedElements) {
+		ListStorage* storage = (ListStorage*) element.storage;
+		if (storage->kind == LIST_ELEMENTS_VALUES && element.index < storage->elements.size) {
+			markValue(&marker, storage->elements.data[element.index]);
+		}
+	}
+	END;
+	heap->rememberedElements.size = 0;
+	drainGrayStack(&marker);
+
+	for (unsigned long index = 0; index < heap->nursery.count; index++) {
+		releaseDeadList(heap->nursery.objects[index]);
+	}
+
+	for (unsigned long index = 0; index < heap->nursery.count; index++) {
+		HeapObject* object = heap->nursery.objects[index];
+		if (isObjectMarked(object)) {
+			promoteObject(heap, object);
+		} else {
+			freeObject(object);
+		}
+	}
+	heap->nursery.count = 0;
+	heap->nurseryBytes = 0;
+}
+
+PRIVATE bool isLongStorage(HeapObject* object) {
+	if (object->type != HEAP_OBJECT_LIST_STORAGE) {
+		return false;
+	}
+
+	ListStorage* storage = (ListStorage*) object;
+	return storage->kind == LIST_ELEMENTS_VALUES && storage->elements.size > ELEMENTS_PER_SCAN;
+}
+
+/**
+ * Marks the next chunk of the storage being scanned. Elements written behind the
+ * scan are caught by the write barrier, since the storage is already marked, and
+ * the storage can shrink or be packed between chunks, so its size is read afresh.
+ */
+PRIVATE void scanElements(Heap* heap, Marker* marker) {
+	ListStorage* storage = (ListStorage*) heap->scanning;
+	if (storage->kind != LIST_ELEMENTS_VALUES) {
+		heap->scanning = NULL;
+		return;
+	}
+
+	unsigned long end = MIN(heap->scanIndex + ELEMENTS_PER_SCAN, storage->elements.size);
+	for (unsigned long index = heap->scanIndex; index < end; index++) {
+		markValue(marker, storage->elements.data[index]);
+	}
+	heap->scanIndex = end;
+	if (end >= storage->elements.size) {
+		heap->scanning = NULL;
+	}
+}
+
+/**
+ * Returns the time in nanoseconds since some fixed point in the past. Standard C
+ * only has the calendar time, so a change to the system clock during a pause can
+ * stretch or cut it short.
+ */
+PRIVATE uint64_t currentTime(void) {
+	struct timespec time;
+	timespec_get(&time, TIME_UTC);
+	return (uint64_t) time.tv_sec * 1000000000 + (uint64_t) time.tv_nsec;
+}
+
+/**
+ * Counts a unit of work done by an increment, returning whether there's time
+ * for another.
+ */
+PRIVATE bool hasTimeLeft(unsigned long* work, uint64_t deadline) {
+	(*work)++;
+	return *work % WORK_PER_CLOCK_CHECK != 0 || currentTime() < deadline;
+}
+
+PRIVATE HeapObject* popMarkStack(MarkStack* stack) {
+	mtx_lock(&stack->lock);
+	HeapObject* object = stack->gray.count > 0 ? stack->gray.objects[--stack->gray.count] : NULL;
+	mtx_unlock(&stack->lock);
+	return object;
+}
+
+/**
+ * Takes up to half of the gray objects of the first other thread that has any,
+ * returning one to trace and pushing the rest onto the thief's own stack. Only
+ * one lock is held at a time, so two threads stealing from each other can't
+ * deadlock.
+ */
+PRIVATE HeapObject* stealObject(MarkStack* thief) {
+	CollectorThreads* threads = thief->threads;
+	unsigned int stackCount = threads->helperCount + 1;
+	HeapObject* stolen[MAXIMUM_STOLEN_OBJECTS];
+	for (unsigned int offset = 1; offset < stackCount; offset++) {
+		MarkStack* victim = &threads->stacks[(thief->index + offset) % stackCount];
+		mtx_lock(&victim->lock);
+		unsigned long count = MIN((victim->gray.count + 1) / 2, MAXIMUM_STOLEN_OBJECTS);
+		victim->gray.count -= count;
+		memcpy(stolen, victim->gray.objects + victim->gray.count, sizeof(HeapObject*) * count);
+		mtx_unlock(&victim->lock);
+		if (count == 0) {
+			continue;
+		}
+
+		mtx_lock(&thief->lock);
+		for (unsigned long index = 1; index < count; index++) {
+			appendToHeapObjectArray(&thief->gray, stolen[index]);
+		}
+		mtx_unlock(&thief->lock);
+		return stolen[0];
+	}
+
+	return NULL;
+}
+
+PRIVATE bool isAnyMarkStackFull(CollectorThreads* threads) {
+	for (unsigned int index = 0; index <= threads->helperCount; index++) {
+		MarkStack* stack = &threads->stacks[index];
+		mtx_lock(&stack->lock);
+		bool isFull = stack->gray.count > 0;
+		mtx_unlock(&stack->lock);
+		if (isFull) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Waits until another thread has work to steal, returning `false` if marking
+ * is over instead. A thread only waits once its own stack is empty, and a waiting
+ * thread never adds to its stack, so once every thread is waiting no stack can
+ * ever fill again.
+ */
+PRIVATE bool waitForWork(CollectorThreads* threads) {
+	unsigned int stackCount = threads->helperCount + 1;
+	atomic_fetch_add_explicit(&threads->idleCount, 1, memory_order_acq_rel);
+	while (true) {
+		if (atomic_load_explicit(&threads->idleCount, memory_order_acquire) == stackCount || atomic_load_explicit(&threads->isOutOfTime, memory_order_relaxed)) {
+			return false;
+		}
+
+		if (isAnyMarkStackFull(threads)) {
+			atomic_fetch_sub_explicit(&threads->idleCount, 1, memory_order_acq_rel);
+			return true;
+		}
+		thrd_yield();
+	}
+}
+
+/**
+ * Marks from a thread's own stack, stealing from the others whenever it's empty,
+ * until every stack is empty or the round runs out of time.
+ */
+PRIVATE void markWithStack(MarkStack* stack) {
+	CollectorThreads* threads = stack->threads;
+	Marker marker = {
+		.gray = &stack->gray,
+		.lock = &stack->lock,
+		.isOld = true,
+		.markedBytes = &stack->markedBytes,
+	};
+
+	unsigned long work = 0;
+	while (!atomic_load_explicit(&threads->isOutOfTime, memory_order_relaxed)) {
+		HeapObject* object = popMarkStack(stack);
+		if (object == NULL) {
+			object = stealObject(stack);
+		}
+		if (object == NULL) {
+			if (waitForWork(threads)) {
+				continue;
+			}
+			return;
+		}
+
+		traceObject(&marker, object);
+		if (!hasTimeLeft(&work, threads->deadline)) {
+			atomic_store_explicit(&threads->isOutOfTime, true, memory_order_relaxed);
+		}
+	}
+}
+
+/**
+ * The body of a helper thread, which joins in each round of marking until the
+ * heap is freed.
+ */
+PRIVATE int runHelper(void* argument) {
+	MarkStack* stack = argument;
+	CollectorThreads* threads = stack->threads;
+	unsigned long round = 0;
+
+	mtx_lock(&threads->lock);
+	while (true) {
+		while (threads->round == round && !threads->isStopping) {
+			cnd_wait(&threads->roundStarted, &threads->lock);
+		}
+		if (threads->isStopping) {
+			break;
+		}
+		round = threads->round;
+		mtx_unlock(&threads->lock);
+
+		markWithStack(stack);
+
+		mtx_lock(&threads->lock);
+		threads->runningHelpers--;
+		if (threads->runningHelpers == 0) {
+			cnd_signal(&threads->roundFinished);
+		}
+	}
+	mtx_unlock(&threads->lock);
+	return 0;
+}
+
+/**
+ * Returns how many processors are online, or 0 if the system can't say.
+ */
+PRIVATE long countProcessors(void) {
+#ifdef _SC_NPROCESSORS_ONLN
+	return sysconf(_SC_NPROCESSORS_ONLN);
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Returns the heap's helper threads, starting them if they aren't running yet.
+ * Helpers beyond one per spare processor would only take turns with each other
+ * and the program, so no more than that are started, and if the system won't
+ * start as many as asked for, the collector makes do with those it could.
+ */
+PRIVATE CollectorThreads* startCollectorThreads(Heap* heap) {
+	if (heap->threads != NULL) {
+		return heap->threads;
+	}
+
+	long processorCount = countProcessors();
+	unsigned int helperCount = heap->threadCount;
+	if (processorCount > 0) {
+		helperCount = processorCount > 1 ? MIN(helperCount, (unsigned int) processorCount - 1) : 0;
+	}
+
+	CollectorThreads* threads = malloc(sizeof(CollectorThreads));
+	threads->helpers = malloc(sizeof(thrd_t) * MAX(helperCount, 1));
+	threads->helperCount = helperCount;
+	threads->stacks = malloc(sizeof(MarkStack) * (helperCount + 1));
+	for (unsigned int index = 0; index <= helperCount; index++) {
+		MarkStack* stack = &threads->stacks[index];
+		mtx_init(&stack->lock, mtx_plain);
+		stack->gray = emptyHeapObjectArray();
+		stack->markedBytes = 0;
+		stack->threads = threads;
+		stack->index = index;
+	}
+
+	mtx_init(&threads->lock, mtx_plain);
+	cnd_init(&threads->roundStarted);
+	cnd_init(&threads->roundFinished);
+	threads->round = 0;
+	threads->runningHelpers = 0;
+	threads->isStopping = false;
+	threads->deadline = 0;
+	atomic_init(&threads->idleCount, 0);
+	atomic_init(&threads->isOutOfTime, false);
+	threads->isSweeperRunning = false;
+	atomic_init(&threads->isSweepDone, false);
+	threads->sweeping = emptyHeapObjectArray();
+	threads->sweptSurvivorCount = 0;
+
+	// The program's thread uses the stack after the last helper that started
+	for (unsigned int index = 0; index < helperCount; index++) {
+		if (thrd_create(&threads->helpers[index], runHelper, &threads->stacks[index]) != thrd_success) {
+			threads->helperCount = index;
+			break;
+		}
+	}
+
+	heap->threads = threads;
+	return threads;
+}
+
+/**
+ * Marks from the gray stack with every helper thread until it's empty or the
+ * deadline passes, returning whether it's empty.
+ */
+PRIVATE bool markInParallel(Heap* heap, uint64_t deadline) {
+	CollectorThreads* threads = startCollectorThreads(heap);
+	unsigned int stackCount = threads->helperCount + 1;
+
+	// Deal the gray objects out evenly, so every thread starts with work
+	for (unsigned long index = 0; index < heap->gray.count; index++) {
+		appendToHeapObjectArray(&threads->stacks[index % stackCount].gray, heap->gray.objects[index]);
+	}
+	heap->gray.count = 0;
+	threads->deadline = deadline;
+	atomic_store_explicit(&threads->idleCount, 0, memory_order_relaxed);
+	atomic_store_explicit(&threads->isOutOfTime, false, memory_order_relaxed);
+
+	mtx_lock(&threads->lock);
+	threads->round++;
+	threads->runningHelpers = threads->helperCount;
+	cnd_broadcast(&threads->roundStarted);
+	mtx_unlock(&threads->lock);
+
+	markWithStack(&threads->stacks[threads->helperCount]);
+
+	mtx_lock(&threads->lock);
+	while (threads->runningHelpers > 0) {
+		cnd_wait(&threads->roundFinished, &threads->lock);
+	}
+	mtx_unlock(&threads->lock);
+
+	// Whatever's left when time runs out waits for the next increment
+	for (unsigned int index = 0; index < stackCount; index++) {
+		MarkStack* stack = &threads->stacks[index];
+		for (unsigned long object = 0; object < stack->gray.count; object++) {
+			appendToHeapObjectArray(&heap->gray, stack->gray.objects[object]);
+		}
+		stack->gray.count = 0;
+		heap->markedBytes += stack->markedBytes;
+		stack->markedBytes = 0;
+	}
+
+	return heap->gray.count == 0;
+}
+
+/**
+ * Follows every object on the major collection's gray stack, in parallel if the
+ * heap has helper threads.
+ */
+PRIVATE void drainMajorGrayStack(Heap* heap) {
+	if (heap->threadCount > 0) {
+		markInParallel(heap, UINT64_MAX);
+		return;
+	}
+
+	Marker marker = majorMarker(heap);
+	drainGrayStack(&marker);
+}
+
+/**
+ * Ends the marking phase by marking the roots again, since they change without
+ * write barriers, and following them to completion. Every old object that's
+ * reachable is then marked, and the rest can be freed.
+ */
+PRIVATE void finishMarking(Heap* heap) {
+	Marker marker = majorMarker(heap);
+	while (heap->scanning != NULL) {
+		scanElements(heap, &marker);
+	}
+	markRoots(heap, &marker);
+	drainMajorGrayStack(heap);
+
+	heap->phase = COLLECTION_PHASE_RELEASING;
+	heap->sweeping = heap->old;
+	heap->old = emptyHeapObjectArray();
+	heap->sweepIndex = 0;
+	heap->survivorCount = 0;
+	heap->promotedBytes = 0;
+}
+
+/**
+ * Frees an old object if it's unmarked, and otherwise clears its mark, returning
+ * whether it survived. The program never reads the marks of old objects while
+ * they're being swept, so this is safe to do on a background thread.
+ */
+PRIVATE bool sweepObject(HeapObject* object) {
+	if (!isObjectMarked(object)) {
+		freeObject(object);
+		return false;
+	}
+
+	unmarkObject(object);
+	return true;
+}
+
+/**
+ * The body of the background sweep, which sweeps the objects it was given and
+ * moves the survivors to the start of their array. Nothing reachable refers to
+ * the objects it frees, so the program can't notice them go.
+ */
+PRIVATE int runSweeper(void* argument) {
+	CollectorThreads* threads = argument;
+	HeapObjectArray* sweeping = &threads->sweeping;
+	unsigned long survivorCount = 0;
+	for (unsigned long index = 0; index < sweeping->count; index++) {
+		HeapObject* object = sweeping->objects[index];
+		if (sweepObject(object)) {
+			sweeping->objects[survivorCount++] = object;
+		}
+	}
+
+	threads->sweptSurvivorCount = survivorCount;
+	atomic_store_explicit(&threads->isSweepDone, true, memory_order_release);
+	return 0;
+}
+
+/**
+ * Starts sweeping on a background thread. If the thread can't be started, the
+ * sweep happens in increments instead.
+ */
+PRIVATE void startSweeper(Heap* heap) {
+	CollectorThreads* threads = startCollectorThreads(heap);
+	threads->sweeping = heap->sweeping;
+	atomic_store_explicit(&threads->isSweepDone, false, memory_order_relaxed);
+	threads->isSweeperRunning = thrd_create(&threads->sweeper, runSweeper, threads) == thrd_success;
+}
+
+PRIVATE bool isSweeperRunning(Heap* heap) {
+	return heap->threads != NULL && heap->threads->isSweeperRunning;
+}
+
+/**
+ * Waits for the background sweep to finish, if there is one, and records which
+ * objects it kept.
+ */
+PRIVATE void waitForSweeper(Heap* heap) {
+	if (!isSweeperRunning(heap)) {
+		return;
+	}
+
+	thrd_join(heap->threads->sweeper, NULL);
+	heap->threads->isSweeperRunning = false;
+	heap->sweepIndex = heap->sweeping.count;
+	heap->survivorCount = heap->threads->sweptSurvivorCount;
+}
+
+/**
+ * Ends a major collection, adding the objects promoted while it ran after the
+ * survivors and setting the size at which the next one starts.
+ */
+PRIVATE void finishSweeping(Heap* heap) {
+	heap->sweeping.count = heap->survivorCount;
+	for (unsigned long index = 0; index < heap->old.count; index++) {
+		appendToHeapObjectArray(&heap->sweeping, heap->old.objects[index]);
+	}
+	free(heap->old.objects);
+	heap->old = heap->sweeping;
+	heap->sweeping = emptyHeapObjectArray();
+
+	heap->oldBytes = heap->markedBytes + heap->promotedBytes;
+	heap->threshold = MAX(heap->oldBytes * 2, MINIMUM_HEAP_THRESHOLD);
+	heap->phase = COLLECTION_PHASE_IDLE;
+}
+
+PRIVATE void startMajorCollection(Heap* heap) {
+	heap->phase = COLLECTION_PHASE_MARKING;
+	heap->markedBytes = 0;
+	Marker marker = majorMarker(heap);
+	markRoots(heap, &marker);
+}
+
+/**
+ * Advances the major collection in progress until it finishes or the deadline
+ * passes. A deadline of `UINT64_MAX` finishes it, waiting for a background sweep
+ * if need be. The nursery must be empty, so that every live object is either old
+ * or reachable only through the roots.
+ */
+PRIVATE void collectIncrement(Heap* heap, uint64_t deadline) {
+	Marker marker = majorMarker(heap);
+	unsigned long work = 0;
+	while (heap->phase != COLLECTION_PHASE_IDLE && hasTimeLeft(&work, deadline)) {
+		switch (heap->phase) {
+			case COLLECTION_PHASE_MARKING: {
+				if (heap->scanning != NULL) {
+					scanElements(heap, &marker);
+					break;
+				}
+				if (heap->gray.count == 0) {
+					finishMarking(heap);
+					break;
+				}
+				if (heap->threadCount > 0) {
+					if (!markInParallel(heap, deadline)) {
+						return;
+					}
+					break;
+				}
+
+				HeapObject* object = heap->gray.objects[--heap->gray.count];
+				if (isLongStorage(object)) {
+					heap->scanning = object;
+					heap->scanIndex = 0;
+				} else {
+					traceObject(&marker, object);
+				}
+				break;
+			}
+			case COLLECTION_PHASE_RELEASING:
+				if (heap->sweepIndex < heap->sweeping.count) {
+					releaseDeadList(heap->sweeping.objects[heap->sweepIndex++]);
+					break;
+				}
+
+				heap->phase = COLLECTION_PHASE_SWEEPING;
+				heap->sweepIndex = 0;
+				if (heap->threadCount > 0) {
+					startSweeper(heap);
+				}
+				break;
+			case COLLECTION_PHASE_SWEEPING: {
+				if (isSweeperRunning(heap)) {
+					if (deadline != UINT64_MAX && !atomic_load_explicit(&heap->threads->isSweepDone, memory_order_acquire)) {
+						return;
+					}
+					waitForSweeper(heap);
+				}
+
+				if (heap->sweepIndex == heap->sweeping.count) {
+					finishSweeping(heap);
+					break;
+				}
+
+				HeapObject* object = heap->sweeping.objects[heap->sweepIndex++];
+				if (sweepObject(object)) {
+					heap->sweeping.objects[heap->survivorCount++] = object;
+				}
+				break;
+			}
+			case COLLECTION_PHASE_IDLE:
+				break;
+		}
+	}
+}
+
+void collectGarbage(void) {
+	Heap* heap = &CONTEXT->heap;
+	collectNursery(heap);
+
+	// A collection already under way may have missed garbage made since it started
+	collectIncrement(heap, UINT64_MAX);
+	startMajorCollection(heap);
+	collectIncrement(heap, UINT64_MAX);
+}
+
+void collectGarbageIfNeeded(void) {
+	Heap* heap = &CONTEXT->heap;
+	if (heap->nurseryBytes < NURSERY_SIZE) {
+		return;
+	}
+
+	uint64_t start = currentTime();
+	collectNursery(heap);
+	if (heap->phase == COLLECTION_PHASE_IDLE && heap->oldBytes >= heap->threshold) {
+		startMajorCollection(heap);
+	}
+	collectIncrement(heap, start + heap->maximumPause);
+}
+
+void setMaximumPause(unsigned long microseconds) {
+	CONTEXT->heap.maximumPause = microseconds * 1000;
+}
+
+/**
+ * Stops the heap's helper threads, if they're running, after waiting for any
+ * background sweep.
+ */
+PRIVATE void stopCollectorThreads(Heap* heap) {
+	CollectorThreads* threads = heap->threads;
+	if (threads == NULL) {
+		return;
+	}
+
+	waitForSweeper(heap);
+	mtx_lock(&threads->lock);
+	threads->isStopping = true;
+	cnd_broadcast(&threads->roundStarted);
+	mtx_unlock(&threads->lock);
+	for (unsigned int index = 0; index < threads->helperCount; index++) {
+		thrd_join(threads->helpers[index], NULL);
+	}
+
+	for (unsigned int index = 0; index <= threads->helperCount; index++) {
+		mtx_destroy(&threads->stacks[index].lock);
+		free(threads->stacks[index].gray.objects);
+	}
+	mtx_destroy(&threads->lock);
+	cnd_destroy(&threads->roundStarted);
+	cnd_destroy(&threads->roundFinished);
+	free(threads->helpers);
+	free(threads->stacks);
+	free(threads);
+	heap->threads = NULL;
+}
+
+void setCollectorThreads(unsigned int count) {
+	Heap* heap = &CONTEXT->heap;
+	stopCollectorThreads(heap);
+	heap->threadCount = count;
+}
+
+void freeHeap(Heap* heap) {
+	stopCollectorThreads(heap);
+	for (unsigned long index = 0; index < heap->nursery.count; index++) {
+		freeObject(heap->nursery.objects[index]);
+	}
+	for (unsigned long index = 0; index < heap->old.count; index++) {
+		freeObject(heap->old.objects[index]);
+	}
+
+	// Partway through a sweep, only the survivors and the objects not yet swept are left
+	bool isSweeping = heap->phase == COLLECTION_PHASE_SWEEPING;
+	unsigned long survivorCount = isSweeping ? heap->survivorCount : 0;
+	unsigned long sweepIndex = isSweeping ? heap->sweepIndex : 0;
+	for (unsigned long index = 0; index < survivorCount; index++) {
+		freeObject(heap->sweeping.objects[index]);
+	}
+	for (unsigned long index = sweepIndex; index < heap->sweeping.count; index++) {
+		freeObject(heap->sweeping.objects[index]);
+	}
+
+	free(heap->nursery.objects);
+	free(heap->old.objects);
+	free(heap->sweeping.objects);
+	free(heap->remembered.objects);
+	freeRememberedElementList(&heap->rememberedElements);
+	free(heap->gray.objects);
+	free(heap->youngGray.objects);
+	freeValueList(&heap->roots);
+	free(heap->globalRoots);
+	*heap = newHeap();
+}
@@ -0,0 +1,326 @@
+#include "../include/iterator.h"
+#include "../include/gc.h"
+#include "../include/map.h"
+#include "../include/persistent.h"
+#include "../include/runner.h"
+#include <string.h>
+
+PRIVATE HeapIterator* allocateIterator(IteratorKind kind) {
+	HeapIterator* iterator = (HeapIterator*) allocateObject(HEAP_OBJECT_ITERATOR, sizeof(HeapIterator));
+	iterator->kind = kind;
+	iterator->source = NULL;
+	iterator->value = NULL_VALUE;
+	iterator->index = 0;
+	iterator->current = 0;
+	iterator->high = 0;
+	iterator->file = NULL;
+	return iterator;
+}
+
+bool isIterator(Value value) {
+	return isObjectOfType(value, HEAP_OBJECT_ITERATOR);
+}
+
+KleinResult iteratorOf(Value value, HeapIterator** output) {
+	if (isIterator(value)) {
+		RETURN_OK(output, (HeapIterator*) AS_OBJECT(value));
+	}
+
+	HeapRange* range = getUnmaterializedRange(value);
+	if (range != NULL) {
+		HeapIterator* iterator = allocateIterator(ITERATOR_RANGE);
+		iterator->current = range->low;
+		iterator->high = range->high;
+		RETURN_OK(output, iterator);
+	}
+
+	if (isList(value)) {
+		HeapIterator* iterator = allocateIterator(ITERATOR_LIST);
+		iterator->value = value;
+		RETURN_OK(output, iterator);
+	}
+
+	if (isString(value)) {
+		HeapIterator* iterator = allocateIterator(ITERATOR_STRING);
+		iterator->value = value;
+		RETURN_OK(output, iterator);
+	}
+
+	if (isMap(value)) {
+		HeapIterator* iterator = allocateIterator(ITERATOR_MAP_KEYS);
+		iterator->value = value;
+		RETURN_OK(output, iterator);
+	}
+
+	if (isVector(value)) {
+		HeapIterator* iterator = allocateIterator(ITERATOR_VECTOR);
+		iterator->value = value;
+		RETURN_OK(output, iterator);
+	}
+
+	if (isPersistentMap(value)) {
+		TRY_LET(Value keys, persistentMapIterator(ITERATOR_MAP_KEYS, value, &keys));
+		RETURN_OK(output, (HeapIterator*) AS_OBJECT(keys));
+	}
+
+	return (KleinResult) {
+		.type = KLEIN_ERROR_INTERNAL,
+	};
+}
+
+KleinResult linesIterator(String path, Value* output) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_INTERNAL,
+		};
+	}
+
+	HeapIterator* iterator = allocateIterator(ITERATOR_LINES);
+	iterator->file = file;
+	RETURN_OK(output, OBJECT_VALUE(iterator));
+}
+
+KleinResult mapIterator(IteratorKind kind, Value map, Value* output) {
+	HeapIterator* iterator = allocateIterator(kind);
+	iterator->value = map;
+	RETURN_OK(output, OBJECT_VALUE(iterator));
+}
+
+KleinResult combinatorIterator(IteratorKind kind, HeapIterator* source, Value value, unsigned long count, Value* output) {
+	HeapIterator* iterator = allocateIterator(kind);
+	iterator->source = source;
+	iterator->value = value;
+	iterator->index = count;
+	RETURN_OK(output, OBJECT_VALUE(iterator));
+}
+
+/**
+ * Calls a function of one argument, as `map` and `filter` do for each value. The
+ * argument is kept alive for the duration of the call.
+ */
+PRIVATE KleinResult callWith(Value function, Value argument, Value* output) {
+	unsigned long roots = saveRoots();
+	pushRoot(argument);
+	Value argumentBuffer[SMALL_LIST_CAPACITY];
+	ValueList arguments = emptyValueListWithBuffer(argumentBuffer, SMALL_LIST_CAPACITY);
+	appendToValueList(&arguments, argument);
+	KleinResult result = callFunction(function, &arguments, output);
+	freeValueList(&arguments);
+	restoreRoots(roots);
+	return result;
+}
+
+/**
+ * Creates the two-element list `[first, second]` produced by `zip` and `enumerate`.
+ */
+PRIVATE KleinResult pairValue(Value first, Value second, Value* output) {
+	ValueList pair = emptyValueList();
+	appendToValueList(&pair, first);
+	appendToValueList(&pair, second);
+	return listValue(pair, output);
+}
+
+KleinResult persistentMapIterator(IteratorKind kind, Value map, Value* output) {
+	TRY_LET(HeapPersistentMap * persistentMap, getPersistentMap(map, &persistentMap));
+	ValueList keys = emptyValueList();
+	ValueList values = emptyValueList();
+	persistentMapEntries(persistentMap, &keys, &values);
+
+	ValueList elements;
+	switch (kind) {
+		case ITERATOR_MAP_KEYS:
+			elements = keys;
+			freeValueList(&values);
+			break;
+		case ITERATOR_MAP_VALUES:
+			elements = values;
+			freeValueList(&keys);
+			break;
+		default:
+			elements = emptyValueList();
+			FOR_EACH(Value key, keys) {
+				TRY_LET(Value entry, pairValue(key, values.data[index__], &entry));
+				appendToValueList(&elements, entry);
+			}
+			END;
+			freeValueList(&keys);
+			freeValueList(&values);
+	}
+
+	HeapIterator* iterator = allocateIterator(ITERATOR_LIST);
+	TRY(listValue(elements, &iterator->value));
+	RETURN_OK(output, OBJECT_VALUE(iterator));
+}
+
+/**
+ * Reads the next line of a `lines` iterator's file, closing it at the end.
+ */
+PRIVATE KleinResult advanceLines(HeapIterator* iterator, Value* output, bool* isDone) {
+	if (iterator->file == NULL) {
+		*isDone = true;
+		return OK;
+	}
+
+	char* line = NULL;
+	size_t capacity = 0;
+	ssize_t length = getline(&line, &capacity, iterator->file);
+	if (length < 0) {
+		free(line);
+		fclose(iterator->file);
+		iterator->file = NULL;
+		*isDone = true;
+		return OK;
+	}
+
+	// Line break
+	while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+		length--;
+	}
+
+	*isDone = false;
+	KleinResult result = stringValueOfLength(line, (unsigned long) length, output);
+	free(line);
+	return result;
+}
+
+/**
+ * Moves a map iterator to its map's next occupied slot. The entry array is read
+ * afresh each time, so changing the map while iterating over it never reads
+ * freed memory.
+ */
+PRIVATE KleinResult advanceMap(HeapIterator* iterator, Value* output, bool* isDone) {
+	TRY_LET(HeapMap * map, getMap(iterator->value, &map));
+	while (iterator->index < map->capacity && map->entries[iterator->index].distance == 0) {
+		iterator->index++;
+	}
+	if (iterator->index >= map->capacity) {
+		*isDone = true;
+		return OK;
+	}
+
+	*isDone = false;
+	MapEntry entry = map->entries[iterator->index++];
+	switch (iterator->kind) {
+		case ITERATOR_MAP_KEYS:
+			RETURN_OK(output, entry.key);
+		case ITERATOR_MAP_VALUES:
+			RETURN_OK(output, entry.value);
+		default:
+			return pairValue(entry.key, entry.value, output);
+	}
+}
+
+KleinResult advanceIterator(HeapIterator* iterator, Value* output, bool* isDone) {
+	switch (iterator->kind) {
+		case ITERATOR_LIST: {
+			TRY_LET(HeapList * list, getList(iterator->value, &list));
+			if (iterator->index >= list->length) {
+				*isDone = true;
+				return OK;
+			}
+			*isDone = false;
+			RETURN_OK(output, listElement(list, iterator->index++));
+		}
+		case ITERATOR_VECTOR: {
+			TRY_LET(HeapVector * vector, getVector(iterator->value, &vector));
+			if (iterator->index >= vector->count) {
+				*isDone = true;
+				return OK;
+			}
+			*isDone = false;
+			return vectorGet(vector, (double) iterator->index++, output);
+		}
+		case ITERATOR_RANGE: {
+			if (iterator->current > iterator->high) {
+				*isDone = true;
+				return OK;
+			}
+			*isDone = false;
+			return numberValue(iterator->current++, output);
+		}
+		case ITERATOR_STRING: {
+			if (iterator->index >= stringValueLength(iterator->value)) {
+				*isDone = true;
+				return OK;
+			}
+			*isDone = false;
+			TRY_LET(const char* characters, getStringCharacters(iterator->value, &characters));
+
+			// Single characters are interned, so walking a string doesn't allocate
+			HeapString* character = internString(&characters[iterator->index++], 1);
+			RETURN_OK(output, OBJECT_VALUE(character));
+		}
+		case ITERATOR_LINES: {
+			return advanceLines(iterator, output, isDone);
+		}
+		case ITERATOR_MAP_KEYS:
+		case ITERATOR_MAP_VALUES:
+		case ITERATOR_MAP_ENTRIES: {
+			return advanceMap(iterator, output, isDone);
+		}
+		case ITERATOR_MAP: {
+			TRY_LET(Value value, advanceIterator(iterator->source, &value, isDone));
+			if (*isDone) {
+				return OK;
+			}
+			return callWith(iterator->value, value, output);
+		}
+		case ITERATOR_FILTER: {
+			while (true) {
+				TRY_LET(Value value, advanceIterator(iterator->source, &value, isDone));
+				if (*isDone) {
+					return OK;
+				}
+				TRY_LET(Value keep, callWith(iterator->value, value, &keep));
+				TRY_LET(bool isKept, getBoolean(keep, &isKept));
+				if (isKept) {
+					RETURN_OK(output, value);
+				}
+			}
+		}
+		case ITERATOR_TAKE: {
+			if (iterator->index == 0) {
+				*isDone = true;
+				return OK;
+			}
+			iterator->index--;
+			return advanceIterator(iterator->source, output, isDone);
+		}
+		case ITERATOR_SKIP: {
+			while (iterator->index > 0) {
+				iterator->index--;
+				TRY_LET(Value skipped, advanceIterator(iterator->source, &skipped, isDone));
+				if (*isDone) {
+					return OK;
+				}
+			}
+			return advanceIterator(iterator->source, output, isDone);
+		}
+		case ITERATOR_ZIP: {
+			TRY_LET(Value first, advanceIterator(iterator->source, &first, isDone));
+			if (*isDone) {
+				return OK;
+			}
+			HeapIterator* other = (HeapIterator*) AS_OBJECT(iterator->value);
+			unsigned long roots = saveRoots();
+			pushRoot(first);
+			TRY_LET(Value second, advanceIterator(other, &second, isDone));
+			restoreRoots(roots);
+			if (*isDone) {
+				return OK;
+			}
+			return pairValue(first, second, output);
+		}
+		case ITERATOR_ENUMERATE: {
+			TRY_LET(Value value, advanceIterator(iterator->source, &value, isDone));
+			if (*isDone) {
+				return OK;
+			}
+			TRY_LET(Value index, numberValue(iterator->index++, &index));
+			return pairValue(index, value, output);
+		}
+	}
+
+	UNREACHABLE;
+}
@@ -2,6 +2,7 @@
 #include "../include//klein.h"
 #include "../include/list.h"
 #include "../include/result.h"
+#include "../include/sugar.h"
 #include "../include/util.h"
 #include <stdlib.h>
 #include <string.h>
@@ -72,6 +73,8 @@ PRIVATE KleinResult getNextToken(String sourceCode, Token* output) {
 			RETURN_OK(output, createToken(TOKEN_TYPE_EQUALS, "="));
 		case '+':
 			RETURN_OK(output, createToken(TOKEN_TYPE_PLUS, "+"));
+		case '*':
+			RETURN_OK(output, createToken(TOKEN_TYPE_ASTERISK, "*"));
 		case '.':
 			RETURN_OK(output, createToken(TOKEN_TYPE_DOT, "."));
 		case ',':
@@ -212,6 +215,11 @@ KleinResult tokenizeKlein(String sourceCode, TokenList* output) {
 				token.value[length - 1] = '\0';
 				token.value++;
 			}
+
+			// Names and string literals are compared by pointer from here on
+			if (token.type == TOKEN_TYPE_STRING || token.type == TOKEN_TYPE_IDENTIFIER) {
+				token.value = internName(token.value);
+			}
 			appendToTokenList(output, token);
 		}
 		cursor += length;
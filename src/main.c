@@ -94,10 +94,19 @@ PRIVATE KleinResult runFile(int numberOfArguments, String arguments[]) {
 	TRY_LET(Program program, parseKlein(sourceCode, &program));
 
 	// Run
-	TRY(run(program));
+	KleinResult result = run(program);
+
+	// Names in the error belong to the context, so it's reported before the context is freed
+	if (isError(result)) {
+		printError(result);
+		freeResult(result);
+		freeContext(context);
+		exit(1);
+	}
 
 	// Done
-	return OK;
+	freeContext(context);
+	return result;
 }
 
 /**
@@ -142,7 +151,8 @@ PRIVATE KleinResult mainWrapper(int numberOfArguments, String arguments[]) {
 int main(int numberOfArguments, String arguments[]) {
 	KleinResult attempt = mainWrapper(numberOfArguments, arguments);
 	if (isError(attempt)) {
-		fprintf(stderr, "\n%s\n\n", STYLE("Error:", RED, BOLD));
+		printError(attempt);
+		freeResult(attempt);
 		return 1;
 	}
 
@@ -0,0 +1,207 @@
+#include "../include/map.h"
+#include "../include/equality.h"
+#include "../include/gc.h"
+#include "../include/persistent.h"
+#include <string.h>
+
+#define INITIAL_MAP_CAPACITY 8
+
+KleinResult mapValue(Value* output) {
+	HeapMap* map = (HeapMap*) allocateObject(HEAP_OBJECT_MAP, sizeof(HeapMap));
+	map->entries = calloc(INITIAL_MAP_CAPACITY, sizeof(MapEntry));
+	map->capacity = INITIAL_MAP_CAPACITY;
+	map->count = 0;
+	countAllocation(sizeof(MapEntry) * map->capacity);
+	RETURN_OK(output, OBJECT_VALUE(map));
+}
+
+KleinResult getMap(Value value, HeapMap** output) {
+	if (!isMap(value)) {
+		UNREACHABLE;
+	}
+
+	RETURN_OK(output, (HeapMap*) AS_OBJECT(value));
+}
+
+bool isMap(Value value) {
+	return isObjectOfType(value, HEAP_OBJECT_MAP);
+}
+
+/**
+ * Returns whether a value can be used as a map key. Lists and maps can change
+ * after they've been added, which would change their hash, so they can't unless
+ * they're frozen; nor can records, vectors or persistent maps holding them.
+ */
+PRIVATE bool isHashable(Value key) {
+
+	// A frozen list or map can't change its hash after it's been used as a key
+	if (isList(key) || isMap(key)) {
+		return isFrozen(key);
+	}
+
+	if (isRecord(key)) {
+		HeapRecord* record = (HeapRecord*) AS_OBJECT(key);
+		for (unsigned long slot = 0; slot < record->shape->fieldNames.size; slot++) {
+			if (!isHashable(record->slots[slot])) {
+				return false;
+			}
+		}
+	}
+
+	if (isVector(key)) {
+		UNWRAP_LET(HeapVector * vector, getVector(key, &vector));
+		for (unsigned long index = 0; index < vector->count; index++) {
+			UNWRAP_LET(Value element, vectorGet(vector, (double) index, &element));
+			if (!isHashable(element)) {
+				return false;
+			}
+		}
+	}
+
+	// Keys of a persistent map are already known to be hashable
+	if (isPersistentMap(key)) {
+		UNWRAP_LET(HeapPersistentMap * map, getPersistentMap(key, &map));
+		ValueList values = emptyValueList();
+		persistentMapEntries(map, NULL, &values);
+		bool isEveryValueHashable = true;
+		FOR_EACH(Value value, values) {
+			if (!isHashable(value)) {
+				isEveryValueHashable = false;
+				break;
+			}
+		}
+		END;
+		freeValueList(&values);
+		return isEveryValueHashable;
+	}
+
+	return true;
+}
+
+KleinResult hashMapKey(Value key, uint32_t* output) {
+	if (!isHashable(key)) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_UNHASHABLE_KEY,
+		};
+	}
+
+	RETURN_OK(output, hashValue(key));
+}
+
+/**
+ * Returns the index of the entry with the given key, or `capacity` if there isn't one.
+ */
+PRIVATE unsigned long findEntry(HeapMap* map, Value key, uint32_t hash) {
+	unsigned long mask = map->capacity - 1;
+	unsigned long index = hash & mask;
+
+	// An entry closer to home than we are means the key would have been placed here
+	for (uint32_t distance = 1; map->entries[index].distance >= distance; distance++) {
+		MapEntry* entry = &map->entries[index];
+		if (entry->hash == hash && valuesEqual(entry->key, key)) {
+			return index;
+		}
+		index = (index + 1) & mask;
+	}
+
+	return map->capacity;
+}
+
+/**
+ * Places an entry whose key isn't in the map yet, displacing richer entries along the way.
+ */
+PRIVATE void insertEntry(HeapMap* map, MapEntry entry) {
+	unsigned long mask = map->capacity - 1;
+	unsigned long index = entry.hash & mask;
+	entry.distance = 1;
+
+	while (map->entries[index].distance != 0) {
+		if (map->entries[index].distance < entry.distance) {
+			MapEntry displaced = map->entries[index];
+			map->entries[index] = entry;
+			entry = displaced;
+		}
+		index = (index + 1) & mask;
+		entry.distance++;
+	}
+
+	map->entries[index] = entry;
+	map->count++;
+}
+
+PRIVATE void growMap(HeapMap* map) {
+	MapEntry* entries = map->entries;
+	unsigned long capacity = map->capacity;
+
+	map->capacity = capacity * 2;
+	map->entries = calloc(map->capacity, sizeof(MapEntry));
+	map->count = 0;
+	countAllocation(sizeof(MapEntry) * map->capacity);
+	for (unsigned long index = 0; index < capacity; index++) {
+		if (entries[index].distance != 0) {
+			insertEntry(map, entries[index]);
+		}
+	}
+
+	free(entries);
+}
+
+KleinResult mapGet(HeapMap* map, Value key, Value* output, bool* isFound) {
+
+	// Any value can be looked up, since an unfrozen list can equal a frozen key
+	unsigned long index = findEntry(map, key, hashValue(key));
+
+	*isFound = index != map->capacity;
+	if (*isFound) {
+		*output = map->entries[index].value;
+	}
+
+	return OK;
+}
+
+KleinResult mapSet(HeapMap* map, Value key, Value value) {
+	EXPECT_UNFROZEN(map);
+	TRY_LET(uint32_t hash, hashMapKey(key, &hash));
+
+	// Existing key
+	unsigned long index = findEntry(map, key, hash);
+	if (index != map->capacity) {
+		map->entries[index].value = value;
+		writeBarrier(&map->header, value);
+		return OK;
+	}
+
+	// New key; keep the load factor under seven eighths
+	if ((map->count + 1) * 8 > map->capacity * 7) {
+		growMap(map);
+	}
+	insertEntry(map, (MapEntry) {.key = key, .value = value, .hash = hash});
+	writeBarrier(&map->header, key);
+	writeBarrier(&map->header, value);
+
+	return OK;
+}
+
+KleinResult mapDelete(HeapMap* map, Value key, bool* wasPresent) {
+	EXPECT_UNFROZEN(map);
+	unsigned long index = findEntry(map, key, hashValue(key));
+
+	*wasPresent = index != map->capacity;
+	if (!*wasPresent) {
+		return OK;
+	}
+
+	// Shift the rest of the probe sequence back a slot instead of leaving a tombstone
+	unsigned long mask = map->capacity - 1;
+	unsigned long next = (index + 1) & mask;
+	while (map->entries[next].distance > 1) {
+		map->entries[index] = map->entries[next];
+		map->entries[index].distance--;
+		index = next;
+		next = (next + 1) & mask;
+	}
+	map->entries[index] = (MapEntry) {.distance = 0};
+	map->count--;
+
+	return OK;
+}
@@ -1,7 +1,7 @@
 #include "../include/parser.h"
 #include "../include//klein.h"
-#include "../include/context.h"
 #include "../include/list.h"
+#include "../include/resolver.h"
 #include "../include/result.h"
 #include "../include/util.h"
 
@@ -15,45 +15,6 @@ PRIVATE KleinResult parseExpression(TokenList* tokens, Expression* output);
 PRIVATE KleinResult parseBinaryOperation(TokenList* tokens, BinaryOperator operator, Expression * output);
 PRIVATE KleinResult parsePrefixExpression(TokenList* tokens, Expression* output);
 
-bool hasInternal(Value value, InternalKey key) {
-	void* output;
-	return isOk(getValueInternal(value, key, &output));
-}
-
-KleinResult getValueInternal(Value value, InternalKey key, void** output) {
-	FOR_EACH(Internal internal, value.internals) {
-		if (internal.key == key) {
-			RETURN_OK(output, internal.value);
-		}
-	}
-	END;
-
-	return (KleinResult) {
-		.type = KLEIN_ERROR_INTERNAL,
-	};
-}
-
-KleinResult getValueField(Value value, String name, Value** output) {
-	FOR_EACH_REFP(ValueField * field, value.fields) {
-		if (strcmp(field->name, name) == 0) {
-			RETURN_OK(output, &field->value);
-		}
-	}
-	END;
-
-	Value* heapValue = malloc(sizeof(Value));
-	*heapValue = value;
-	return (KleinResult) {
-		.type = KLEIN_ERROR_MISSING_FIELD,
-		.data = (KleinResultData) {
-			.missingField = {
-				.value = heapValue,
-				.name = name,
-			},
-		},
-	};
-}
-
 PRIVATE KleinResult popToken(TokenList* tokens, TokenType type, String* output) {
 
 	// Empty token stream - error
@@ -233,7 +194,6 @@ PRIVATE KleinResult parseType(TokenList* tokens, Type* output) {
  * unexpectedly), an error is returned. If memory fails to allocate, an error is returned.
  */
 PRIVATE KleinResult parseBlock(TokenList* tokens, Block* output) {
-	TRY(enterNewScope());
 	TRY_LET(String next, popToken(tokens, TOKEN_TYPE_LEFT_BRACE, &next));
 
 	// Parse statements
@@ -248,11 +208,8 @@ PRIVATE KleinResult parseBlock(TokenList* tokens, Block* output) {
 
 	Block block = (Block) {
 		.statements = statements,
-		.innerScope = CONTEXT->scope,
 	};
 
-	TRY(exitScope());
-
 	RETURN_OK(output, block);
 }
 
@@ -364,7 +321,39 @@ PRIVATE KleinResult parseIdentifierLiteral(TokenList* tokens, Expression* output
 	Expression expression = (Expression) {
 		.type = EXPRESSION_IDENTIFIER,
 		.data = (ExpressionData) {
-			.identifier = identifier,
+			.identifier = (Identifier) {
+				.name = identifier,
+			},
+		},
+	};
+	RETURN_OK(output, expression);
+}
+
+/**
+ * Parses a `boolean literal expression`.
+ *
+ * Syntax: `"true" | "false"`
+ *
+ * # Parameters
+ *
+ * - `tokens` - The token list to parse from
+ * - `output` - Where to place the parsed output
+ *
+ * # Returns
+ *
+ * A result, indicating success or failure. If failed, contains the error message.
+ *
+ * # Errors
+ *
+ * If an unexpected token was encountered (including the token stream running out of tokens
+ * unexpectedly), an error is returned.
+ */
+PRIVATE KleinResult parseBooleanLiteral(TokenList* tokens, Expression* output) {
+	UNWRAP_LET(String value, popToken(tokens, TOKEN_TYPE_IDENTIFIER, &value));
+	Expression expression = (Expression) {
+		.type = EXPRESSION_BOOLEAN,
+		.data = (ExpressionData) {
+			.boolean = strcmp(value, "true") == 0,
 		},
 	};
 	RETURN_OK(output, expression);
@@ -690,7 +679,8 @@ PRIVATE KleinResult parseFunctionLiteral(TokenList* tokens, Expression* output)
 	TRY_LET(Block body, parseBlock(tokens, &body));
 
 	// Create function
-	Function function = (Function) {
+	Function* function = malloc(sizeof(Function));
+	*function = (Function) {
 		.parameters = parameters,
 		.returnType = returnType,
 		.body = body,
@@ -741,6 +731,9 @@ PRIVATE KleinResult parseLiteral(TokenList* tokens, Expression* output) {
 			return parseStringLiteral(tokens, output);
 		}
 		case TOKEN_TYPE_IDENTIFIER: {
+			if (strcmp(tokens->data[0].value, "true") == 0 || strcmp(tokens->data[0].value, "false") == 0) {
+				return parseBooleanLiteral(tokens, output);
+			}
 			return parseIdentifierLiteral(tokens, output);
 		}
 		case TOKEN_TYPE_LEFT_BRACKET: {
@@ -866,31 +859,6 @@ PRIVATE KleinResult binaryOperationOf(String tokenValue, BinaryOperation* output
 	};
 }
 
-PRIVATE KleinResult parseFieldAccess(TokenList* tokens, Expression* output) {
-	TRY_LET(Expression left, parseLiteral(tokens, &left));
-
-	while (nextTokenIs(tokens, TOKEN_TYPE_DOT)) {
-		UNWRAP_LET(String next, popToken(tokens, TOKEN_TYPE_DOT, &next));
-		Expression right;
-		TRY(parseIdentifierLiteral(tokens, &right));
-
-		BinaryExpression* binary = malloc(sizeof(BinaryExpression));
-		*binary = (BinaryExpression) {
-			.left = left,
-			.right = right,
-			.operation = BINARY_OPERATION_DOT,
-		};
-		left = (Expression) {
-			.type = EXPRESSION_BINARY,
-			.data = (ExpressionData) {
-				.binary = binary,
-			},
-		};
-	}
-
-	RETURN_OK(output, left);
-}
-
 PRIVATE KleinResult parseBinaryOperation(TokenList* tokens, BinaryOperator operator, Expression * output) {
 	TRY_LET(Expression left, parsePrecedentBinaryOperation(tokens, operator, & left));
 
@@ -923,10 +891,35 @@ PRIVATE KleinResult parseExpression(TokenList* tokens, Expression* output) {
 	return parseBinaryOperation(tokens, ASSIGNMENT, output);
 }
 
+/**
+ * Parses a literal followed by any chain of field accesses, indices and calls,
+ * such as `numbers.map(double).take(3)`.
+ */
 PRIVATE KleinResult parsePostfixExpression(TokenList* tokens, Expression* output) {
-	TRY_LET(Expression expression, parseFieldAccess(tokens, &expression));
+	TRY_LET(Expression expression, parseLiteral(tokens, &expression));
 
-	while (nextTokenIsOneOf(tokens, (TokenType[]) {TOKEN_TYPE_LEFT_PARENTHESIS, TOKEN_TYPE_LEFT_BRACKET}, 2)) {
+	while (nextTokenIsOneOf(tokens, (TokenType[]) {TOKEN_TYPE_DOT, TOKEN_TYPE_LEFT_PARENTHESIS, TOKEN_TYPE_LEFT_BRACKET}, 3)) {
+
+		// Field access
+		if (nextTokenIs(tokens, TOKEN_TYPE_DOT)) {
+			UNWRAP_LET(String next, popToken(tokens, TOKEN_TYPE_DOT, &next));
+			Expression right;
+			TRY(parseIdentifierLiteral(tokens, &right));
+
+			BinaryExpression* binary = malloc(sizeof(BinaryExpression));
+			*binary = (BinaryExpression) {
+				.left = expression,
+				.right = right,
+				.operation = BINARY_OPERATION_DOT,
+			};
+			expression = (Expression) {
+				.type = EXPRESSION_BINARY,
+				.data = (ExpressionData) {
+					.binary = binary,
+				},
+			};
+			continue;
+		}
 
 		// Index
 		if (nextTokenIs(tokens, TOKEN_TYPE_LEFT_BRACKET)) {
@@ -1233,6 +1226,7 @@ KleinResult parseKlein(String code, Program* output) {
 	TokenList tokens;
 	TRY(tokenizeKlein(code, &tokens));
 	TRY_LET(Program program, parseTokens(&tokens, &program));
+	TRY(resolveProgram(&program));
 	RETURN_OK(output, program);
 }
 
@@ -1240,6 +1234,7 @@ KleinResult parseKleinExpression(String code, Expression* output) {
 	TokenList tokens;
 	TRY(tokenizeKlein(code, &tokens));
 	TRY_LET(Expression expression, parseExpression(&tokens, &expression));
+	TRY(resolveStandaloneExpression(&expression));
 	RETURN_OK(output, expression);
 }
 
@@ -1247,8 +1242,8 @@ IMPLEMENT_KLEIN_LIST(Declaration)
 IMPLEMENT_KLEIN_LIST(Statement)
 IMPLEMENT_KLEIN_LIST(Expression)
 IMPLEMENT_KLEIN_LIST(Parameter)
+IMPLEMENT_KLEIN_LIST(Capture)
 IMPLEMENT_KLEIN_LIST(Field)
-IMPLEMENT_KLEIN_LIST(Internal)
 IMPLEMENT_KLEIN_LIST(ValueField)
 IMPLEMENT_KLEIN_LIST(Value)
 IMPLEMENT_KLEIN_LIST(IfExpression)
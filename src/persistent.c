@@ -0,0 +1,487 @@
+#include "../include/persistent.h"
+#include "../include/equality.h"
+#include "../include/map.h"
+#include <math.h>
+#include <string.h>
+
+// Vectors -----------------------------------------------------------------------------------------------------------------------------------------
+
+PRIVATE VectorNode* emptyVectorNode(void) {
+	VectorNode* node = (VectorNode*) allocateObject(HEAP_OBJECT_VECTOR_NODE, sizeof(VectorNode));
+	memset(node->children, 0, sizeof(node->children));
+	return node;
+}
+
+PRIVATE VectorNode* copyVectorNode(VectorNode* node) {
+	VectorNode* copy = (VectorNode*) allocateObject(HEAP_OBJECT_VECTOR_NODE, sizeof(VectorNode));
+	memcpy(copy->children, node->children, sizeof(node->children));
+	return copy;
+}
+
+PRIVATE Value allocateVector(unsigned long count, unsigned int shift, VectorNode* root, VectorNode* tail) {
+	HeapVector* vector = (HeapVector*) allocateObject(HEAP_OBJECT_VECTOR, sizeof(HeapVector));
+	vector->count = count;
+	vector->shift = shift;
+	vector->root = root;
+	vector->tail = tail;
+	return OBJECT_VALUE(vector);
+}
+
+/**
+ * Returns the index of the first element in a vector's tail.
+ */
+PRIVATE unsigned long vectorTailOffset(HeapVector* vector) {
+	if (vector->count < VECTOR_BRANCHING) {
+		return 0;
+	}
+	return ((vector->count - 1) >> VECTOR_BITS) << VECTOR_BITS;
+}
+
+/**
+ * Returns the bottom-level node holding the element at an index that's within
+ * the bounds of a vector.
+ */
+PRIVATE VectorNode* vectorLeafFor(HeapVector* vector, unsigned long index) {
+	if (index >= vectorTailOffset(vector)) {
+		return vector->tail;
+	}
+
+	VectorNode* node = vector->root;
+	for (unsigned int level = vector->shift; level > 0; level -= VECTOR_BITS) {
+		node = node->children[(index >> level) & VECTOR_MASK];
+	}
+	return node;
+}
+
+PRIVATE bool isVectorIndex(double index, unsigned long length) {
+	return index >= 0 && index < (double) length && floor(index) == index;
+}
+
+KleinResult vectorValue(Value* output) {
+	RETURN_OK(output, allocateVector(0, VECTOR_BITS, emptyVectorNode(), emptyVectorNode()));
+}
+
+KleinResult getVector(Value value, HeapVector** output) {
+	if (!isVector(value)) {
+		UNREACHABLE;
+	}
+
+	RETURN_OK(output, (HeapVector*) AS_OBJECT(value));
+}
+
+bool isVector(Value value) {
+	return isObjectOfType(value, HEAP_OBJECT_VECTOR);
+}
+
+KleinResult vectorGet(HeapVector* vector, double index, Value* output) {
+	if (!isVectorIndex(index, vector->count)) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_INVALID_INDEX,
+		};
+	}
+
+	unsigned long position = (unsigned long) index;
+	RETURN_OK(output, vectorLeafFor(vector, position)->values[position & VECTOR_MASK]);
+}
+
+/**
+ * Creates a chain of nodes from `level` down to `leaf`.
+ */
+PRIVATE VectorNode* newVectorPath(unsigned int level, VectorNode* leaf) {
+	if (level == 0) {
+		return leaf;
+	}
+
+	VectorNode* node = emptyVectorNode();
+	node->children[0] = newVectorPath(level - VECTOR_BITS, leaf);
+	return node;
+}
+
+/**
+ * Copies the path to where a full tail belongs in the trie under `parent`, and
+ * places the tail there. `count` is the length of the vector the tail is full in.
+ */
+PRIVATE VectorNode* pushVectorTail(unsigned long count, unsigned int level, VectorNode* parent, VectorNode* tail) {
+	unsigned long child = ((count - 1) >> level) & VECTOR_MASK;
+	VectorNode* node = copyVectorNode(parent);
+	if (level == VECTOR_BITS) {
+		node->children[child] = tail;
+	} else if (parent->children[child] != NULL) {
+		node->children[child] = pushVectorTail(count, level - VECTOR_BITS, parent->children[child], tail);
+	} else {
+		node->children[child] = newVectorPath(level - VECTOR_BITS, tail);
+	}
+	return node;
+}
+
+KleinResult vectorConj(HeapVector* vector, Value value, Value* output) {
+
+	// Room in the tail
+	unsigned long tailLength = vector->count - vectorTailOffset(vector);
+	if (tailLength < VECTOR_BRANCHING) {
+		VectorNode* tail = copyVectorNode(vector->tail);
+		tail->values[tailLength] = value;
+		RETURN_OK(output, allocateVector(vector->count + 1, vector->shift, vector->root, tail));
+	}
+
+	// The full tail moves into the trie, which gains a level when the root is full
+	VectorNode* root;
+	unsigned int shift = vector->shift;
+	if ((vector->count >> VECTOR_BITS) > (1UL << vector->shift)) {
+		root = emptyVectorNode();
+		root->children[0] = vector->root;
+		root->children[1] = newVectorPath(vector->shift, vector->tail);
+		shift += VECTOR_BITS;
+	} else {
+		root = pushVectorTail(vector->count, vector->shift, vector->root, vector->tail);
+	}
+
+	VectorNode* tail = emptyVectorNode();
+	tail->values[0] = value;
+	RETURN_OK(output, allocateVector(vector->count + 1, shift, root, tail));
+}
+
+PRIVATE VectorNode* assocInVectorNode(unsigned int level, VectorNode* node, unsigned long index, Value value) {
+	VectorNode* copy = copyVectorNode(node);
+	if (level == 0) {
+		copy->values[index & VECTOR_MASK] = value;
+	} else {
+		unsigned long child = (index >> level) & VECTOR_MASK;
+		copy->children[child] = assocInVectorNode(level - VECTOR_BITS, node->children[child], index, value);
+	}
+	return copy;
+}
+
+KleinResult vectorAssoc(HeapVector* vector, double index, Value value, Value* output) {
+	if (index == (double) vector->count) {
+		return vectorConj(vector, value, output);
+	}
+
+	if (!isVectorIndex(index, vector->count)) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_INVALID_INDEX,
+		};
+	}
+
+	unsigned long position = (unsigned long) index;
+	if (position >= vectorTailOffset(vector)) {
+		VectorNode* tail = copyVectorNode(vector->tail);
+		tail->values[position & VECTOR_MASK] = value;
+		RETURN_OK(output, allocateVector(vector->count, vector->shift, vector->root, tail));
+	}
+
+	VectorNode* root = assocInVectorNode(vector->shift, vector->root, position, value);
+	RETURN_OK(output, allocateVector(vector->count, vector->shift, root, vector->tail));
+}
+
+/**
+ * Copies the path to the last leaf under `node` without that leaf, returning
+ * `NULL` if nothing would be left. `count` is the length of the vector being popped.
+ */
+PRIVATE VectorNode* popVectorTail(unsigned long count, unsigned int level, VectorNode* node) {
+	unsigned long child = ((count - 2) >> level) & VECTOR_MASK;
+	if (level > VECTOR_BITS) {
+		VectorNode* newChild = popVectorTail(count, level - VECTOR_BITS, node->children[child]);
+		if (newChild == NULL && child == 0) {
+			return NULL;
+		}
+		VectorNode* copy = copyVectorNode(node);
+		copy->children[child] = newChild;
+		return copy;
+	}
+
+	if (child == 0) {
+		return NULL;
+	}
+	VectorNode* copy = copyVectorNode(node);
+	copy->children[child] = NULL;
+	return copy;
+}
+
+KleinResult vectorPop(HeapVector* vector, Value* output) {
+	if (vector->count == 0) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_INVALID_INDEX,
+		};
+	}
+	if (vector->count == 1) {
+		return vectorValue(output);
+	}
+
+	// Slots after the end of the tail are ignored, so the tail can be shared
+	if (vector->count - vectorTailOffset(vector) > 1) {
+		RETURN_OK(output, allocateVector(vector->count - 1, vector->shift, vector->root, vector->tail));
+	}
+
+	// The last leaf of the trie becomes the tail, and the trie loses a level once its root has one child
+	VectorNode* tail = vectorLeafFor(vector, vector->count - 2);
+	VectorNode* root = popVectorTail(vector->count, vector->shift, vector->root);
+	unsigned int shift = vector->shift;
+	if (root == NULL) {
+		root = emptyVectorNode();
+	}
+	if (shift > VECTOR_BITS && root->children[1] == NULL) {
+		root = root->children[0];
+		shift -= VECTOR_BITS;
+	}
+	RETURN_OK(output, allocateVector(vector->count - 1, shift, root, tail));
+}
+
+// Persistent maps ---------------------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Nodes at this shift or deeper have used up every bit of the hash, and hold keys
+ * whose hashes collide.
+ */
+#define HAMT_COLLISION_SHIFT 32
+
+PRIVATE HamtNode* allocateHamtNode(uint32_t bitmap, uint32_t length) {
+	HamtNode* node = (HamtNode*) allocateObject(HEAP_OBJECT_HAMT_NODE, sizeof(HamtNode) + sizeof(HamtSlot) * length);
+	node->bitmap = bitmap;
+	node->length = length;
+	return node;
+}
+
+/**
+ * Copies a node with `slot` inserted at `index`.
+ */
+PRIVATE HamtNode* insertHamtSlot(HamtNode* node, uint32_t bitmap, uint32_t index, HamtSlot slot) {
+	HamtNode* copy = allocateHamtNode(bitmap, node->length + 1);
+	memcpy(copy->slots, node->slots, sizeof(HamtSlot) * index);
+	copy->slots[index] = slot;
+	memcpy(copy->slots + index + 1, node->slots + index, sizeof(HamtSlot) * (node->length - index));
+	return copy;
+}
+
+/**
+ * Copies a node with the slot at `index` removed, or returns `NULL` if it was the
+ * only one.
+ */
+PRIVATE HamtNode* removeHamtSlot(HamtNode* node, uint32_t bitmap, uint32_t index) {
+	if (node->length == 1) {
+		return NULL;
+	}
+
+	HamtNode* copy = allocateHamtNode(bitmap, node->length - 1);
+	memcpy(copy->slots, node->slots, sizeof(HamtSlot) * index);
+	memcpy(copy->slots + index, node->slots + index + 1, sizeof(HamtSlot) * (node->length - index - 1));
+	return copy;
+}
+
+/**
+ * Copies a node with the slot at `index` replaced.
+ */
+PRIVATE HamtNode* replaceHamtSlot(HamtNode* node, uint32_t index, HamtSlot slot) {
+	HamtNode* copy = allocateHamtNode(node->bitmap, node->length);
+	memcpy(copy->slots, node->slots, sizeof(HamtSlot) * node->length);
+	copy->slots[index] = slot;
+	return copy;
+}
+
+PRIVATE uint32_t hamtBit(uint32_t hash, unsigned int shift) {
+	return (uint32_t) 1 << ((hash >> shift) & VECTOR_MASK);
+}
+
+/**
+ * Returns the position among a node's slots of the slot for `bit`.
+ */
+PRIVATE uint32_t hamtIndex(uint32_t bitmap, uint32_t bit) {
+	return (uint32_t) countSetBits(bitmap & (bit - 1));
+}
+
+PRIVATE bool isHamtEntry(HamtSlot slot, uint32_t hash, Value key) {
+	return slot.node == NULL && slot.hash == hash && valuesEqual(slot.key, key);
+}
+
+/**
+ * Returns the entry for a key under `node`, or `NULL` if there isn't one.
+ */
+PRIVATE HamtSlot* findHamtEntry(HamtNode* node, unsigned int shift, uint32_t hash, Value key) {
+	while (node != NULL) {
+		if (shift >= HAMT_COLLISION_SHIFT) {
+			for (uint32_t index = 0; index < node->length; index++) {
+				if (isHamtEntry(node->slots[index], hash, key)) {
+					return &node->slots[index];
+				}
+			}
+			return NULL;
+		}
+
+		uint32_t bit = hamtBit(hash, shift);
+		if ((node->bitmap & bit) == 0) {
+			return NULL;
+		}
+		HamtSlot* slot = &node->slots[hamtIndex(node->bitmap, bit)];
+		if (slot->node == NULL) {
+			return isHamtEntry(*slot, hash, key) ? slot : NULL;
+		}
+		node = slot->node;
+		shift += VECTOR_BITS;
+	}
+
+	return NULL;
+}
+
+/**
+ * Returns a copy of `node` (which may be `NULL`) with an entry set, setting
+ * `isAdded` if the key wasn't there before.
+ */
+PRIVATE HamtNode* assocInHamtNode(HamtNode* node, unsigned int shift, HamtSlot entry, bool* isAdded) {
+	if (node == NULL) {
+		if (shift >= HAMT_COLLISION_SHIFT) {
+			node = allocateHamtNode(0, 1);
+		} else {
+			node = allocateHamtNode(hamtBit(entry.hash, shift), 1);
+		}
+		node->slots[0] = entry;
+		*isAdded = true;
+		return node;
+	}
+
+	if (shift >= HAMT_COLLISION_SHIFT) {
+		for (uint32_t index = 0; index < node->length; index++) {
+			if (isHamtEntry(node->slots[index], entry.hash, entry.key)) {
+				return replaceHamtSlot(node, index, entry);
+			}
+		}
+		*isAdded = true;
+		return insertHamtSlot(node, 0, node->length, entry);
+	}
+
+	uint32_t bit = hamtBit(entry.hash, shift);
+	uint32_t index = hamtIndex(node->bitmap, bit);
+	if ((node->bitmap & bit) == 0) {
+		*isAdded = true;
+		return insertHamtSlot(node, node->bitmap | bit, index, entry);
+	}
+
+	HamtSlot slot = node->slots[index];
+	if (slot.node != NULL) {
+		HamtNode* child = assocInHamtNode(slot.node, shift + VECTOR_BITS, entry, isAdded);
+		return replaceHamtSlot(node, index, (HamtSlot) {.node = child});
+	}
+	if (isHamtEntry(slot, entry.hash, entry.key)) {
+		return replaceHamtSlot(node, index, entry);
+	}
+
+	// Two keys share this slot, so they move down a level
+	HamtNode* child = assocInHamtNode(NULL, shift + VECTOR_BITS, slot, isAdded);
+	child = assocInHamtNode(child, shift + VECTOR_BITS, entry, isAdded);
+	return replaceHamtSlot(node, index, (HamtSlot) {.node = child});
+}
+
+/**
+ * Returns a copy of `node` without a key's entry, or `NULL` if nothing would be
+ * left. If the key isn't there, `node` itself is returned.
+ */
+PRIVATE HamtNode* dissocInHamtNode(HamtNode* node, unsigned int shift, uint32_t hash, Value key) {
+	if (shift >= HAMT_COLLISION_SHIFT) {
+		for (uint32_t index = 0; index < node->length; index++) {
+			if (isHamtEntry(node->slots[index], hash, key)) {
+				return removeHamtSlot(node, 0, index);
+			}
+		}
+		return node;
+	}
+
+	uint32_t bit = hamtBit(hash, shift);
+	if ((node->bitmap & bit) == 0) {
+		return node;
+	}
+
+	uint32_t index = hamtIndex(node->bitmap, bit);
+	HamtSlot slot = node->slots[index];
+	if (slot.node == NULL) {
+		if (!isHamtEntry(slot, hash, key)) {
+			return node;
+		}
+		return removeHamtSlot(node, node->bitmap & ~bit, index);
+	}
+
+	HamtNode* child = dissocInHamtNode(slot.node, shift + VECTOR_BITS, hash, key);
+	if (child == slot.node) {
+		return node;
+	}
+	if (child == NULL) {
+		return removeHamtSlot(node, node->bitmap & ~bit, index);
+	}
+
+	// A child left with a single entry is folded back into this node
+	if (child->length == 1 && child->slots[0].node == NULL) {
+		return replaceHamtSlot(node, index, child->slots[0]);
+	}
+	return replaceHamtSlot(node, index, (HamtSlot) {.node = child});
+}
+
+PRIVATE Value allocatePersistentMap(HamtNode* root, unsigned long count) {
+	HeapPersistentMap* map = (HeapPersistentMap*) allocateObject(HEAP_OBJECT_PERSISTENT_MAP, sizeof(HeapPersistentMap));
+	map->root = root;
+	map->count = count;
+	return OBJECT_VALUE(map);
+}
+
+KleinResult persistentMapValue(Value* output) {
+	RETURN_OK(output, allocatePersistentMap(NULL, 0));
+}
+
+KleinResult getPersistentMap(Value value, HeapPersistentMap** output) {
+	if (!isPersistentMap(value)) {
+		UNREACHABLE;
+	}
+
+	RETURN_OK(output, (HeapPersistentMap*) AS_OBJECT(value));
+}
+
+bool isPersistentMap(Value value) {
+	return isObjectOfType(value, HEAP_OBJECT_PERSISTENT_MAP);
+}
+
+KleinResult persistentMapGet(HeapPersistentMap* map, Value key, Value* output, bool* isFound) {
+	HamtSlot* entry = findHamtEntry(map->root, 0, hashValue(key), key);
+	*isFound = entry != NULL;
+	if (*isFound) {
+		*output = entry->value;
+	}
+	return OK;
+}
+
+KleinResult persistentMapAssoc(HeapPersistentMap* map, Value key, Value value, Value* output) {
+	TRY_LET(uint32_t hash, hashMapKey(key, &hash));
+	bool isAdded = false;
+	HamtNode* root = assocInHamtNode(map->root, 0, (HamtSlot) {.key = key, .value = value, .hash = hash}, &isAdded);
+	RETURN_OK(output, allocatePersistentMap(root, map->count + (isAdded ? 1 : 0)));
+}
+
+KleinResult persistentMapDissoc(HeapPersistentMap* map, Value key, Value* output) {
+	if (map->root == NULL) {
+		RETURN_OK(output, OBJECT_VALUE(map));
+	}
+
+	HamtNode* root = dissocInHamtNode(map->root, 0, hashValue(key), key);
+	if (root == map->root) {
+		RETURN_OK(output, OBJECT_VALUE(map));
+	}
+	RETURN_OK(output, allocatePersistentMap(root, map->count - 1));
+}
+
+PRIVATE void hamtNodeEntries(HamtNode* node, ValueList* keys, ValueList* values) {
+	for (uint32_t index = 0; index < node->length; index++) {
+		HamtSlot slot = node->slots[index];
+		if (slot.node != NULL) {
+			hamtNodeEntries(slot.node, keys, values);
+			continue;
+		}
+		if (keys != NULL) {
+			appendToValueList(keys, slot.key);
+		}
+		if (values != NULL) {
+			appendToValueList(values, slot.value);
+		}
+	}
+}
+
+void persistentMapEntries(HeapPersistentMap* map, ValueList* keys, ValueList* values) {
+	if (map->root != NULL) {
+		hamtNodeEntries(map->root, keys, values);
+	}
+}
@@ -0,0 +1,652 @@
+#include "../include/resolver.h"
+#include "../include/list.h"
+#include "../include/result.h"
+#include "../include/util.h"
+#include <math.h>
+#include <string.h>
+
+/**
+ * A local variable that is in scope at the current point of resolution.
+ */
+typedef struct {
+
+	/** The name of the variable. */
+	String name;
+
+	/** The block nesting depth the variable was declared at. */
+	unsigned long depth;
+
+	/** Whether a nested function captures this variable by reference. */
+	bool isCaptured;
+
+	/** Whether the variable holds a value yet; this is false while resolving its own initializer. */
+	bool isInitialized;
+
+	/** Where to record that the variable is reassigned. This lives in the declaring AST node. */
+	int* isReassigned;
+
+	/** The literal the variable is initialized with, or `NULL` if it isn't initialized with a literal. */
+	Expression* literal;
+
+	/** Whether resolution has reached the declaration; top-level variables are reserved before this. */
+	bool isDeclared;
+
+	/** Whether a function refers to the variable before its declaration, so its slot must be written. */
+	bool isForwardReferenced;
+
+} Local;
+
+DEFINE_KLEIN_LIST(Local);
+
+typedef struct FunctionScope FunctionScope;
+
+/**
+ * The resolution state of a single function (or of the top level of the program).
+ * The position of a local in `locals` is the slot it occupies in the function's
+ * frame, so sibling blocks reuse each other's slots.
+ */
+struct FunctionScope {
+
+	/** The function lexically enclosing this one, or `NULL` for the top level. */
+	FunctionScope* enclosing;
+
+	/** The locals currently in scope, innermost last. */
+	LocalList locals;
+
+	/** The captures of the function being resolved, or `NULL` for the top level. */
+	CaptureList* captures;
+
+	/** The current block nesting depth. */
+	unsigned long depth;
+
+	/** The highest number of locals that were in scope at once. */
+	unsigned long slotCount;
+};
+
+PRIVATE FunctionScope* currentFunction = NULL;
+
+/**
+ * Whether the resolver is on its second pass over the program. The first pass
+ * finds which variables are reassigned; the second uses that to replace constant
+ * variables with their values and to capture immutable variables by copy.
+ */
+PRIVATE bool isPropagating = false;
+
+PRIVATE KleinResult resolveExpression(Expression* expression);
+PRIVATE KleinResult resolveStatement(Statement* statement);
+
+PRIVATE unsigned long declareLocal(String name, int* isReassigned) {
+	unsigned long slot = currentFunction->locals.size;
+	Local local = (Local) {
+		.name = name,
+		.depth = currentFunction->depth,
+		.isCaptured = false,
+		.isInitialized = true,
+		.isReassigned = isReassigned,
+		.literal = NULL,
+		.isDeclared = true,
+		.isForwardReferenced = false,
+	};
+	appendToLocalList(&currentFunction->locals, local);
+	currentFunction->slotCount = MAX(currentFunction->slotCount, currentFunction->locals.size);
+	return slot;
+}
+
+/**
+ * Declares the variable of the given declaration and returns its slot. Top-level
+ * variables already have a slot reserved by `reserveGlobals()`.
+ */
+PRIVATE unsigned long declareVariable(Declaration* declaration) {
+	if (currentFunction->enclosing == NULL && currentFunction->depth == 0) {
+		FOR_EACH_REF(Local * local, currentFunction->locals) {
+			if (local->isReassigned == &declaration->isReassigned) {
+				local->isDeclared = true;
+				local->isInitialized = true;
+				return index__;
+			}
+		}
+		END;
+	}
+
+	return declareLocal(declaration->name, &declaration->isReassigned);
+}
+
+/**
+ * Reserves a slot for every top-level variable before anything is resolved, so
+ * that functions can refer to top-level variables declared after them.
+ */
+PRIVATE void reserveGlobals(Program* program) {
+	FOR_EACH_REF(Statement * statement, program->statements) {
+		if (statement->type == STATEMENT_DECLARATION) {
+			unsigned long slot = declareLocal(statement->data.declaration.name, &statement->data.declaration.isReassigned);
+			currentFunction->locals.data[slot].isDeclared = false;
+			currentFunction->locals.data[slot].isInitialized = false;
+		}
+	}
+	END;
+}
+
+PRIVATE bool findLocal(FunctionScope* function, String name, unsigned long* output) {
+	for (unsigned long slot = function->locals.size; slot > 0; slot--) {
+		if (function->locals.data[slot - 1].isDeclared && function->locals.data[slot - 1].name == name) {
+			*output = slot - 1;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+PRIVATE FunctionScope* topLevelOf(FunctionScope* function) {
+	while (function->enclosing != NULL) {
+		function = function->enclosing;
+	}
+	return function;
+}
+
+/**
+ * Finds a top-level variable that is declared later in the program than the point
+ * being resolved. Only function bodies can refer to these, since they don't run
+ * until they're called.
+ */
+PRIVATE bool findLaterGlobal(FunctionScope* function, String name, unsigned long* output) {
+	if (function->enclosing == NULL) {
+		return false;
+	}
+
+	FunctionScope* topLevel = topLevelOf(function);
+	FOR_EACH_REF(Local * local, topLevel->locals) {
+		if (!local->isDeclared && local->name == name) {
+			*output = index__;
+			return true;
+		}
+	}
+	END;
+
+	return false;
+}
+
+/**
+ * Returns the variable the given name refers to from within `function`, searching
+ * the enclosing functions and then the later top-level variables as well, or `NULL`
+ * if there is none.
+ */
+PRIVATE Local* findVariable(FunctionScope* function, String name) {
+	unsigned long slot;
+	for (FunctionScope* scope = function; scope != NULL; scope = scope->enclosing) {
+		if (findLocal(scope, name, &slot)) {
+			return &scope->locals.data[slot];
+		}
+	}
+
+	if (findLaterGlobal(function, name, &slot)) {
+		return &topLevelOf(function)->locals.data[slot];
+	}
+
+	return NULL;
+}
+
+PRIVATE bool isImmutable(Local* local) {
+	return isPropagating && !*local->isReassigned;
+}
+
+PRIVATE unsigned long addCapture(FunctionScope* function, Capture capture) {
+	FOR_EACH_REFP(Capture * existing, function->captures) {
+		if (existing->isLocal == capture.isLocal && existing->index == capture.index && existing->isCopy == capture.isCopy) {
+			return index__;
+		}
+	}
+	END;
+
+	appendToCaptureList(function->captures, capture);
+	return function->captures->size - 1;
+}
+
+/**
+ * Finds the given name in the functions enclosing `function`, capturing it into
+ * each function between the declaring one and `function`.
+ */
+PRIVATE bool findUpvalue(FunctionScope* function, String name, unsigned long* output) {
+	if (function->enclosing == NULL) {
+		return false;
+	}
+
+	unsigned long slot;
+	if (findLocal(function->enclosing, name, &slot)) {
+		Local* local = &function->enclosing->locals.data[slot];
+
+		// Variables that never change can be copied into the closure
+		if (isImmutable(local) && local->isInitialized) {
+			*output = addCapture(function, (Capture) {.isLocal = true, .index = slot, .isCopy = true});
+			return true;
+		}
+
+		local->isCaptured = true;
+		*output = addCapture(function, (Capture) {.isLocal = true, .index = slot, .isCopy = false});
+		return true;
+	}
+
+	unsigned long index;
+	if (findUpvalue(function->enclosing, name, &index)) {
+		*output = addCapture(function, (Capture) {.isLocal = false, .index = index, .isCopy = false});
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Captures the top-level variable in the given slot by reference into `function`
+ * and each function enclosing it.
+ */
+PRIVATE unsigned long captureGlobal(FunctionScope* function, unsigned long slot) {
+	if (function->enclosing->enclosing == NULL) {
+		return addCapture(function, (Capture) {.isLocal = true, .index = slot, .isCopy = false});
+	}
+
+	unsigned long index = captureGlobal(function->enclosing, slot);
+	return addCapture(function, (Capture) {.isLocal = false, .index = index, .isCopy = false});
+}
+
+PRIVATE KleinResult resolveIdentifier(Expression* expression) {
+	Identifier* identifier = &expression->data.identifier;
+
+	// Constant propagation
+	Local* variable = findVariable(currentFunction, identifier->name);
+	if (variable != NULL && variable->literal != NULL && isImmutable(variable)) {
+		*expression = *variable->literal;
+		return OK;
+	}
+
+	unsigned long index;
+
+	if (findLocal(currentFunction, identifier->name, &index)) {
+		identifier->location = VARIABLE_LOCAL;
+		identifier->index = index;
+		return OK;
+	}
+
+	if (findUpvalue(currentFunction, identifier->name, &index)) {
+		identifier->location = VARIABLE_UPVALUE;
+		identifier->index = index;
+		return OK;
+	}
+
+	// A top-level variable declared after this function; it's set by the time the function runs
+	if (findLaterGlobal(currentFunction, identifier->name, &index)) {
+		topLevelOf(currentFunction)->locals.data[index].isForwardReferenced = true;
+		identifier->location = VARIABLE_UPVALUE;
+		identifier->index = captureGlobal(currentFunction, index);
+		return OK;
+	}
+
+	return (KleinResult) {
+		.type = KLEIN_ERROR_REFERENCE_UNDEFINED_VARIABLE,
+		.data = (KleinResultData) {
+			.referenceUndefinedVariable = identifier->name,
+		},
+	};
+}
+
+PRIVATE void beginBlock(Block* block) {
+	block->firstSlot = currentFunction->locals.size;
+	block->closesUpvalues = false;
+	currentFunction->depth++;
+}
+
+PRIVATE void endBlock(Block* block) {
+	while (currentFunction->locals.size > 0 && currentFunction->locals.data[currentFunction->locals.size - 1].depth == currentFunction->depth) {
+		if (currentFunction->locals.data[currentFunction->locals.size - 1].isCaptured) {
+			block->closesUpvalues = true;
+		}
+		currentFunction->locals.size--;
+	}
+	currentFunction->depth--;
+}
+
+PRIVATE bool isLiteral(Expression expression) {
+	return expression.type == EXPRESSION_NUMBER || expression.type == EXPRESSION_STRING || expression.type == EXPRESSION_BOOLEAN;
+}
+
+PRIVATE Expression numberLiteral(double number) {
+	return (Expression) {
+		.type = EXPRESSION_NUMBER,
+		.data = (ExpressionData) {
+			.number = number,
+		},
+	};
+}
+
+PRIVATE Expression booleanLiteral(bool boolean) {
+	return (Expression) {
+		.type = EXPRESSION_BOOLEAN,
+		.data = (ExpressionData) {
+			.boolean = boolean,
+		},
+	};
+}
+
+/**
+ * Replaces the given binary expression with its result if both of its operands
+ * are literals that the operation is defined on. Operations that would fail at
+ * runtime are left alone so that they still report their error.
+ */
+PRIVATE void foldBinaryExpression(Expression* expression) {
+	BinaryExpression binary = *expression->data.binary;
+
+	if (binary.left.type == EXPRESSION_NUMBER && binary.right.type == EXPRESSION_NUMBER) {
+		double left = binary.left.data.number;
+		double right = binary.right.data.number;
+		switch (binary.operation) {
+			case BINARY_OPERATION_PLUS: {
+				*expression = numberLiteral(left + right);
+				return;
+			}
+			case BINARY_OPERATION_MINUS: {
+				*expression = numberLiteral(left - right);
+				return;
+			}
+			case BINARY_OPERATION_TIMES: {
+				*expression = numberLiteral(left * right);
+				return;
+			}
+			case BINARY_OPERATION_DIVIDE: {
+				*expression = numberLiteral(left / right);
+				return;
+			}
+			case BINARY_OPERATION_POWER: {
+				*expression = numberLiteral(pow(left, right));
+				return;
+			}
+			case BINARY_OPERATION_LESS_THAN: {
+				*expression = booleanLiteral(left < right);
+				return;
+			}
+			case BINARY_OPERATION_GREATER_THAN: {
+				*expression = booleanLiteral(left > right);
+				return;
+			}
+			case BINARY_OPERATION_LESS_THAN_OR_EQUAL_TO: {
+				*expression = booleanLiteral(left <= right);
+				return;
+			}
+			case BINARY_OPERATION_GREATER_THAN_OR_EQUAL_TO: {
+				*expression = booleanLiteral(left >= right);
+				return;
+			}
+			case BINARY_OPERATION_EQUAL: {
+				*expression = booleanLiteral(left == right);
+				return;
+			}
+			default: {
+				return;
+			}
+		}
+	}
+
+	if (binary.left.type == EXPRESSION_BOOLEAN && binary.right.type == EXPRESSION_BOOLEAN) {
+		bool left = binary.left.data.boolean;
+		bool right = binary.right.data.boolean;
+		switch (binary.operation) {
+			case BINARY_OPERATION_AND: {
+				*expression = booleanLiteral(left && right);
+				return;
+			}
+			case BINARY_OPERATION_OR: {
+				*expression = booleanLiteral(left || right);
+				return;
+			}
+			default: {
+				return;
+			}
+		}
+	}
+}
+
+PRIVATE KleinResult resolveStatements(StatementList* statements) {
+	FOR_EACH_REFP(Statement * statement, statements) {
+		TRY(resolveStatement(statement));
+	}
+	END;
+
+	return OK;
+}
+
+PRIVATE KleinResult resolveBlock(Block* block) {
+	beginBlock(block);
+	TRY(resolveStatements(block->statements));
+	endBlock(block);
+	return OK;
+}
+
+PRIVATE KleinResult resolveFunction(Function* function) {
+	free(function->captures.data);
+	function->captures = emptyCaptureList();
+
+	FunctionScope scope = (FunctionScope) {
+		.enclosing = currentFunction,
+		.locals = emptyLocalList(),
+		.captures = &function->captures,
+		.depth = 0,
+		.slotCount = 0,
+	};
+	currentFunction = &scope;
+
+	// Parameters occupy the first slots, in order
+	FOR_EACH_REF(Parameter * parameter, function->parameters) {
+		declareLocal(parameter->name, &parameter->isReassigned);
+	}
+	END;
+
+	KleinResult result = resolveBlock(&function->body);
+	function->slotCount = scope.slotCount;
+
+	currentFunction = scope.enclosing;
+	free(scope.locals.data);
+
+	return result;
+}
+
+PRIVATE KleinResult resolveExpression(Expression* expression) {
+	switch (expression->type) {
+		case EXPRESSION_IDENTIFIER: {
+			return resolveIdentifier(expression);
+		}
+		case EXPRESSION_OBJECT: {
+			FOR_EACH_REF(Field * field, expression->data.object->fields) {
+				TRY(resolveExpression(&field->value));
+			}
+			END;
+			return OK;
+		}
+		case EXPRESSION_BLOCK: {
+			return resolveBlock(expression->data.block);
+		}
+		case EXPRESSION_FOR_LOOP: {
+			ForLoop* forLoop = expression->data.forLoop;
+			TRY(resolveExpression(&forLoop->list));
+
+			// The binding belongs to the body, so each iteration gets a fresh variable
+			beginBlock(&forLoop->body);
+			forLoop->slot = declareLocal(forLoop->binding, &forLoop->isBindingReassigned);
+			TRY(resolveStatements(forLoop->body.statements));
+			endBlock(&forLoop->body);
+			return OK;
+		}
+		case EXPRESSION_WHILE_LOOP: {
+			TRY(resolveExpression(&expression->data.whileLoop->condition));
+			return resolveBlock(&expression->data.whileLoop->body);
+		}
+		case EXPRESSION_IF: {
+			FOR_EACH_REFP(IfExpression * ifExpression, expression->data.ifExpression) {
+				TRY(resolveExpression(&ifExpression->condition));
+				TRY(resolveBlock(&ifExpression->body));
+			}
+			END;
+			return OK;
+		}
+		case EXPRESSION_BINARY: {
+			BinaryExpression* binary = expression->data.binary;
+			TRY(resolveExpression(&binary->left));
+
+			// The right side of a dot is a field name, not a variable
+			if (binary->operation == BINARY_OPERATION_DOT) {
+				return OK;
+			}
+
+			TRY(resolveExpression(&binary->right));
+
+			if (binary->operation == BINARY_OPERATION_ASSIGN && binary->left.type == EXPRESSION_IDENTIFIER) {
+				Local* variable = findVariable(currentFunction, binary->left.data.identifier.name);
+				*variable->isReassigned = true;
+				return OK;
+			}
+
+			foldBinaryExpression(expression);
+			return OK;
+		}
+		case EXPRESSION_LIST: {
+			FOR_EACH_REFP(Expression * element, expression->data.list) {
+				TRY(resolveExpression(element));
+			}
+			END;
+			return OK;
+		}
+		case EXPRESSION_FUNCTION: {
+			return resolveFunction(expression->data.function);
+		}
+		case EXPRESSION_UNARY: {
+			UnaryExpression* unary = expression->data.unary;
+			switch (unary->operation.type) {
+				case UNARY_OPERATION_FUNCTION_CALL: {
+
+					// `builtin("name")` isn't a call to a variable
+					if (unary->expression.type == EXPRESSION_IDENTIFIER && strcmp(unary->expression.data.identifier.name, "builtin") == 0) {
+						return OK;
+					}
+
+					TRY(resolveExpression(&unary->expression));
+					FOR_EACH_REF(Expression * argument, unary->operation.data.functionCall) {
+						TRY(resolveExpression(argument));
+					}
+					END;
+					return OK;
+				}
+				case UNARY_OPERATION_NOT: {
+					TRY(resolveExpression(&unary->expression));
+
+					if (unary->expression.type == EXPRESSION_BOOLEAN) {
+						*expression = booleanLiteral(!unary->expression.data.boolean);
+					}
+					return OK;
+				}
+				case UNARY_OPERATION_INDEX: {
+					TRY(resolveExpression(&unary->expression));
+					return resolveExpression(&unary->operation.data.index);
+				}
+			}
+			UNREACHABLE;
+		}
+		case EXPRESSION_STRING:
+		case EXPRESSION_NUMBER:
+		case EXPRESSION_BOOLEAN:
+		case EXPRESSION_BUILTIN_FUNCTION: {
+			return OK;
+		}
+	}
+
+	UNREACHABLE;
+}
+
+PRIVATE KleinResult resolveStatement(Statement* statement) {
+	switch (statement->type) {
+		case STATEMENT_EXPRESSION: {
+			return resolveExpression(&statement->data.expression);
+		}
+		case STATEMENT_RETURN: {
+			return resolveExpression(&statement->data.returnExpression);
+		}
+		case STATEMENT_DECLARATION: {
+			Declaration* declaration = &statement->data.declaration;
+
+			// Functions can refer to themselves
+			if (declaration->value.type == EXPRESSION_FUNCTION) {
+				declaration->slot = declareVariable(declaration);
+				currentFunction->locals.data[declaration->slot].isInitialized = false;
+				TRY(resolveExpression(&declaration->value));
+				currentFunction->locals.data[declaration->slot].isInitialized = true;
+				return OK;
+			}
+
+			TRY(resolveExpression(&declaration->value));
+			declaration->slot = declareVariable(declaration);
+			Local* local = &currentFunction->locals.data[declaration->slot];
+
+			if (isLiteral(declaration->value)) {
+				local->literal = &declaration->value;
+				declaration->isConstant = isImmutable(local) && !local->isForwardReferenced;
+			}
+			return OK;
+		}
+	}
+
+	UNREACHABLE;
+}
+
+PRIVATE KleinResult resolveTopLevel(Program* program) {
+	FunctionScope* previousFunction = currentFunction;
+	FunctionScope scope = (FunctionScope) {
+		.enclosing = NULL,
+		.locals = emptyLocalList(),
+		.captures = NULL,
+		.depth = 0,
+		.slotCount = 0,
+	};
+	currentFunction = &scope;
+
+	reserveGlobals(program);
+	KleinResult result = resolveStatements(&program->statements);
+	program->slotCount = scope.slotCount;
+
+	currentFunction = previousFunction;
+	free(scope.locals.data);
+
+	return result;
+}
+
+KleinResult resolveProgram(Program* program) {
+	isPropagating = false;
+	TRY(resolveTopLevel(program));
+
+	isPropagating = true;
+	KleinResult result = resolveTopLevel(program);
+	isPropagating = false;
+
+	return result;
+}
+
+KleinResult resolveStandaloneExpression(Expression* expression) {
+	FunctionScope* previousFunction = currentFunction;
+	FunctionScope scope = (FunctionScope) {
+		.enclosing = NULL,
+		.locals = emptyLocalList(),
+		.captures = NULL,
+		.depth = 0,
+		.slotCount = 0,
+	};
+	currentFunction = &scope;
+
+	KleinResult result = resolveExpression(expression);
+
+	currentFunction = previousFunction;
+	free(scope.locals.data);
+
+	TRY(result);
+	if (scope.slotCount > 0) {
+		return (KleinResult) {.type = KLEIN_ERROR_DECLARATION_IN_STANDALONE_EXPRESSION};
+	}
+
+	return OK;
+}
+
+IMPLEMENT_KLEIN_LIST(Local)
@@ -1,4 +1,5 @@
 #include "../include/result.h"
+#include "../include/lexer.h"
 #include <stdarg.h>
 #include <stdbool.h>
 
@@ -11,3 +12,75 @@ bool isOk(KleinResult result) {
 bool isError(KleinResult result) {
 	return !isOk(result);
 }
+
+void freeResult(KleinResult result) {
+	switch (result.type) {
+		case KLEIN_ERROR_UNRECOGNIZED_TOKEN:
+			free(result.data.unrecognizedToken);
+			break;
+		case KLEIN_ERROR_MISSING_FIELD:
+			free(result.data.missingField.value);
+			break;
+		case KLEIN_ERROR_ASSIGN_TO_NON_IDENTIFIER:
+			free(result.data.assignToNonIdentifier);
+			break;
+		default:
+			break;
+	}
+}
+
+void printError(KleinResult result) {
+	fflush(stdout);
+	fprintf(stderr, "\n%s ", STYLE("Error:", RED, BOLD));
+
+	KleinResultData data = result.data;
+	switch (result.type) {
+		case KLEIN_OK:
+			fprintf(stderr, "None.");
+			break;
+		case KLEIN_ERROR_INTERNAL:
+			fprintf(stderr, "Internal error.");
+			break;
+		case KLEIN_ERROR_UNRECOGNIZED_TOKEN:
+			fprintf(stderr, "Unrecognized token \"%s\".", data.unrecognizedToken);
+			break;
+		case KLEIN_ERROR_UNEXPECTED_TOKEN:
+			fprintf(stderr, "Expected %s but found %s.", tokenTypeName(data.unexpectedToken.expected), tokenTypeName(data.unexpectedToken.actual));
+			break;
+		case KLEIN_ERROR_PEEK_EMPTY_TOKEN_STREAM:
+			fprintf(stderr, "Unexpected end of input.");
+			break;
+		case KLEIN_ERROR_MISSING_FIELD:
+			fprintf(stderr, "No field called \"%s\".", data.missingField.name);
+			break;
+		case KLEIN_ERROR_ASSIGN_TO_NON_IDENTIFIER:
+			fprintf(stderr, "Only variables can be assigned to.");
+			break;
+		case KLEIN_ERROR_INCORRECT_ARGUMENT_COUNT:
+			fprintf(stderr, "Expected %lu arguments but got %lu.", data.incorrectArgumentCount.expected, data.incorrectArgumentCount.actual);
+			break;
+		case KLEIN_ERROR_INVALID_INDEX:
+			fprintf(stderr, "Invalid index.");
+			break;
+		case KLEIN_ERROR_UNHASHABLE_KEY:
+			fprintf(stderr, "That value can't be used as a map key.");
+			break;
+		case KLEIN_ERROR_MUTATE_FROZEN_VALUE:
+			fprintf(stderr, "Can't modify a frozen value.");
+			break;
+		case KLEIN_ERROR_INVALID_ARGUMENT:
+			fprintf(stderr, "Invalid argument.");
+			break;
+		case KLEIN_ERROR_DUPLICATE_VARIABLE_DECLARATION:
+			fprintf(stderr, "Variable \"%s\" is already declared.", data.duplicateVariableDeclaration);
+			break;
+		case KLEIN_ERROR_REFERENCE_UNDEFINED_VARIABLE:
+			fprintf(stderr, "Undefined variable \"%s\".", data.referenceUndefinedVariable);
+			break;
+		case KLEIN_ERROR_DECLARATION_IN_STANDALONE_EXPRESSION:
+			fprintf(stderr, "A standalone expression can only declare variables inside a function.");
+			break;
+	}
+
+	fprintf(stderr, "\n\n");
+}
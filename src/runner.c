@@ -1,87 +1,183 @@
 #include "../include/runner.h"
 #include "../include/builtin.h"
 #include "../include/context.h"
+#include "../include/gc.h"
+#include "../include/iterator.h"
+#include "../include/map.h"
 #include "../include/parser.h"
+#include "../include/persistent.h"
 #include "../include/sugar.h"
 #include <math.h>
 
 static bool isReturning = false;
 static Value returnValue;
 
+/** The interned name `builtin`, so calls can be checked for it by pointer. */
+static String builtinName;
+
 PRIVATE KleinResult evaluateStatement(Statement statement);
 KleinResult evaluateExpression(Expression expression, Value* output);
 
-PRIVATE KleinResult evaluateObject(Object object, Value* output) {
-	ValueFieldList* list = emptyHeapValueFieldList();
-	FOR_EACH(Field field, object.fields) {
+PRIVATE KleinResult evaluateObject(Object* object, Value* output) {
+
+	// Every record made by the same literal has the same shape
+	if (object->shape == NULL) {
+		Shape* shape = emptyShape();
+		FOR_EACH(Field field, object->fields) {
+			shape = shapeWithField(shape, field.name);
+		}
+		END;
+		object->shape = shape;
+	}
+
+	// Field values are rooted until they're in the record, since later fields may run statements
+	unsigned long roots = saveRoots();
+	Value slotBuffer[SMALL_LIST_CAPACITY];
+	ValueList slots = emptyValueListWithBuffer(slotBuffer, SMALL_LIST_CAPACITY);
+	FOR_EACH(Field field, object->fields) {
 		TRY_LET(Value value, evaluateExpression(field.value, &value));
-		ValueField valueField = (ValueField) {
-			.name = field.name,
-			.value = value,
-		};
-		appendToValueFieldList(list, valueField);
+		pushRoot(value);
+		appendToValueList(&slots, value);
 	}
 	END;
 
-	InternalList internals = emptyInternalList();
+	KleinResult result = recordValue(object->shape, slots.data, output);
+	freeValueList(&slots);
+	restoreRoots(roots);
+	return result;
+}
+
+/**
+ * Returns where the given variable currently lives: either a slot of the
+ * current frame, or wherever the current closure's upvalue points.
+ */
+PRIVATE Value* variableLocation(Identifier identifier) {
+	if (identifier.location == VARIABLE_LOCAL) {
+		return &CONTEXT->frame->slots[identifier.index];
+	}
 
-	Value result = (Value) {.fields = list, .internals = internals};
-	RETURN_OK(output, result);
+	return CONTEXT->frame->closure->upvalues[identifier.index]->location;
 }
 
-PRIVATE KleinResult evaluateBlock(Block block, Value* output) {
-	Scope* previousScope = CONTEXT->scope;
-	CONTEXT->scope = block.innerScope;
+/**
+ * Stores a value in a variable. A captured variable may live in a closed
+ * upvalue, which the garbage collector has to be told about.
+ */
+PRIVATE void assignVariable(Identifier identifier, Value value) {
+	*variableLocation(identifier) = value;
+	if (identifier.location != VARIABLE_LOCAL) {
+		writeBarrier(&CONTEXT->frame->closure->upvalues[identifier.index]->header, value);
+	}
+}
 
+PRIVATE KleinResult evaluateBlock(Block block, Value* output) {
+	KleinResult result = OK;
 	FOR_EACHP(Statement statement, block.statements) {
-		evaluateStatement(statement);
+		result = evaluateStatement(statement);
+		if (!isOk(result)) {
+			break;
+		}
 	}
 	END;
 
-	CONTEXT->scope = previousScope;
+	// Closures created in this block keep their own copy of its variables
+	if (block.closesUpvalues) {
+		closeUpvalues(block.firstSlot);
+	}
 
+	TRY(result);
 	return nullValue(output);
 }
 
 PRIVATE KleinResult evaluateList(ExpressionList list, Value* output) {
+	unsigned long roots = saveRoots();
 	ValueList elements = emptyValueList();
 	FOR_EACH(Expression element, list) {
-		TRY_LET(Value value, evaluateExpression(element, &value));
+		Value value;
+		KleinResult result = evaluateExpression(element, &value);
+		if (!isOk(result)) {
+			freeValueList(&elements);
+			restoreRoots(roots);
+			return result;
+		}
+		pushRoot(value);
 		appendToValueList(&elements, value);
 	}
 	END;
 
-	return listValue(elements, output);
+	KleinResult result = listValue(elements, output);
+	restoreRoots(roots);
+	return result;
 }
 
 PRIVATE KleinResult evaluateForLoop(ForLoop forLoop, Value* output) {
+	unsigned long roots = saveRoots();
 	TRY_LET(Value list, evaluateExpression(forLoop.list, &list));
-	TRY_LET(String iterable, valueToString(list, &iterable));
-	TRY_LET(ValueList * elements, getList(list, &elements));
+	pushRoot(list);
+
+	// Ranges are counted through without creating their elements
+	HeapRange* range = getUnmaterializedRange(list);
+	if (range != NULL) {
+		for (double number = range->low; number <= range->high; number++) {
+			TRY(numberValue(number, &CONTEXT->frame->slots[forLoop.slot]));
+			TRY_LET(Value blockValue, evaluateBlock(forLoop.body, &blockValue));
+			if (isReturning) {
+				break;
+			}
+		}
+		restoreRoots(roots);
+		return nullValue(output);
+	}
 
-	FOR_EACHP(Value value, elements) {
-		ScopeDeclaration declaration = (ScopeDeclaration) {
-			.name = forLoop.binding,
-			.value = value,
-		};
-		setVariable(forLoop.body.innerScope, declaration);
+	// Strings and iterators go through the iterator protocol
+	if (!isList(list)) {
+		TRY_LET(HeapIterator * iterator, iteratorOf(list, &iterator));
+		pushRoot(OBJECT_VALUE(iterator));
+		while (true) {
+			bool isDone;
+			TRY(advanceIterator(iterator, &CONTEXT->frame->slots[forLoop.slot], &isDone));
+			if (isDone) {
+				break;
+			}
+
+			// Advancing again could call a function, such as the one given to `map()`
+			TRY_LET(Value blockValue, evaluateBlock(forLoop.body, &blockValue));
+			if (isReturning) {
+				break;
+			}
+		}
+		restoreRoots(roots);
+		return nullValue(output);
+	}
+
+	TRY_LET(HeapList * elements, getList(list, &elements));
+
+	// The body may append to the list, so its elements are looked up afresh each time
+	for (unsigned long index = 0; index < elements->length; index++) {
+		CONTEXT->frame->slots[forLoop.slot] = listElement(elements, index);
 		TRY_LET(Value blockValue, evaluateBlock(forLoop.body, &blockValue));
+		if (isReturning) {
+			break;
+		}
 	}
-	END;
 
+	restoreRoots(roots);
 	return nullValue(output);
 }
 
 PRIVATE KleinResult evaluateWhileLoop(WhileLoop whileLoop, Value* output) {
 	while (true) {
 		TRY_LET(Value condition, evaluateExpression(whileLoop.condition, &condition));
-		TRY_LET(bool* conditionValue, getBoolean(condition, &conditionValue));
+		TRY_LET(bool conditionValue, getBoolean(condition, &conditionValue));
 
-		if (!*conditionValue) {
+		if (!conditionValue) {
 			break;
 		}
 
 		TRY_LET(Value blockValue, evaluateBlock(whileLoop.body, &blockValue));
+		if (isReturning) {
+			break;
+		}
 	}
 
 	return nullValue(output);
@@ -90,9 +186,9 @@ PRIVATE KleinResult evaluateWhileLoop(WhileLoop whileLoop, Value* output) {
 PRIVATE KleinResult evaluateIfExpression(IfExpressionList ifExpressions, Value* output) {
 	FOR_EACH(IfExpression ifExpression, ifExpressions) {
 		TRY_LET(Value condition, evaluateExpression(ifExpression.condition, &condition));
-		TRY_LET(bool* conditionValue, getBoolean(condition, &conditionValue));
+		TRY_LET(bool conditionValue, getBoolean(condition, &conditionValue));
 
-		if (*conditionValue) {
+		if (conditionValue) {
 			TRY_LET(Value blockValue, evaluateBlock(ifExpression.body, &blockValue));
 			break;
 		}
@@ -102,102 +198,230 @@ PRIVATE KleinResult evaluateIfExpression(IfExpressionList ifExpressions, Value*
 	return nullValue(output);
 }
 
-PRIVATE KleinResult evaluateBinaryExpression(BinaryExpression binary, Value* output) {
-	switch (binary.operation) {
+/**
+ * Reads the field named by the right side of a `.` expression off of `receiver`,
+ * going through the expression's inline cache for records. Built-in methods are
+ * returned as-is, without being bound to the receiver.
+ */
+PRIVATE KleinResult readField(BinaryExpression* dot, Value receiver, Value* output) {
+	if (isRecord(receiver)) {
+		HeapRecord* record = (HeapRecord*) AS_OBJECT(receiver);
+		FieldCache* cache = &dot->cache;
+		if (record->shape != cache->shape) {
+			unsigned long slot;
+			if (getShapeSlot(record->shape, dot->right.data.identifier.name, &slot)) {
+				*cache = (FieldCache) {.shape = record->shape, .slot = slot};
+			}
+		}
+		if (record->shape == cache->shape) {
+			RETURN_OK(output, record->slots[cache->slot]);
+		}
+	}
+
+	return getValueField(receiver, dot->right.data.identifier.name, output);
+}
+
+/**
+ * Assigns to `list[index]` or `map[key]`. A list whose elements are shared with
+ * a copy gets its own elements first.
+ */
+PRIVATE KleinResult assignToIndex(UnaryExpression indexExpression, Value value) {
+	unsigned long roots = saveRoots();
+	pushRoot(value);
+	TRY_LET(Value operand, evaluateExpression(indexExpression.expression, &operand));
+	pushRoot(operand);
+	TRY_LET(Value index, evaluateExpression(indexExpression.operation.data.index, &index));
+	restoreRoots(roots);
+
+	if (isMap(operand)) {
+		UNWRAP_LET(HeapMap * map, getMap(operand, &map));
+		return mapSet(map, index, value);
+	}
+
+	if (isNumber(index) && isList(operand)) {
+		UNWRAP_LET(double number, getNumber(index, &number));
+		UNWRAP_LET(HeapList * list, getList(operand, &list));
+		return setListElement(list, number, value);
+	}
+
+	return (KleinResult) {
+		.type = KLEIN_ERROR_INVALID_INDEX,
+	};
+}
+
+/**
+ * Evaluates both sides of a binary expression, keeping the left side alive while
+ * the right is evaluated.
+ */
+PRIVATE KleinResult evaluateOperands(BinaryExpression* binary, Value* left, Value* right) {
+	TRY(evaluateExpression(binary->left, left));
+	unsigned long roots = saveRoots();
+	pushRoot(*left);
+	TRY(evaluateExpression(binary->right, right));
+	restoreRoots(roots);
+	return OK;
+}
+
+/**
+ * Multiplies two integers, returning `false` instead if the product would be
+ * outside the integer range. The operands are checked before multiplying, since
+ * an overflowing multiplication is undefined.
+ */
+PRIVATE bool multiplyIntegers(int64_t left, int64_t right, int64_t* output) {
+	if (left != 0) {
+		int64_t limit = MAX_INTEGER / (left < 0 ? -left : left);
+		if (right > limit || right < -limit) {
+			return false;
+		}
+	}
+
+	*output = left * right;
+	return true;
+}
+
+PRIVATE KleinResult evaluateBinaryExpression(BinaryExpression* binary, Value* output) {
+	switch (binary->operation) {
 		case BINARY_OPERATION_DOT: {
-			TRY_LET(Value left, evaluateExpression(binary.left, &left));
-			TRY_LET(Value * value, getValueField(left, binary.right.data.identifier, &value));
-			Value* this = malloc(sizeof(Value));
-			*this = left;
-			appendToInternalList(&value->internals, (Internal) {.key = INTERNAL_KEY_THIS_OBJECT, .value = this});
-			RETURN_OK(output, *value);
+			TRY_LET(Value left, evaluateExpression(binary->left, &left));
+			TRY_LET(Value value, readField(binary, left, &value));
+
+			// Built-in methods receive the value they were read from
+			if (isBuiltinFunction(value)) {
+				return boundMethodValue(left, value, output);
+			}
+
+			RETURN_OK(output, value);
 		}
 		case BINARY_OPERATION_LESS_THAN_OR_EQUAL_TO: {
-			TRY_LET(Value left, evaluateExpression(binary.left, &left));
-			TRY_LET(Value right, evaluateExpression(binary.right, &right));
-			TRY_LET(double* leftNumber, getNumber(left, &leftNumber));
-			TRY_LET(double* rightNumber, getNumber(right, &rightNumber));
-			return booleanValue(*leftNumber <= *rightNumber, output);
+			Value left;
+			Value right;
+			TRY(evaluateOperands(binary, &left, &right));
+			if (IS_INTEGER(left) && IS_INTEGER(right)) {
+				return booleanValue(AS_INTEGER(left) <= AS_INTEGER(right), output);
+			}
+			TRY_LET(double leftNumber, getNumber(left, &leftNumber));
+			TRY_LET(double rightNumber, getNumber(right, &rightNumber));
+			return booleanValue(leftNumber <= rightNumber, output);
 		}
 		case BINARY_OPERATION_LESS_THAN: {
-			TRY_LET(Value left, evaluateExpression(binary.left, &left));
-			TRY_LET(Value right, evaluateExpression(binary.right, &right));
-			TRY_LET(double* leftNumber, getNumber(left, &leftNumber));
-			TRY_LET(double* rightNumber, getNumber(right, &rightNumber));
-			return booleanValue(*leftNumber < *rightNumber, output);
+			Value left;
+			Value right;
+			TRY(evaluateOperands(binary, &left, &right));
+			if (IS_INTEGER(left) && IS_INTEGER(right)) {
+				return booleanValue(AS_INTEGER(left) < AS_INTEGER(right), output);
+			}
+			TRY_LET(double leftNumber, getNumber(left, &leftNumber));
+			TRY_LET(double rightNumber, getNumber(right, &rightNumber));
+			return booleanValue(leftNumber < rightNumber, output);
 		}
 		case BINARY_OPERATION_GREATER_THAN: {
-			TRY_LET(Value left, evaluateExpression(binary.left, &left));
-			TRY_LET(Value right, evaluateExpression(binary.right, &right));
-			TRY_LET(double* leftNumber, getNumber(left, &leftNumber));
-			TRY_LET(double* rightNumber, getNumber(right, &rightNumber));
-			return booleanValue(*leftNumber > *rightNumber, output);
+			Value left;
+			Value right;
+			TRY(evaluateOperands(binary, &left, &right));
+			if (IS_INTEGER(left) && IS_INTEGER(right)) {
+				return booleanValue(AS_INTEGER(left) > AS_INTEGER(right), output);
+			}
+			TRY_LET(double leftNumber, getNumber(left, &leftNumber));
+			TRY_LET(double rightNumber, getNumber(right, &rightNumber));
+			return booleanValue(leftNumber > rightNumber, output);
 		}
 		case BINARY_OPERATION_GREATER_THAN_OR_EQUAL_TO: {
-			TRY_LET(Value left, evaluateExpression(binary.left, &left));
-			TRY_LET(Value right, evaluateExpression(binary.right, &right));
-			TRY_LET(double* leftNumber, getNumber(left, &leftNumber));
-			TRY_LET(double* rightNumber, getNumber(right, &rightNumber));
-			return booleanValue(*leftNumber >= *rightNumber, output);
+			Value left;
+			Value right;
+			TRY(evaluateOperands(binary, &left, &right));
+			if (IS_INTEGER(left) && IS_INTEGER(right)) {
+				return booleanValue(AS_INTEGER(left) >= AS_INTEGER(right), output);
+			}
+			TRY_LET(double leftNumber, getNumber(left, &leftNumber));
+			TRY_LET(double rightNumber, getNumber(right, &rightNumber));
+			return booleanValue(leftNumber >= rightNumber, output);
 		}
 		case BINARY_OPERATION_PLUS: {
-			TRY_LET(Value left, evaluateExpression(binary.left, &left));
-			TRY_LET(Value right, evaluateExpression(binary.right, &right));
-			TRY_LET(double* leftNumber, getNumber(left, &leftNumber));
-			TRY_LET(double* rightNumber, getNumber(right, &rightNumber));
-			return numberValue(*leftNumber + *rightNumber, output);
+			Value left;
+			Value right;
+			TRY(evaluateOperands(binary, &left, &right));
+			if (isString(left) && isString(right)) {
+				return concatenateStrings(left, right, output);
+			}
+
+			// Integer results too big for the integer range become doubles
+			if (IS_INTEGER(left) && IS_INTEGER(right)) {
+				return integerValue(AS_INTEGER(left) + AS_INTEGER(right), output);
+			}
+			TRY_LET(double leftNumber, getNumber(left, &leftNumber));
+			TRY_LET(double rightNumber, getNumber(right, &rightNumber));
+			return numberValue(leftNumber + rightNumber, output);
 		}
 		case BINARY_OPERATION_TIMES: {
-			TRY_LET(Value left, evaluateExpression(binary.left, &left));
-			TRY_LET(Value right, evaluateExpression(binary.right, &right));
-			TRY_LET(double* leftNumber, getNumber(left, &leftNumber));
-			TRY_LET(double* rightNumber, getNumber(right, &rightNumber));
-			return numberValue(*leftNumber * *rightNumber, output);
+			Value left;
+			Value right;
+			TRY(evaluateOperands(binary, &left, &right));
+			int64_t product;
+			if (IS_INTEGER(left) && IS_INTEGER(right) && multiplyIntegers(AS_INTEGER(left), AS_INTEGER(right), &product)) {
+				return integerValue(product, output);
+			}
+			TRY_LET(double leftNumber, getNumber(left, &leftNumber));
+			TRY_LET(double rightNumber, getNumber(right, &rightNumber));
+			return numberValue(leftNumber * rightNumber, output);
 		}
 		case BINARY_OPERATION_MINUS: {
-			TRY_LET(Value left, evaluateExpression(binary.left, &left));
-			TRY_LET(Value right, evaluateExpression(binary.right, &right));
-			TRY_LET(double* leftNumber, getNumber(left, &leftNumber));
-			TRY_LET(double* rightNumber, getNumber(right, &rightNumber));
-			return numberValue(*leftNumber - *rightNumber, output);
+			Value left;
+			Value right;
+			TRY(evaluateOperands(binary, &left, &right));
+			if (IS_INTEGER(left) && IS_INTEGER(right)) {
+				return integerValue(AS_INTEGER(left) - AS_INTEGER(right), output);
+			}
+			TRY_LET(double leftNumber, getNumber(left, &leftNumber));
+			TRY_LET(double rightNumber, getNumber(right, &rightNumber));
+			return numberValue(leftNumber - rightNumber, output);
 		}
 		case BINARY_OPERATION_DIVIDE: {
-			TRY_LET(Value left, evaluateExpression(binary.left, &left));
-			TRY_LET(Value right, evaluateExpression(binary.right, &right));
-			TRY_LET(double* leftNumber, getNumber(left, &leftNumber));
-			TRY_LET(double* rightNumber, getNumber(right, &rightNumber));
-			return numberValue(*leftNumber / *rightNumber, output);
+			Value left;
+			Value right;
+			TRY(evaluateOperands(binary, &left, &right));
+			TRY_LET(double leftNumber, getNumber(left, &leftNumber));
+			TRY_LET(double rightNumber, getNumber(right, &rightNumber));
+			return numberValue(leftNumber / rightNumber, output);
 		}
 		case BINARY_OPERATION_POWER: {
-			TRY_LET(Value left, evaluateExpression(binary.left, &left));
-			TRY_LET(Value right, evaluateExpression(binary.right, &right));
-			TRY_LET(double* leftNumber, getNumber(left, &leftNumber));
-			TRY_LET(double* rightNumber, getNumber(right, &rightNumber));
-			return numberValue(pow(*leftNumber, *rightNumber), output);
+			Value left;
+			Value right;
+			TRY(evaluateOperands(binary, &left, &right));
+			TRY_LET(double leftNumber, getNumber(left, &leftNumber));
+			TRY_LET(double rightNumber, getNumber(right, &rightNumber));
+			return numberValue(pow(leftNumber, rightNumber), output);
 		}
 		case BINARY_OPERATION_EQUAL: {
-			TRY_LET(Value left, evaluateExpression(binary.left, &left));
-			TRY_LET(Value right, evaluateExpression(binary.right, &right));
+			Value left;
+			Value right;
+			TRY(evaluateOperands(binary, &left, &right));
 			return valuesAreEqual(left, right, output);
 		}
 		case BINARY_OPERATION_AND: {
-			TRY_LET(Value left, evaluateExpression(binary.left, &left));
-			TRY_LET(Value right, evaluateExpression(binary.right, &right));
-			TRY_LET(bool* leftBoolean, getBoolean(left, &leftBoolean));
-			TRY_LET(bool* rightBoolean, getBoolean(right, &rightBoolean));
-			return booleanValue(*leftBoolean && *rightBoolean, output);
+			Value left;
+			Value right;
+			TRY(evaluateOperands(binary, &left, &right));
+			TRY_LET(bool leftBoolean, getBoolean(left, &leftBoolean));
+			TRY_LET(bool rightBoolean, getBoolean(right, &rightBoolean));
+			return booleanValue(leftBoolean && rightBoolean, output);
 		}
 		case BINARY_OPERATION_OR: {
-			TRY_LET(Value left, evaluateExpression(binary.left, &left));
-			TRY_LET(Value right, evaluateExpression(binary.right, &right));
-			TRY_LET(bool* leftBoolean, getBoolean(left, &leftBoolean));
-			TRY_LET(bool* rightBoolean, getBoolean(right, &rightBoolean));
-			return booleanValue(*leftBoolean || *rightBoolean, output);
+			Value left;
+			Value right;
+			TRY(evaluateOperands(binary, &left, &right));
+			TRY_LET(bool leftBoolean, getBoolean(left, &leftBoolean));
+			TRY_LET(bool rightBoolean, getBoolean(right, &rightBoolean));
+			return booleanValue(leftBoolean || rightBoolean, output);
 		}
 		case BINARY_OPERATION_ASSIGN: {
-			if (binary.left.type != EXPRESSION_IDENTIFIER) {
+			if (binary->left.type == EXPRESSION_UNARY && binary->left.data.unary->operation.type == UNARY_OPERATION_INDEX) {
+				TRY_LET(Value right, evaluateExpression(binary->right, &right));
+				TRY(assignToIndex(*binary->left.data.unary, right));
+				RETURN_OK(output, right);
+			}
+			if (binary->left.type != EXPRESSION_IDENTIFIER) {
 				Expression* expression = malloc(sizeof(Expression));
-				*expression = binary.left;
+				*expression = binary->left;
 				return (KleinResult) {
 					.type = KLEIN_ERROR_ASSIGN_TO_NON_IDENTIFIER,
 					.data = (KleinResultData) {
@@ -205,97 +429,207 @@ PRIVATE KleinResult evaluateBinaryExpression(BinaryExpression binary, Value* out
 					},
 				};
 			}
-			TRY_LET(Value right, evaluateExpression(binary.right, &right));
-			return reassignVariable(CONTEXT->scope, (ScopeDeclaration) {.name = binary.left.data.identifier, .value = right});
+			TRY_LET(Value right, evaluateExpression(binary->right, &right));
+			assignVariable(binary->left.data.identifier, right);
+			RETURN_OK(output, right);
 		}
 	}
 
 	UNREACHABLE;
 }
 
-PRIVATE KleinResult evaluateFunction(Function expression, Value* output) {
-	return functionValue(expression, output);
+/**
+ * Creates a closure over the given function, capturing the variables it uses
+ * from the enclosing functions. Only the captured variables are touched, so
+ * this costs time proportional to the number of captures.
+ */
+PRIVATE KleinResult evaluateFunction(Function* function, Value* output) {
+	Upvalue** upvalues = malloc(sizeof(Upvalue*) * MAX(function->captures.size, 1));
+	FOR_EACH(Capture capture, function->captures) {
+		KleinResult result = OK;
+		if (capture.isLocal && capture.isCopy) {
+			result = copyUpvalue(capture.index, &upvalues[index__]);
+		} else if (capture.isLocal) {
+			result = captureUpvalue(capture.index, &upvalues[index__]);
+		} else {
+			upvalues[index__] = CONTEXT->frame->closure->upvalues[capture.index];
+		}
+		if (!isOk(result)) {
+			free(upvalues);
+			return result;
+		}
+	}
+	END;
+
+	Closure* closure = (Closure*) allocateObject(HEAP_OBJECT_CLOSURE, sizeof(Closure));
+	closure->function = function;
+	closure->upvalues = upvalues;
+
+	return functionValue(closure, output);
+}
+
+KleinResult callFunction(Value function, ValueList* arguments, Value* output) {
+
+	// Built-in method taken as a value, like `let append = list.append`
+	if (isBoundMethod(function)) {
+		UNWRAP_LET(HeapBoundMethod * bound, getBoundMethod(function, &bound));
+		prependToValueList(arguments, bound->receiver);
+		function = bound->method;
+	}
+
+	// Builtin function like `print()`
+	if (isBuiltinFunction(function)) {
+		UNWRAP_LET(BuiltinFunction builtin, getBuiltinFunction(function, &builtin));
+		return (*builtin)(arguments, output);
+	}
+
+	// Regular function
+	TRY_LET(Closure * closure, getFunction(function, &closure));
+	Function* called = closure->function;
+
+	// Arguments
+	if (called->parameters.size != arguments->size) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_INCORRECT_ARGUMENT_COUNT,
+			.data = (KleinResultData) {
+				.incorrectArgumentCount = (KleinIncorrectArgumentCountError) {
+					.expected = called->parameters.size,
+					.actual = arguments->size,
+				},
+			},
+		};
+	}
+
+	// A return already under way in the caller belongs to the caller, so it's set aside
+	bool wasReturning = isReturning;
+	Value pendingReturnValue = returnValue;
+	unsigned long roots = saveRoots();
+	pushRoot(pendingReturnValue);
+	isReturning = false;
+
+	// Parameters occupy the first slots of the new frame
+	TRY(enterFrame(closure, called->slotCount));
+	if (arguments->size > 0) {
+		memcpy(CONTEXT->frame->slots, arguments->data, sizeof(Value) * arguments->size);
+	}
+
+	// Body
+	Value result;
+	KleinResult attempt = evaluateBlock(called->body, &result);
+	TRY(exitFrame());
+
+	// Return
+	Value calledReturnValue = NULL_VALUE;
+	bool isReturned = isReturning;
+	if (isReturned) {
+		calledReturnValue = returnValue;
+	}
+	isReturning = wasReturning;
+	returnValue = pendingReturnValue;
+	restoreRoots(roots);
+	TRY(attempt);
+
+	if (isReturned) {
+		RETURN_OK(output, calledReturnValue);
+	}
+	return nullValue(output);
 }
 
 PRIVATE KleinResult evaluateUnaryExpression(UnaryExpression unaryExpression, Value* output) {
 	switch (unaryExpression.operation.type) {
 		case UNARY_OPERATION_FUNCTION_CALL: {
 			// Builtin
-			if (unaryExpression.expression.type == EXPRESSION_IDENTIFIER && strcmp(unaryExpression.expression.data.identifier, "builtin") == 0) {
+			if (unaryExpression.expression.type == EXPRESSION_IDENTIFIER && unaryExpression.expression.data.identifier.name == builtinName) {
 				TRY_LET(BuiltinFunction builtin, getBuiltin(unaryExpression.operation.data.functionCall.data[0].data.string, &builtin));
-				return builtinFunctionToValue(builtin, output);
+				return builtinFunctionValue(builtin, output);
 			}
 
 			// Not builtin()
-			TRY_LET(Value functionToCall, evaluateExpression(unaryExpression.expression, &functionToCall));
-
-			// Builtin function like `print()`
-			if (isBuiltinFunction(functionToCall)) {
-				UNWRAP_LET(BuiltinFunction builtin, getValueInternal(functionToCall, INTERNAL_KEY_BUILTIN_FUNCTION, (void**) &builtin));
-				ValueList arguments = emptyValueList();
-				if (hasInternal(functionToCall, INTERNAL_KEY_THIS_OBJECT)) {
-					UNWRAP_LET(Value * this, getValueInternal(functionToCall, INTERNAL_KEY_THIS_OBJECT, (void**) &this));
-					appendToValueList(&arguments, *this);
-				}
-				FOR_EACH(Expression argumentExpression, unaryExpression.operation.data.functionCall) {
-					TRY_LET(Value argument, evaluateExpression(argumentExpression, &argument));
-					appendToValueList(&arguments, argument);
-				}
-				END;
-				return (*builtin)(&arguments, output);
+			Value functionToCall;
+			Value receiver;
+			bool hasReceiver = false;
+
+			// Method calls like `list.append(x)` pass the receiver straight through
+			// instead of binding it to the method first
+			unsigned long roots = saveRoots();
+			Expression callee = unaryExpression.expression;
+			if (callee.type == EXPRESSION_BINARY && callee.data.binary->operation == BINARY_OPERATION_DOT) {
+				TRY(evaluateExpression(callee.data.binary->left, &receiver));
+				pushRoot(receiver);
+				TRY(readField(callee.data.binary, receiver, &functionToCall));
+				hasReceiver = isBuiltinFunction(functionToCall);
+			} else {
+				TRY(evaluateExpression(callee, &functionToCall));
 			}
+			pushRoot(functionToCall);
 
-			// Regular function
-			TRY_LET(Function * function, getFunction(functionToCall, &function));
-
-			// Arguments
-			if (function->parameters.size != unaryExpression.operation.data.functionCall.size) {
-				return (KleinResult) {
-					.type = KLEIN_ERROR_INCORRECT_ARGUMENT_COUNT,
-					.data = (KleinResultData) {
-						.incorrectArgumentCount = (KleinIncorrectArgumentCountError) {
-							.expected = function->parameters.size,
-							.actual = unaryExpression.operation.data.functionCall.size,
-						},
-					},
-				};
-			}
-			for (size_t parameterNumber = 0; parameterNumber < function->parameters.size; parameterNumber++) {
-				TRY_LET(Value argument, evaluateExpression(unaryExpression.operation.data.functionCall.data[parameterNumber], &argument));
-				TRY(setVariable(function->body.innerScope, (ScopeDeclaration) {.name = function->parameters.data[parameterNumber].name, .value = argument}));
+			// Most calls have only a few arguments, which are gathered on the stack
+			Value argumentBuffer[SMALL_LIST_CAPACITY];
+			ValueList arguments = emptyValueListWithBuffer(argumentBuffer, SMALL_LIST_CAPACITY);
+			if (hasReceiver) {
+				appendToValueList(&arguments, receiver);
 			}
-
-			// Body
-			TRY_LET(Value result, evaluateBlock(function->body, &result));
-
-			// Return
-			if (isReturning) {
-				isReturning = false;
-				TRY_LET(String returning, valueToString(returnValue, &returning));
-				RETURN_OK(output, returnValue);
+			FOR_EACH(Expression argumentExpression, unaryExpression.operation.data.functionCall) {
+				TRY_LET(Value argument, evaluateExpression(argumentExpression, &argument));
+				pushRoot(argument);
+				appendToValueList(&arguments, argument);
 			}
+			END;
 
-			return nullValue(output);
+			KleinResult result = callFunction(functionToCall, &arguments, output);
+			freeValueList(&arguments);
+			restoreRoots(roots);
+			return result;
 		}
 		case UNARY_OPERATION_NOT: {
 			TRY_LET(Value operand, evaluateExpression(unaryExpression.expression, &operand));
-			TRY_LET(bool* boolean, getBoolean(operand, &boolean));
-			return booleanValue(!*boolean, output);
+			TRY_LET(bool boolean, getBoolean(operand, &boolean));
+			return booleanValue(!boolean, output);
 		}
 		case UNARY_OPERATION_INDEX: {
+			unsigned long roots = saveRoots();
 			TRY_LET(Value operand, evaluateExpression(unaryExpression.expression, &operand));
+			pushRoot(operand);
 			TRY_LET(Value index, evaluateExpression(unaryExpression.operation.data.index, &index));
+			restoreRoots(roots);
+
+			if (isMap(operand)) {
+				UNWRAP_LET(HeapMap * map, getMap(operand, &map));
+				TRY_LET(bool isFound, mapGet(map, index, output, &isFound));
+				if (!isFound) {
+					return (KleinResult) {
+						.type = KLEIN_ERROR_INVALID_INDEX,
+					};
+				}
+				return OK;
+			}
+
+			if (isPersistentMap(operand)) {
+				UNWRAP_LET(HeapPersistentMap * map, getPersistentMap(operand, &map));
+				TRY_LET(bool isFound, persistentMapGet(map, index, output, &isFound));
+				if (!isFound) {
+					return (KleinResult) {
+						.type = KLEIN_ERROR_INVALID_INDEX,
+					};
+				}
+				return OK;
+			}
+
+			if (isNumber(index) && isVector(operand)) {
+				UNWRAP_LET(double number, getNumber(index, &number));
+				UNWRAP_LET(HeapVector * vector, getVector(operand, &vector));
+				return vectorGet(vector, number, output);
+			}
 
 			if (isString(index)) {
-				UNWRAP_LET(String * string, getString(index, &string));
-				TRY_LET(Value * field, getValueField(operand, *string, &field));
-				RETURN_OK(output, *field);
+				UNWRAP_LET(String string, getString(index, &string));
+				return getValueField(operand, internName(string), output);
 			}
 
 			if (isNumber(index) && isList(operand)) {
-				UNWRAP_LET(double* number, getNumber(index, &number));
-				UNWRAP_LET(ValueList * list, getList(operand, &list));
-				RETURN_OK(output, list->data[(int) *number]);
+				UNWRAP_LET(double number, getNumber(index, &number));
+				UNWRAP_LET(HeapList * list, getList(operand, &list));
+				return getListElement(list, number, output);
 			}
 
 			return (KleinResult) {
@@ -309,11 +643,22 @@ PRIVATE KleinResult evaluateUnaryExpression(UnaryExpression unaryExpression, Val
 KleinResult evaluateExpression(Expression expression, Value* output) {
 	switch (expression.type) {
 		case EXPRESSION_OBJECT: {
-			return evaluateObject(*expression.data.object, output);
+			return evaluateObject(expression.data.object, output);
 		}
 		case EXPRESSION_IDENTIFIER: {
-			TRY_LET(Value * result, getVariable(*CONTEXT->scope, expression.data.identifier, &result));
-			RETURN_OK(output, *result);
+			Value value = *variableLocation(expression.data.identifier);
+
+			// A function read a top-level variable before its declaration ran
+			if (value.bits == UNDECLARED_VALUE.bits) {
+				return (KleinResult) {
+					.type = KLEIN_ERROR_REFERENCE_UNDEFINED_VARIABLE,
+					.data = (KleinResultData) {
+						.referenceUndefinedVariable = expression.data.identifier.name,
+					},
+				};
+			}
+
+			RETURN_OK(output, value);
 		}
 		case EXPRESSION_BLOCK: {
 			return evaluateBlock(*expression.data.block, output);
@@ -328,10 +673,10 @@ KleinResult evaluateExpression(Expression expression, Value* output) {
 			return evaluateIfExpression(*expression.data.ifExpression, output);
 		}
 		case EXPRESSION_BINARY: {
-			return evaluateBinaryExpression(*expression.data.binary, output);
+			return evaluateBinaryExpression(expression.data.binary, output);
 		}
 		case EXPRESSION_STRING: {
-			return stringValue(expression.data.string, output);
+			RETURN_OK(output, OBJECT_VALUE(internedString(expression.data.string)));
 		}
 		case EXPRESSION_NUMBER: {
 			return numberValue(expression.data.number, output);
@@ -356,27 +701,25 @@ KleinResult evaluateExpression(Expression expression, Value* output) {
 	UNREACHABLE;
 }
 
-PRIVATE KleinResult evaluateStatement(Statement statement) {
-	if (isReturning) {
-		return OK;
-	}
-
+PRIVATE KleinResult executeStatement(Statement statement) {
 	switch (statement.type) {
 		case STATEMENT_EXPRESSION: {
 			TRY_LET(Value value, evaluateExpression(statement.data.expression, &value));
 			return OK;
 		}
 		case STATEMENT_DECLARATION: {
+
+			// Every use of a constant was replaced with its value by the resolver
+			if (statement.data.declaration.isConstant) {
+				return OK;
+			}
+
 			TRY_LET(Value value, evaluateExpression(statement.data.declaration.value, &value));
-			ScopeDeclaration declaration = (ScopeDeclaration) {
-				.name = statement.data.declaration.name,
-				.value = value,
-			};
-			setVariable(CONTEXT->scope, declaration);
+			CONTEXT->frame->slots[statement.data.declaration.slot] = value;
 			return OK;
 		}
 		case STATEMENT_RETURN: {
-			evaluateExpression(statement.data.returnExpression, &returnValue);
+			TRY(evaluateExpression(statement.data.returnExpression, &returnValue));
 			isReturning = true;
 			return OK;
 		}
@@ -385,11 +728,46 @@ PRIVATE KleinResult evaluateStatement(Statement statement) {
 	UNREACHABLE;
 }
 
+/**
+ * Runs a statement. The start of a statement is the only place garbage is
+ * collected, so every value still in use by an enclosing expression must be
+ * reachable from a frame or pushed onto the root stack by then. Anything an
+ * expression left on the root stack when it failed is popped afterwards.
+ */
+PRIVATE KleinResult evaluateStatement(Statement statement) {
+	if (isReturning) {
+		return OK;
+	}
+
+	collectGarbageIfNeeded();
+	unsigned long roots = saveRoots();
+	KleinResult result = executeStatement(statement);
+	restoreRoots(roots);
+	return result;
+}
+
 KleinResult run(Program program) {
+	builtinName = internName("builtin");
+	returnValue = NULL_VALUE;
+	addGlobalRoot(&returnValue);
+	TRY(enterFrame(NULL, program.slotCount));
+
+	// Functions can refer to top-level variables declared after them, so reading
+	// one too early has to be caught
+	for (unsigned long slot = 0; slot < program.slotCount; slot++) {
+		CONTEXT->frame->slots[slot] = UNDECLARED_VALUE;
+	}
+
+	// The first statement that fails stops the program
+	KleinResult result = OK;
 	FOR_EACH(Statement statement, program.statements) {
-		evaluateStatement(statement);
+		result = evaluateStatement(statement);
+		if (!isOk(result)) {
+			break;
+		}
 	}
 	END;
 
-	return OK;
+	TRY(exitFrame());
+	return result;
 }
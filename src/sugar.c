@@ -1,188 +1,1262 @@
 #include "../include/sugar.h"
 #include "../include/builtin.h"
+#include "../include/gc.h"
 #include "../include/parser.h"
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
 
-KleinResult evaluateExpression(Expression expression, Value* output);
+IMPLEMENT_KLEIN_LIST(ShapeTransition)
 
-KleinResult stringValue(String string, Value* output) {
+Shape* emptyShape(void) {
+	static Shape* empty = NULL;
+	if (empty == NULL) {
+		empty = malloc(sizeof(Shape));
+		*empty = (Shape) {
+			.fieldNames = emptyStringList(),
+			.transitions = emptyShapeTransitionList(),
+		};
+	}
+
+	return empty;
+}
+
+Shape* shapeWithField(Shape* shape, String name) {
 
-	// Internals
-	InternalList internals = emptyInternalList();
-	String* pointer = malloc(sizeof(String));
-	*pointer = string;
-	appendToInternalList(&internals, (Internal) {.key = INTERNAL_KEY_STRING, .value = pointer});
-
-	// Fields
-	ValueFieldList* fields = emptyHeapValueFieldList();
-
-	// .length()
-	BuiltinFunction function;
-	TRY(getBuiltin("String.length", &function));
-	TRY_LET(Value length, builtinFunctionToValue(function, &length));
-	appendToValueFieldList(fields, (ValueField) {.name = "length", .value = length});
-
-	// Create value
-	Value value = (Value) {
-		.fields = fields,
-		.internals = internals,
+	// Existing transition
+	FOR_EACH(ShapeTransition transition, shape->transitions) {
+		if (transition.name == name) {
+			return transition.shape;
+		}
+	}
+	END;
+
+	// New shape
+	Shape* next = malloc(sizeof(Shape));
+	*next = (Shape) {
+		.fieldNames = emptyStringList(),
+		.transitions = emptyShapeTransitionList(),
 	};
+	FOR_EACH(String fieldName, shape->fieldNames) {
+		appendToStringList(&next->fieldNames, fieldName);
+	}
+	END;
+	appendToStringList(&next->fieldNames, name);
 
-	RETURN_OK(output, value);
+	appendToShapeTransitionList(&shape->transitions, (ShapeTransition) {.name = name, .shape = next});
+	return next;
+}
+
+bool getShapeSlot(Shape* shape, String name, unsigned long* output) {
+	FOR_EACH(String fieldName, shape->fieldNames) {
+		if (fieldName == name) {
+			*output = index__;
+			return true;
+		}
+	}
+	END;
+
+	return false;
+}
+
+HeapObject* allocateObject(HeapObjectType type, size_t size) {
+	HeapObject* object = malloc(size);
+	object->type = (uint8_t) type;
+	object->isFrozen = false;
+	object->isHashed = false;
+	atomic_init(&object->isMarked, false);
+	object->isOld = false;
+	object->isRemembered = false;
+	object->hash = 0;
+	trackObject(object, size);
+	return object;
+}
+
+bool isObjectOfType(Value value, HeapObjectType type) {
+	return IS_OBJECT(value) && AS_OBJECT(value)->type == type;
+}
+
+void freezeObject(HeapObject* object) {
+	object->isFrozen = true;
+	if (object->type == HEAP_OBJECT_LIST) {
+		((HeapList*) object)->storage->references = FROZEN_REFERENCES;
+	}
+}
+
+bool isFrozen(Value value) {
+	return !IS_OBJECT(value) || AS_OBJECT(value)->isFrozen;
+}
+
+KleinResult stringValue(String string, Value* output) {
+	return stringValueOfLength(string, strlen(string), output);
+}
+
+/**
+ * Allocates a string with room for `length` characters and the null terminator,
+ * which is filled in. The caller fills in the characters.
+ */
+PRIVATE HeapString* allocateString(unsigned long length) {
+	HeapString* string = (HeapString*) allocateObject(HEAP_OBJECT_STRING, sizeof(HeapString) + length + 1);
+	string->length = length;
+	string->hash = 0;
+	string->isHashed = false;
+	string->characters[length] = '\0';
+	return string;
+}
+
+KleinResult stringValueOfLength(const char* characters, unsigned long length, Value* output) {
+	HeapString* object = allocateString(length);
+	memcpy(object->characters, characters, length);
+	RETURN_OK(output, OBJECT_VALUE(object));
+}
+
+/**
+ * Copies the characters of a rope into a single string. The tree is walked with
+ * an explicit stack, filling the result from the end, because ropes built in a
+ * loop are as deep as the loop is long.
+ */
+PRIVATE KleinResult flattenRope(HeapRope* rope, HeapString** output) {
+	HeapString* result = allocateString(rope->length);
+
+	unsigned long position = rope->length;
+	ValueList pending = emptyValueList();
+	appendToValueList(&pending, OBJECT_VALUE(rope));
+	while (pending.size > 0) {
+		Value part = pending.data[--pending.size];
+		if (isObjectOfType(part, HEAP_OBJECT_ROPE) && ((HeapRope*) AS_OBJECT(part))->flattened == NULL) {
+			HeapRope* node = (HeapRope*) AS_OBJECT(part);
+			appendToValueList(&pending, node->left);
+			appendToValueList(&pending, node->right);
+			continue;
+		}
+
+		// Slices are copied straight from their parent
+		if (isObjectOfType(part, HEAP_OBJECT_STRING_SLICE)) {
+			HeapStringSlice* slice = (HeapStringSlice*) AS_OBJECT(part);
+			position -= slice->length;
+			memcpy(result->characters + position, slice->parent->characters + slice->offset, slice->length);
+			continue;
+		}
+
+		HeapString* string = isObjectOfType(part, HEAP_OBJECT_ROPE) ? ((HeapRope*) AS_OBJECT(part))->flattened : (HeapString*) AS_OBJECT(part);
+		position -= string->length;
+		memcpy(result->characters + position, string->characters, string->length);
+	}
+	free(pending.data);
+
+	rope->flattened = result;
+	writeBarrier(&rope->header, OBJECT_VALUE(result));
+	rope->left = NULL_VALUE;
+	rope->right = NULL_VALUE;
+	RETURN_OK(output, result);
+}
+
+KleinResult getString(Value value, String* output) {
+	TRY_LET(HeapString * string, getStringObject(value, &string));
+	RETURN_OK(output, string->characters);
+}
+
+KleinResult getStringObject(Value value, HeapString** output) {
+	if (isObjectOfType(value, HEAP_OBJECT_ROPE)) {
+		HeapRope* rope = (HeapRope*) AS_OBJECT(value);
+		if (rope->flattened == NULL) {
+			return flattenRope(rope, output);
+		}
+		RETURN_OK(output, rope->flattened);
+	}
+
+	if (isObjectOfType(value, HEAP_OBJECT_STRING_SLICE)) {
+		HeapStringSlice* slice = (HeapStringSlice*) AS_OBJECT(value);
+		if (slice->offset != 0 || slice->length != slice->parent->length) {
+			HeapString* copy = allocateString(slice->length);
+			memcpy(copy->characters, slice->parent->characters + slice->offset, slice->length);
+			slice->parent = copy;
+			writeBarrier(&slice->header, OBJECT_VALUE(copy));
+			slice->offset = 0;
+		}
+		RETURN_OK(output, slice->parent);
+	}
+
+	if (!isObjectOfType(value, HEAP_OBJECT_STRING)) {
+		UNREACHABLE;
+	}
+
+	RETURN_OK(output, (HeapString*) AS_OBJECT(value));
+}
+
+KleinResult getStringCharacters(Value value, const char** output) {
+	if (isObjectOfType(value, HEAP_OBJECT_STRING_SLICE)) {
+		HeapStringSlice* slice = (HeapStringSlice*) AS_OBJECT(value);
+		RETURN_OK(output, slice->parent->characters + slice->offset);
+	}
+
+	TRY_LET(HeapString * string, getStringObject(value, &string));
+	RETURN_OK(output, string->characters);
+}
+
+unsigned long stringValueLength(Value value) {
+	if (isObjectOfType(value, HEAP_OBJECT_ROPE)) {
+		return ((HeapRope*) AS_OBJECT(value))->length;
+	}
+
+	if (isObjectOfType(value, HEAP_OBJECT_STRING_SLICE)) {
+		return ((HeapStringSlice*) AS_OBJECT(value))->length;
+	}
+
+	return ((HeapString*) AS_OBJECT(value))->length;
+}
+
+/**
+ * Returns whether `start` and `end` are whole numbers marking out part of a
+ * sequence of the given length.
+ */
+PRIVATE bool isSliceBounds(double start, double end, unsigned long length) {
+	return start >= 0 && start <= end && end <= (double) length && floor(start) == start && floor(end) == end;
+}
+
+/**
+ * Results shorter than this are copied instead of becoming a rope, since a rope
+ * node is about as big as the characters it would save copying.
+ */
+#define MINIMUM_ROPE_LENGTH 64
+
+KleinResult concatenateStrings(Value left, Value right, Value* output) {
+	unsigned long leftLength = stringValueLength(left);
+	unsigned long rightLength = stringValueLength(right);
+
+	if (leftLength == 0) {
+		RETURN_OK(output, right);
+	}
+	if (rightLength == 0) {
+		RETURN_OK(output, left);
+	}
+
+	// Short; both halves are necessarily flat
+	if (leftLength + rightLength < MINIMUM_ROPE_LENGTH) {
+		HeapString* leftString = (HeapString*) AS_OBJECT(left);
+		HeapString* rightString = (HeapString*) AS_OBJECT(right);
+		HeapString* result = allocateString(leftLength + rightLength);
+		memcpy(result->characters, leftString->characters, leftLength);
+		memcpy(result->characters + leftLength, rightString->characters, rightLength);
+		RETURN_OK(output, OBJECT_VALUE(result));
+	}
+
+	HeapRope* rope = (HeapRope*) allocateObject(HEAP_OBJECT_ROPE, sizeof(HeapRope));
+	rope->length = leftLength + rightLength;
+	rope->left = left;
+	rope->right = right;
+	rope->flattened = NULL;
+	RETURN_OK(output, OBJECT_VALUE(rope));
+}
+
+KleinResult sliceString(Value string, double start, double end, Value* output) {
+	unsigned long length = stringValueLength(string);
+	if (!isSliceBounds(start, end, length)) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_INVALID_INDEX,
+		};
+	}
+
+	// Slices of slices share the original parent
+	HeapString* parent;
+	unsigned long offset = (unsigned long) start;
+	if (isObjectOfType(string, HEAP_OBJECT_STRING_SLICE)) {
+		HeapStringSlice* slice = (HeapStringSlice*) AS_OBJECT(string);
+		parent = slice->parent;
+		offset += slice->offset;
+	} else {
+		TRY(getStringObject(string, &parent));
+	}
+
+	unsigned long sliceLength = (unsigned long) end - (unsigned long) start;
+	if (sliceLength == parent->length) {
+		RETURN_OK(output, OBJECT_VALUE(parent));
+	}
+
+	// Short slices are copied for the same reason short concatenations are, which
+	// also keeps every string shorter than `MINIMUM_ROPE_LENGTH` flat
+	if (sliceLength < MINIMUM_ROPE_LENGTH) {
+		return stringValueOfLength(parent->characters + offset, sliceLength, output);
+	}
+
+	HeapStringSlice* slice = (HeapStringSlice*) allocateObject(HEAP_OBJECT_STRING_SLICE, sizeof(HeapStringSlice));
+	slice->parent = parent;
+	slice->offset = offset;
+	slice->length = sliceLength;
+	RETURN_OK(output, OBJECT_VALUE(slice));
 }
 
-KleinResult getString(Value value, String** output) {
-	return getValueInternal(value, INTERNAL_KEY_STRING, (void**) output);
+KleinResult stringBuilderValue(Value* output) {
+	HeapStringBuilder* builder = (HeapStringBuilder*) allocateObject(HEAP_OBJECT_STRING_BUILDER, sizeof(HeapStringBuilder));
+	builder->length = 0;
+	builder->capacity = 16;
+	builder->characters = malloc(builder->capacity);
+	countAllocation(builder->capacity);
+	RETURN_OK(output, OBJECT_VALUE(builder));
+}
+
+KleinResult getStringBuilder(Value value, HeapStringBuilder** output) {
+	if (!isStringBuilder(value)) {
+		UNREACHABLE;
+	}
+
+	RETURN_OK(output, (HeapStringBuilder*) AS_OBJECT(value));
+}
+
+bool isStringBuilder(Value value) {
+	return isObjectOfType(value, HEAP_OBJECT_STRING_BUILDER);
+}
+
+void appendToStringBuilder(HeapStringBuilder* builder, const char* characters, unsigned long length) {
+	if (builder->length + length > builder->capacity) {
+		unsigned long capacity = builder->capacity;
+		while (builder->length + length > builder->capacity) {
+			builder->capacity *= 2;
+		}
+		builder->characters = realloc(builder->characters, builder->capacity);
+		countAllocation(builder->capacity - capacity);
+	}
+
+	memcpy(builder->characters + builder->length, characters, length);
+	builder->length += length;
+}
+
+PRIVATE uint32_t hashCharacters(const char* characters, unsigned long length) {
+	uint32_t hash = 2166136261u;
+	for (unsigned long index = 0; index < length; index++) {
+		hash ^= (uint8_t) characters[index];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+uint32_t stringHash(HeapString* string) {
+	if (!string->isHashed) {
+		string->hash = hashCharacters(string->characters, string->length);
+		string->isHashed = true;
+	}
+
+	return string->hash;
+}
+
+/**
+ * Moves every entry of the intern table into a new array of twice the capacity.
+ */
+PRIVATE void growInternTable(InternTable* table) {
+	unsigned long capacity = table->capacity * 2;
+	HeapString** entries = calloc(capacity, sizeof(HeapString*));
+	for (unsigned long index = 0; index < table->capacity; index++) {
+		HeapString* string = table->entries[index];
+		if (string == NULL) {
+			continue;
+		}
+
+		unsigned long slot = string->hash & (capacity - 1);
+		while (entries[slot] != NULL) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+		entries[slot] = string;
+	}
+
+	free(table->entries);
+	table->entries = entries;
+	table->capacity = capacity;
+}
+
+HeapString* internString(const char* characters, unsigned long length) {
+	if (CONTEXT->strings == NULL) {
+		CONTEXT->strings = malloc(sizeof(InternTable));
+		*CONTEXT->strings = (InternTable) {
+			.entries = calloc(64, sizeof(HeapString*)),
+			.capacity = 64,
+			.count = 0,
+		};
+	}
+	InternTable* table = CONTEXT->strings;
+
+	// Existing
+	uint32_t hash = hashCharacters(characters, length);
+	unsigned long slot = hash & (table->capacity - 1);
+	while (table->entries[slot] != NULL) {
+		HeapString* entry = table->entries[slot];
+		if (entry->hash == hash && entry->length == length && memcmp(entry->characters, characters, length) == 0) {
+			return entry;
+		}
+		slot = (slot + 1) & (table->capacity - 1);
+	}
+
+	// New
+	HeapString* string = allocateString(length);
+	memcpy(string->characters, characters, length);
+	string->hash = hash;
+	string->isHashed = true;
+	table->entries[slot] = string;
+	table->count++;
+
+	// Keep the load factor under three quarters
+	if (table->count * 4 > table->capacity * 3) {
+		growInternTable(table);
+	}
+
+	return string;
+}
+
+String internName(String name) {
+	return internString(name, strlen(name))->characters;
+}
+
+HeapString* internedString(String name) {
+	return (HeapString*) (name - offsetof(HeapString, characters));
+}
+
+void freeInternTable(InternTable* table) {
+	free(table->entries);
+	free(table);
+}
+
+bool stringsAreEqual(HeapString* left, HeapString* right) {
+	if (left == right) {
+		return true;
+	}
+
+	if (left->length != right->length) {
+		return false;
+	}
+
+	if (left->isHashed && right->isHashed && left->hash != right->hash) {
+		return false;
+	}
+
+	return memcmp(left->characters, right->characters, left->length) == 0;
 }
 
 bool isString(Value value) {
-	String* output;
-	return isOk(getString(value, &output));
+	return isObjectOfType(value, HEAP_OBJECT_STRING) || isObjectOfType(value, HEAP_OBJECT_ROPE) || isObjectOfType(value, HEAP_OBJECT_STRING_SLICE);
 }
 
 KleinResult numberValue(double number, Value* output) {
 
-	// Internals
-	InternalList internals = emptyInternalList();
-	double* heapValue = malloc(sizeof(double));
-	*heapValue = number;
-	appendToInternalList(&internals, (Internal) {.key = INTERNAL_KEY_NUMBER, .value = heapValue});
-
-	// Fields
-	ValueFieldList* fields = emptyHeapValueFieldList();
-
-	// .to()
-	String to = ""
-				"function(low: Number, high: Number): List {"
-				"    let numbers = [];"
-				"    let current = low;"
-				"    while current <= high {"
-				"        numbers.append(current);"
-				"        current = current + 1;"
-				"    };"
-				"    return numbers;"
-				"}";
-	TRY_LET(Expression parsed, parseKleinExpression(to, &parsed));
-	TRY_LET(Value toValue, evaluateExpression(parsed, &toValue));
-	appendToValueFieldList(fields, (ValueField) {.name = "to", .value = toValue});
-
-	// .mod()
-	BuiltinFunction function;
-	TRY(getBuiltin("Number.mod", &function));
-	TRY_LET(Value mod, builtinFunctionToValue(function, &mod));
-	appendToValueFieldList(fields, (ValueField) {.name = "mod", .value = mod});
-
-	// Create value
-	Value value = (Value) {
-		.fields = fields,
-		.internals = internals,
-	};
+	// Whole numbers are stored as integers, except `-0`, which would lose its sign
+	if (number >= (double) MIN_INTEGER && number <= (double) MAX_INTEGER && floor(number) == number && !(number == 0 && signbit(number))) {
+		RETURN_OK(output, INTEGER_VALUE((int64_t) number));
+	}
+
+	// Canonicalize NaN so that it can't collide with a boxed value
+	if (isnan(number)) {
+		number = NAN;
+	}
+
+	Value value;
+	memcpy(&value.bits, &number, sizeof(double));
 	RETURN_OK(output, value);
 }
 
-KleinResult getNumber(Value value, double** output) {
-	return getValueInternal(value, INTERNAL_KEY_NUMBER, (void**) output);
+KleinResult integerValue(int64_t integer, Value* output) {
+	if (integer < MIN_INTEGER || integer > MAX_INTEGER) {
+		return numberValue((double) integer, output);
+	}
+
+	RETURN_OK(output, INTEGER_VALUE(integer));
+}
+
+KleinResult getNumber(Value value, double* output) {
+	if (IS_INTEGER(value)) {
+		RETURN_OK(output, (double) AS_INTEGER(value));
+	}
+
+	if (!IS_DOUBLE(value)) {
+		UNREACHABLE;
+	}
+
+	memcpy(output, &value.bits, sizeof(double));
+	return OK;
 }
 
 bool isNumber(Value value) {
-	double* output;
-	return isOk(getNumber(value, &output));
+	return IS_NUMBER(value);
+}
+
+bool isInteger(Value value) {
+	return IS_INTEGER(value);
 }
 
 KleinResult booleanValue(bool boolean, Value* output) {
+	RETURN_OK(output, boolean ? TRUE_VALUE : FALSE_VALUE);
+}
 
-	// Internals
-	InternalList internals = emptyInternalList();
-	bool* heapValue = malloc(sizeof(bool));
-	*heapValue = boolean;
-	appendToInternalList(&internals, (Internal) {.key = INTERNAL_KEY_BOOLEAN, .value = heapValue});
+KleinResult getBoolean(Value value, bool* output) {
+	if (!isBoolean(value)) {
+		UNREACHABLE;
+	}
 
-	// Fields
-	ValueFieldList* fields = emptyHeapValueFieldList();
+	RETURN_OK(output, value.bits == TRUE_VALUE.bits);
+}
 
-	// Create value
-	Value value = (Value) {
-		.fields = fields,
-		.internals = internals,
-	};
-	RETURN_OK(output, value);
+bool isBoolean(Value value) {
+	return (value.bits | 1) == TRUE_VALUE.bits;
 }
 
-KleinResult getBoolean(Value value, bool** output) {
-	return getValueInternal(value, INTERNAL_KEY_BOOLEAN, (void**) output);
+PRIVATE HeapList* allocateList(ListStorage* storage, unsigned long offset, unsigned long length) {
+	HeapList* list = (HeapList*) allocateObject(HEAP_OBJECT_LIST, sizeof(HeapList));
+	list->storage = storage;
+	list->offset = offset;
+	list->length = length;
+	if (storage->references != FROZEN_REFERENCES) {
+		storage->references++;
+	}
+	return list;
 }
 
-bool isBoolean(Value value) {
-	bool* output;
-	return isOk(getBoolean(value, &output));
+PRIVATE ListStorage* allocateListStorage(ListElementKind kind) {
+	ListStorage* storage = (ListStorage*) allocateObject(HEAP_OBJECT_LIST_STORAGE, sizeof(ListStorage));
+	storage->references = 0;
+	storage->kind = kind;
+	storage->elements = emptyValueList();
+	storage->bits = (BitList) {.words = NULL, .size = 0, .capacity = 0};
+	return storage;
+}
+
+#define ROUND_UP_TO_WORD(bits__) (((bits__) + BITS_PER_WORD - 1) / BITS_PER_WORD * BITS_PER_WORD)
+
+PRIVATE bool getBit(BitList* bits, unsigned long index) {
+	return (bits->words[index / BITS_PER_WORD] >> (index % BITS_PER_WORD)) & 1;
+}
+
+PRIVATE void setBit(BitList* bits, unsigned long index, bool bit) {
+	uint64_t mask = (uint64_t) 1 << (index % BITS_PER_WORD);
+	if (bit) {
+		bits->words[index / BITS_PER_WORD] |= mask;
+	} else {
+		bits->words[index / BITS_PER_WORD] &= ~mask;
+	}
+}
+
+PRIVATE void appendBit(BitList* bits, bool bit) {
+	if (bits->size == bits->capacity) {
+		unsigned long capacity = MAX(bits->capacity * 2, BITS_PER_WORD);
+		bits->words = realloc(bits->words, capacity / 8);
+		bits->capacity = capacity;
+	}
+	setBit(bits, bits->size++, bit);
+}
+
+/**
+ * Reads the `BITS_PER_WORD` bits starting at `start`, which needn't be aligned
+ * to a word. Bits past the end of the storage read as `0`.
+ */
+PRIVATE uint64_t readBitWord(BitList* bits, unsigned long start) {
+	unsigned long word = start / BITS_PER_WORD;
+	unsigned long shift = start % BITS_PER_WORD;
+	uint64_t result = bits->words[word] >> shift;
+	if (shift != 0 && (word + 1) * BITS_PER_WORD < bits->capacity) {
+		result |= bits->words[word + 1] << (BITS_PER_WORD - shift);
+	}
+	return result;
+}
+
+/**
+ * Turns storage packed into bits back into one value per element, for when a
+ * list of booleans gains something else. The storage is rewritten in place, so it
+ * must already be private to the list being changed, as `separateListStorage()`
+ * leaves it.
+ */
+PRIVATE void unpackListStorage(ListStorage* storage) {
+	if (storage->kind != LIST_ELEMENTS_BOOLEANS) {
+		return;
+	}
+
+	storage->elements = emptyValueList();
+	for (unsigned long index = 0; index < storage->bits.size; index++) {
+		appendToValueList(&storage->elements, getBit(&storage->bits, index) ? TRUE_VALUE : FALSE_VALUE);
+	}
+	free(storage->bits.words);
+	storage->bits = (BitList) {.words = NULL, .size = 0, .capacity = 0};
+	storage->kind = LIST_ELEMENTS_VALUES;
+	countAllocation(sizeof(Value) * storage->elements.capacity);
 }
 
 KleinResult listValue(ValueList values, Value* output) {
+	bool isNumbers = true;
+	bool isBooleans = values.size > 0;
+	FOR_EACH(Value element, values) {
+		isNumbers = isNumbers && IS_NUMBER(element);
+		isBooleans = isBooleans && isBoolean(element);
+		if (!isNumbers && !isBooleans) {
+			break;
+		}
+	}
+	END;
 
-	// Internals
-	InternalList internals = emptyInternalList();
-	ValueList* heapValues = malloc(sizeof(ValueList));
-	*heapValues = values;
-	appendToInternalList(&internals, (Internal) {.key = INTERNAL_KEY_LIST, .value = heapValues});
-
-	// Fields
-	ValueFieldList* fields = emptyHeapValueFieldList();
-
-	// .append()
-	BuiltinFunction function;
-	TRY(getBuiltin("List.append", &function));
-	TRY_LET(Value append, builtinFunctionToValue(function, &append));
-	appendToValueFieldList(fields, (ValueField) {.name = "append", .value = append});
-
-	// Create value
-	Value value = (Value) {
-		.fields = fields,
-		.internals = internals,
-	};
-	RETURN_OK(output, value);
+	if (isBooleans) {
+		ListStorage* storage = allocateListStorage(LIST_ELEMENTS_BOOLEANS);
+		FOR_EACH(Value element, values) {
+			appendBit(&storage->bits, element.bits == TRUE_VALUE.bits);
+		}
+		END;
+		freeValueList(&values);
+		countAllocation(storage->bits.capacity / 8);
+		RETURN_OK(output, OBJECT_VALUE(allocateList(storage, 0, storage->bits.size)));
+	}
+
+	ListStorage* storage = allocateListStorage(isNumbers ? LIST_ELEMENTS_NUMBERS : LIST_ELEMENTS_VALUES);
+	storage->elements = values;
+	countAllocation(sizeof(Value) * values.capacity);
+	RETURN_OK(output, OBJECT_VALUE(allocateList(storage, 0, values.size)));
+}
+
+KleinResult copyList(HeapList* list, Value* output) {
+	RETURN_OK(output, OBJECT_VALUE(allocateList(list->storage, list->offset, list->length)));
+}
+
+KleinResult sliceList(HeapList* list, double start, double end, Value* output) {
+	if (!isSliceBounds(start, end, list->length)) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_INVALID_INDEX,
+		};
+	}
+
+	unsigned long offset = list->offset + (unsigned long) start;
+	RETURN_OK(output, OBJECT_VALUE(allocateList(list->storage, offset, (unsigned long) end - (unsigned long) start)));
+}
+
+Value* listElements(HeapList* list) {
+	return list->storage->elements.data + list->offset;
+}
+
+Value listElement(HeapList* list, unsigned long index) {
+	ListStorage* storage = list->storage;
+	if (storage->kind == LIST_ELEMENTS_BOOLEANS) {
+		return getBit(&storage->bits, list->offset + index) ? TRUE_VALUE : FALSE_VALUE;
+	}
+	return storage->elements.data[list->offset + index];
+}
+
+/**
+ * Storage smaller than this is never compacted, since it's cheap to keep around.
+ */
+#define MINIMUM_COMPACTED_CAPACITY 64
+
+PRIVATE unsigned long storageCapacity(ListStorage* storage) {
+	return storage->kind == LIST_ELEMENTS_BOOLEANS ? storage->bits.capacity : storage->elements.capacity;
 }
 
-KleinResult getList(Value value, ValueList** output) {
-	return getValueInternal(value, INTERNAL_KEY_LIST, (void**) output);
+/**
+ * Moves a list's elements into a new storage of its own, leaving `frontRoom`
+ * free slots before them. Bits are copied a word at a time, with the front room
+ * rounded up to a whole word.
+ */
+PRIVATE void moveListElements(HeapList* list, unsigned long frontRoom) {
+	ListStorage* old = list->storage;
+	ListStorage* storage = allocateListStorage(old->kind);
+	storage->references = 1;
+
+	if (old->kind == LIST_ELEMENTS_BOOLEANS) {
+		frontRoom = ROUND_UP_TO_WORD(frontRoom);
+		unsigned long capacity = frontRoom + ROUND_UP_TO_WORD(MAX(list->length, 1));
+		storage->bits = (BitList) {
+			.words = calloc(capacity / BITS_PER_WORD, sizeof(uint64_t)),
+			.size = frontRoom + list->length,
+			.capacity = capacity,
+		};
+		for (unsigned long bit = 0; bit < list->length; bit += BITS_PER_WORD) {
+			storage->bits.words[(frontRoom + bit) / BITS_PER_WORD] = readBitWord(&old->bits, list->offset + bit);
+		}
+		countAllocation(capacity / 8);
+	} else {
+		unsigned long capacity = MAX(frontRoom + list->length, 1);
+		storage->elements = (ValueList) {
+			.data = malloc(sizeof(Value) * capacity),
+			.size = frontRoom + list->length,
+			.capacity = capacity,
+		};
+
+		// An empty list's storage may have no elements allocated at all
+		if (list->length > 0) {
+			memcpy(storage->elements.data + frontRoom, old->elements.data + list->offset, sizeof(Value) * list->length);
+		}
+		countAllocation(sizeof(Value) * capacity);
+	}
+
+	// The old storage is collected once the last list using it lets go
+	if (old->references != FROZEN_REFERENCES) {
+		old->references--;
+	}
+
+	list->storage = storage;
+	list->offset = frontRoom;
+	writeBarrier(&list->header, OBJECT_VALUE(storage));
+}
+
+/**
+ * Prepares a list to be changed in place. A list sharing its storage first gets
+ * storage of its own, as does one that has shrunk to under a quarter of its
+ * storage, so a long-running queue doesn't keep every element it ever held.
+ */
+PRIVATE void separateListStorage(HeapList* list) {
+	ListStorage* storage = list->storage;
+	bool isShared = storage->references > 1;
+	bool isSparse = storageCapacity(storage) > MINIMUM_COMPACTED_CAPACITY && list->length < storageCapacity(storage) / 4;
+	if (isShared || isSparse) {
+		moveListElements(list, 0);
+	}
+
+	// Anything after the end of the list was popped or is outside a view, and is dropped
+	if (list->storage->kind == LIST_ELEMENTS_BOOLEANS) {
+		list->storage->bits.size = list->offset + list->length;
+	} else {
+		list->storage->elements.size = list->offset + list->length;
+	}
+}
+
+/**
+ * Stores a value at an index of a list whose storage is its own, generalizing
+ * its element kind if needed.
+ */
+PRIVATE void storeListElement(HeapList* list, unsigned long index, Value value) {
+	ListStorage* storage = list->storage;
+	if (storage->kind == LIST_ELEMENTS_BOOLEANS && isBoolean(value)) {
+		setBit(&storage->bits, list->offset + index, value.bits == TRUE_VALUE.bits);
+		return;
+	}
+
+	unpackListStorage(storage);
+	if (!IS_NUMBER(value)) {
+		storage->kind = LIST_ELEMENTS_VALUES;
+	}
+	storage->elements.data[list->offset + index] = value;
+	writeElementBarrier(&storage->header, list->offset + index, value);
+}
+
+KleinResult getList(Value value, HeapList** output) {
+	if (isObjectOfType(value, HEAP_OBJECT_RANGE)) {
+		HeapRange* range = (HeapRange*) AS_OBJECT(value);
+		if (range->materialized == NULL) {
+			ValueList numbers = emptyValueList();
+			for (double number = range->low; number <= range->high; number++) {
+				TRY_LET(Value element, numberValue(number, &element));
+				appendToValueList(&numbers, element);
+			}
+			TRY_LET(Value list, listValue(numbers, &list));
+			range->materialized = (HeapList*) AS_OBJECT(list);
+			writeBarrier(&range->header, list);
+			if (range->header.isFrozen) {
+				freezeObject(&range->materialized->header);
+			}
+		}
+		RETURN_OK(output, range->materialized);
+	}
+
+	if (!isObjectOfType(value, HEAP_OBJECT_LIST)) {
+		UNREACHABLE;
+	}
+
+	RETURN_OK(output, (HeapList*) AS_OBJECT(value));
+}
+
+KleinResult rangeValue(double low, double high, Value* output) {
+	HeapRange* range = (HeapRange*) allocateObject(HEAP_OBJECT_RANGE, sizeof(HeapRange));
+	range->low = low;
+	range->high = high;
+	range->materialized = NULL;
+	RETURN_OK(output, OBJECT_VALUE(range));
+}
+
+HeapRange* getUnmaterializedRange(Value value) {
+	if (!isObjectOfType(value, HEAP_OBJECT_RANGE)) {
+		return NULL;
+	}
+
+	HeapRange* range = (HeapRange*) AS_OBJECT(value);
+	return range->materialized == NULL ? range : NULL;
+}
+
+KleinResult appendToList(HeapList* list, Value value) {
+	EXPECT_UNFROZEN(list);
+	separateListStorage(list);
+	ListStorage* storage = list->storage;
+
+	// An empty list picks its representation afresh, so a list of flags starts out packed
+	ListElementKind kind = isBoolean(value) ? LIST_ELEMENTS_BOOLEANS : LIST_ELEMENTS_NUMBERS;
+	if (list->offset + list->length == 0 && storage->kind != kind) {
+		freeValueList(&storage->elements);
+		free(storage->bits.words);
+		storage->elements = emptyValueList();
+		storage->bits = (BitList) {.words = NULL, .size = 0, .capacity = 0};
+		storage->kind = kind;
+	}
+
+	if (storage->kind == LIST_ELEMENTS_BOOLEANS && isBoolean(value)) {
+		appendBit(&storage->bits, value.bits == TRUE_VALUE.bits);
+		list->length++;
+		return OK;
+	}
+
+	unpackListStorage(storage);
+	if (!IS_NUMBER(value)) {
+		storage->kind = LIST_ELEMENTS_VALUES;
+	}
+	appendToValueList(&storage->elements, value);
+	writeElementBarrier(&storage->header, storage->elements.size - 1, value);
+	list->length++;
+	return OK;
+}
+
+KleinResult prependToList(HeapList* list, Value value) {
+	EXPECT_UNFROZEN(list);
+	separateListStorage(list);
+	if (!isBoolean(value)) {
+		unpackListStorage(list->storage);
+	}
+
+	// Leave as much room in front as the list is long, so prepending takes amortized constant time
+	if (list->offset == 0) {
+		moveListElements(list, MAX(list->length, SMALL_LIST_CAPACITY));
+	}
+
+	list->offset--;
+	list->length++;
+	storeListElement(list, 0, value);
+	return OK;
+}
+
+KleinResult popFrontOfList(HeapList* list, Value* output) {
+	EXPECT_UNFROZEN(list);
+	if (list->length == 0) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_INVALID_INDEX,
+		};
+	}
+
+	// Only this list's view of the storage changes, so shared storage is left alone
+	Value first = listElement(list, 0);
+	list->offset++;
+	list->length--;
+	RETURN_OK(output, first);
+}
+
+KleinResult popBackOfList(HeapList* list, Value* output) {
+	EXPECT_UNFROZEN(list);
+	if (list->length == 0) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_INVALID_INDEX,
+		};
+	}
+
+	list->length--;
+	RETURN_OK(output, listElement(list, list->length));
+}
+
+PRIVATE bool isListIndex(HeapList* list, double index) {
+	return index >= 0 && index < (double) list->length && floor(index) == index;
+}
+
+KleinResult getListElement(HeapList* list, double index, Value* output) {
+	if (!isListIndex(list, index)) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_INVALID_INDEX,
+		};
+	}
+
+	RETURN_OK(output, listElement(list, (unsigned long) index));
+}
+
+KleinResult setListElement(HeapList* list, double index, Value value) {
+	EXPECT_UNFROZEN(list);
+	if (!isListIndex(list, index)) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_INVALID_INDEX,
+		};
+	}
+
+	separateListStorage(list);
+	storeListElement(list, (unsigned long) index, value);
+	return OK;
+}
+
+unsigned long countTrueInList(HeapList* list) {
+	unsigned long count = 0;
+	if (list->storage->kind == LIST_ELEMENTS_BOOLEANS) {
+		for (unsigned long bit = 0; bit < list->length; bit += BITS_PER_WORD) {
+			uint64_t word = readBitWord(&list->storage->bits, list->offset + bit);
+			if (list->length - bit < BITS_PER_WORD) {
+				word &= ((uint64_t) 1 << (list->length - bit)) - 1;
+			}
+			count += countSetBits(word);
+		}
+		return count;
+	}
+
+	for (unsigned long index = 0; index < list->length; index++) {
+		if (listElement(list, index).bits == TRUE_VALUE.bits) {
+			count++;
+		}
+	}
+	return count;
+}
+
+/**
+ * Reads up to `BITS_PER_WORD` elements of a list of booleans starting at
+ * `start` as the bits of a word.
+ *
+ * # Errors
+ *
+ * If an element isn't a boolean, an error is returned.
+ */
+PRIVATE KleinResult readBooleanWord(HeapList* list, unsigned long start, uint64_t* output) {
+	if (list->storage->kind == LIST_ELEMENTS_BOOLEANS) {
+		RETURN_OK(output, readBitWord(&list->storage->bits, list->offset + start));
+	}
+
+	uint64_t word = 0;
+	for (unsigned long bit = 0; bit < BITS_PER_WORD && start + bit < list->length; bit++) {
+		Value element = listElement(list, start + bit);
+		if (!isBoolean(element)) {
+			return (KleinResult) {
+				.type = KLEIN_ERROR_INVALID_ARGUMENT,
+			};
+		}
+		if (element.bits == TRUE_VALUE.bits) {
+			word |= (uint64_t) 1 << bit;
+		}
+	}
+	RETURN_OK(output, word);
+}
+
+KleinResult combineBooleanLists(BooleanOperation operation, HeapList* left, HeapList* right, Value* output) {
+	if (operation != BOOLEAN_OPERATION_NOT && left->length != right->length) {
+		return (KleinResult) {
+			.type = KLEIN_ERROR_INVALID_ARGUMENT,
+		};
+	}
+
+	unsigned long capacity = ROUND_UP_TO_WORD(MAX(left->length, 1));
+	BitList bits = {
+		.words = malloc(capacity / 8),
+		.size = left->length,
+		.capacity = capacity,
+	};
+	for (unsigned long bit = 0; bit < left->length; bit += BITS_PER_WORD) {
+		uint64_t leftWord;
+		uint64_t rightWord = 0;
+		KleinResult result = readBooleanWord(left, bit, &leftWord);
+		if (result.type == KLEIN_OK && operation != BOOLEAN_OPERATION_NOT) {
+			result = readBooleanWord(right, bit, &rightWord);
+		}
+		if (result.type != KLEIN_OK) {
+			free(bits.words);
+			return result;
+		}
+
+		switch (operation) {
+			case BOOLEAN_OPERATION_AND:
+				bits.words[bit / BITS_PER_WORD] = leftWord & rightWord;
+				break;
+			case BOOLEAN_OPERATION_OR:
+				bits.words[bit / BITS_PER_WORD] = leftWord | rightWord;
+				break;
+			case BOOLEAN_OPERATION_XOR:
+				bits.words[bit / BITS_PER_WORD] = leftWord ^ rightWord;
+				break;
+			case BOOLEAN_OPERATION_NOT:
+				bits.words[bit / BITS_PER_WORD] = ~leftWord;
+				break;
+		}
+	}
+
+	ListStorage* storage = allocateListStorage(LIST_ELEMENTS_BOOLEANS);
+	storage->bits = bits;
+	countAllocation(capacity / 8);
+	RETURN_OK(output, OBJECT_VALUE(allocateList(storage, 0, left->length)));
 }
 
 bool isList(Value value) {
-	ValueList* output;
-	return isOk(getList(value, &output));
+	return isObjectOfType(value, HEAP_OBJECT_LIST) || isObjectOfType(value, HEAP_OBJECT_RANGE);
 }
 
-KleinResult nullValue(Value* output) {
-	// Fields
-	ValueFieldList* fields = emptyHeapValueFieldList();
+KleinResult recordValue(Shape* shape, Value* slots, Value* output) {
+	unsigned long slotCount = shape->fieldNames.size;
+	HeapRecord* object = (HeapRecord*) allocateObject(HEAP_OBJECT_RECORD, sizeof(HeapRecord) + sizeof(Value) * slotCount);
+	object->shape = shape;
+	if (slotCount > 0) {
+		memcpy(object->slots, slots, sizeof(Value) * slotCount);
+	}
+	RETURN_OK(output, OBJECT_VALUE(object));
+}
 
-	InternalList internals = emptyInternalList();
-	appendToInternalList(&internals, (Internal) {.key = INTERNAL_KEY_NULL, .value = NULL});
+bool isRecord(Value value) {
+	return isObjectOfType(value, HEAP_OBJECT_RECORD);
+}
 
-	Value result = (Value) {.fields = fields, .internals = internals};
-	RETURN_OK(output, result);
+KleinResult nullValue(Value* output) {
+	RETURN_OK(output, NULL_VALUE);
+}
+
+bool isNull(Value value) {
+	return value.bits == NULL_VALUE.bits;
 }
 
-KleinResult functionValue(Function value, Value* output) {
-	// Fields
-	ValueFieldList* fields = emptyHeapValueFieldList();
+KleinResult functionValue(Closure* closure, Value* output) {
+	RETURN_OK(output, OBJECT_VALUE(closure));
+}
 
-	InternalList internals = emptyInternalList();
+KleinResult getFunction(Value value, Closure** output) {
+	if (!isObjectOfType(value, HEAP_OBJECT_CLOSURE)) {
+		UNREACHABLE;
+	}
 
-	Function* function = malloc(sizeof(Function));
-	*function = value;
-	appendToInternalList(&internals, (Internal) {.key = INTERNAL_KEY_FUNCTION, .value = function});
+	RETURN_OK(output, (Closure*) AS_OBJECT(value));
+}
 
-	Value result = (Value) {.fields = fields, .internals = internals};
-	RETURN_OK(output, result);
+KleinResult builtinFunctionValue(BuiltinFunction function, Value* output) {
+	HeapBuiltinFunction* object = (HeapBuiltinFunction*) allocateObject(HEAP_OBJECT_BUILTIN_FUNCTION, sizeof(HeapBuiltinFunction));
+	object->function = function;
+	RETURN_OK(output, OBJECT_VALUE(object));
 }
 
-KleinResult getFunction(Value value, Function** output) {
-	return getValueInternal(value, INTERNAL_KEY_FUNCTION, (void**) output);
+KleinResult getBuiltinFunction(Value value, BuiltinFunction* output) {
+	if (!isBuiltinFunction(value)) {
+		UNREACHABLE;
+	}
+
+	RETURN_OK(output, ((HeapBuiltinFunction*) AS_OBJECT(value))->function);
 }
 
 bool isBuiltinFunction(Value value) {
-	return hasInternal(value, INTERNAL_KEY_BUILTIN_FUNCTION);
+	return isObjectOfType(value, HEAP_OBJECT_BUILTIN_FUNCTION);
 }
 
-bool isNull(Value value) {
-	return hasInternal(value, INTERNAL_KEY_NULL);
+KleinResult boundMethodValue(Value receiver, Value method, Value* output) {
+	HeapBoundMethod* object = (HeapBoundMethod*) allocateObject(HEAP_OBJECT_BOUND_METHOD, sizeof(HeapBoundMethod));
+	object->receiver = receiver;
+	object->method = method;
+	RETURN_OK(output, OBJECT_VALUE(object));
+}
+
+KleinResult getBoundMethod(Value value, HeapBoundMethod** output) {
+	if (!isBoundMethod(value)) {
+		UNREACHABLE;
+	}
+
+	RETURN_OK(output, (HeapBoundMethod*) AS_OBJECT(value));
+}
+
+bool isBoundMethod(Value value) {
+	return isObjectOfType(value, HEAP_OBJECT_BOUND_METHOD);
+}
+
+/**
+ * The built-in methods shared by every value of a type, keyed by name. Tables
+ * are built the first time any of them is needed and never change afterwards.
+ */
+typedef struct {
+	ValueFieldList number;
+	ValueFieldList string;
+	ValueFieldList list;
+	ValueFieldList boolean;
+	ValueFieldList function;
+	ValueFieldList stringBuilder;
+	ValueFieldList iterator;
+	ValueFieldList map;
+	ValueFieldList vector;
+	ValueFieldList persistentMap;
+} MethodTables;
+
+PRIVATE MethodTables methodTables;
+PRIVATE bool methodTablesBuilt = false;
+
+/**
+ * Adds a built-in method to a table. Since the tables are shared by every
+ * context, the method is allocated outside of any context's heap. It starts out
+ * old and marked, and the garbage collector only clears the marks of objects in
+ * its own heap, so it's never traced or freed.
+ */
+PRIVATE KleinResult addBuiltinMethod(ValueFieldList* table, String name, String builtinName) {
+	TRY_LET(BuiltinFunction function, getBuiltin(builtinName, &function));
+	HeapBuiltinFunction* method = malloc(sizeof(HeapBuiltinFunction));
+	method->header = (HeapObject) {
+		.type = HEAP_OBJECT_BUILTIN_FUNCTION,
+		.isFrozen = false,
+		.isHashed = false,
+		.isMarked = true,
+		.isOld = true,
+		.isRemembered = false,
+		.hash = 0,
+	};
+	method->function = function;
+	appendToValueFieldList(table, (ValueField) {.name = internName(name), .value = OBJECT_VALUE(method)});
+	return OK;
+}
+
+/**
+ * Adds the iterator combinators, which lists and strings share with iterators.
+ */
+PRIVATE KleinResult addIteratorMethods(ValueFieldList* table) {
+	TRY(addBuiltinMethod(table, "iterate", "Iterator.iterate"));
+	TRY(addBuiltinMethod(table, "map", "Iterator.map"));
+	TRY(addBuiltinMethod(table, "filter", "Iterator.filter"));
+	TRY(addBuiltinMethod(table, "take", "Iterator.take"));
+	TRY(addBuiltinMethod(table, "skip", "Iterator.skip"));
+	TRY(addBuiltinMethod(table, "zip", "Iterator.zip"));
+	TRY(addBuiltinMethod(table, "enumerate", "Iterator.enumerate"));
+	TRY(addBuiltinMethod(table, "reduce", "Iterator.reduce"));
+	TRY(addBuiltinMethod(table, "collect", "Iterator.collect"));
+	return OK;
+}
+
+PRIVATE KleinResult buildMethodTables(void) {
+	methodTables = (MethodTables) {
+		.number = emptyValueFieldList(),
+		.string = emptyValueFieldList(),
+		.list = emptyValueFieldList(),
+		.boolean = emptyValueFieldList(),
+		.function = emptyValueFieldList(),
+		.stringBuilder = emptyValueFieldList(),
+		.iterator = emptyValueFieldList(),
+		.map = emptyValueFieldList(),
+		.vector = emptyValueFieldList(),
+		.persistentMap = emptyValueFieldList(),
+	};
+
+	TRY(addBuiltinMethod(&methodTables.number, "to", "Number.to"));
+	TRY(addBuiltinMethod(&methodTables.number, "mod", "Number.mod"));
+	TRY(addBuiltinMethod(&methodTables.string, "length", "String.length"));
+	TRY(addBuiltinMethod(&methodTables.list, "append", "List.append"));
+	TRY(addBuiltinMethod(&methodTables.list, "prepend", "List.prepend"));
+	TRY(addBuiltinMethod(&methodTables.list, "pop_front", "List.pop_front"));
+	TRY(addBuiltinMethod(&methodTables.list, "pop_back", "List.pop_back"));
+	TRY(addBuiltinMethod(&methodTables.list, "copy", "List.copy"));
+	TRY(addBuiltinMethod(&methodTables.list, "slice", "List.slice"));
+	TRY(addBuiltinMethod(&methodTables.list, "count", "List.count"));
+	TRY(addBuiltinMethod(&methodTables.list, "bitwise_and", "List.bitwise_and"));
+	TRY(addBuiltinMethod(&methodTables.list, "bitwise_or", "List.bitwise_or"));
+	TRY(addBuiltinMethod(&methodTables.list, "bitwise_xor", "List.bitwise_xor"));
+	TRY(addBuiltinMethod(&methodTables.list, "bitwise_not", "List.bitwise_not"));
+	TRY(addBuiltinMethod(&methodTables.string, "slice", "String.slice"));
+	TRY(addIteratorMethods(&methodTables.string));
+	TRY(addIteratorMethods(&methodTables.list));
+	TRY(addIteratorMethods(&methodTables.iterator));
+	TRY(addIteratorMethods(&methodTables.map));
+	TRY(addBuiltinMethod(&methodTables.map, "get", "Map.get"));
+	TRY(addBuiltinMethod(&methodTables.map, "set", "Map.set"));
+	TRY(addBuiltinMethod(&methodTables.map, "delete", "Map.delete"));
+	TRY(addBuiltinMethod(&methodTables.map, "contains", "Map.contains"));
+	TRY(addBuiltinMethod(&methodTables.map, "size", "Map.size"));
+	TRY(addBuiltinMethod(&methodTables.map, "keys", "Map.keys"));
+	TRY(addBuiltinMethod(&methodTables.map, "values", "Map.values"));
+	TRY(addBuiltinMethod(&methodTables.map, "entries", "Map.entries"));
+	TRY(addIteratorMethods(&methodTables.vector));
+	TRY(addBuiltinMethod(&methodTables.vector, "get", "Vector.get"));
+	TRY(addBuiltinMethod(&methodTables.vector, "conj", "Vector.conj"));
+	TRY(addBuiltinMethod(&methodTables.vector, "assoc", "Vector.assoc"));
+	TRY(addBuiltinMethod(&methodTables.vector, "pop", "Vector.pop"));
+	TRY(addBuiltinMethod(&methodTables.vector, "length", "Vector.length"));
+	TRY(addIteratorMethods(&methodTables.persistentMap));
+	TRY(addBuiltinMethod(&methodTables.persistentMap, "get", "PersistentMap.get"));
+	TRY(addBuiltinMethod(&methodTables.persistentMap, "assoc", "PersistentMap.assoc"));
+	TRY(addBuiltinMethod(&methodTables.persistentMap, "dissoc", "PersistentMap.dissoc"));
+	TRY(addBuiltinMethod(&methodTables.persistentMap, "contains", "PersistentMap.contains"));
+	TRY(addBuiltinMethod(&methodTables.persistentMap, "size", "PersistentMap.size"));
+	TRY(addBuiltinMethod(&methodTables.persistentMap, "keys", "PersistentMap.keys"));
+	TRY(addBuiltinMethod(&methodTables.persistentMap, "values", "PersistentMap.values"));
+	TRY(addBuiltinMethod(&methodTables.persistentMap, "entries", "PersistentMap.entries"));
+	TRY(addBuiltinMethod(&methodTables.stringBuilder, "append", "StringBuilder.append"));
+	TRY(addBuiltinMethod(&methodTables.stringBuilder, "append_number", "StringBuilder.append_number"));
+	TRY(addBuiltinMethod(&methodTables.stringBuilder, "length", "StringBuilder.length"));
+	TRY(addBuiltinMethod(&methodTables.stringBuilder, "build", "StringBuilder.build"));
+
+
+	methodTablesBuilt = true;
+	return OK;
+}
+
+/**
+ * Returns the method table shared by all values of the given value's type, or
+ * `NULL` if the type has no methods.
+ */
+PRIVATE KleinResult methodTableOf(Value value, ValueFieldList** output) {
+	if (!methodTablesBuilt) {
+		TRY(buildMethodTables());
+	}
+
+	if (isNumber(value)) {
+		RETURN_OK(output, &methodTables.number);
+	}
+	if (isString(value)) {
+		RETURN_OK(output, &methodTables.string);
+	}
+	if (isList(value)) {
+		RETURN_OK(output, &methodTables.list);
+	}
+	if (isBoolean(value)) {
+		RETURN_OK(output, &methodTables.boolean);
+	}
+	if (isObjectOfType(value, HEAP_OBJECT_CLOSURE) || isBuiltinFunction(value) || isBoundMethod(value)) {
+		RETURN_OK(output, &methodTables.function);
+	}
+	if (isStringBuilder(value)) {
+		RETURN_OK(output, &methodTables.stringBuilder);
+	}
+	if (isObjectOfType(value, HEAP_OBJECT_ITERATOR)) {
+		RETURN_OK(output, &methodTables.iterator);
+	}
+	if (isObjectOfType(value, HEAP_OBJECT_MAP)) {
+		RETURN_OK(output, &methodTables.map);
+	}
+	if (isObjectOfType(value, HEAP_OBJECT_VECTOR)) {
+		RETURN_OK(output, &methodTables.vector);
+	}
+	if (isObjectOfType(value, HEAP_OBJECT_PERSISTENT_MAP)) {
+		RETURN_OK(output, &methodTables.persistentMap);
+	}
+
+	RETURN_OK(output, NULL);
+}
+
+/**
+ * Looks up a field by name in the given list, storing it in `output` if it's there.
+ *
+ * # Returns
+ *
+ * Whether the field was found.
+ */
+PRIVATE bool findValueField(ValueFieldList* fields, String name, Value* output) {
+	FOR_EACHP(ValueField field, fields) {
+		if (field.name == name) {
+			*output = field.value;
+			return true;
+		}
+	}
+	END;
+
+	return false;
+}
+
+KleinResult getValueField(Value value, String name, Value* output) {
+
+	// Own fields
+	if (isRecord(value)) {
+		HeapRecord* record = (HeapRecord*) AS_OBJECT(value);
+		unsigned long slot;
+		if (getShapeSlot(record->shape, name, &slot)) {
+			RETURN_OK(output, record->slots[slot]);
+		}
+	}
+
+	// Methods
+	TRY_LET(ValueFieldList * methods, methodTableOf(value, &methods));
+	if (methods != NULL && findValueField(methods, name, output)) {
+		return OK;
+	}
+
+	Value* heapValue = malloc(sizeof(Value));
+	*heapValue = value;
+	return (KleinResult) {
+		.type = KLEIN_ERROR_MISSING_FIELD,
+		.data = (KleinResultData) {
+			.missingField = {
+				.value = heapValue,
+				.name = name,
+			},
+		},
+	};
 }
@@ -1,3 +1,12 @@
 #include "../include/util.h"
 
 Context* CONTEXT;
+
+unsigned int countSetBits(uint64_t word) {
+
+	// Sums adjacent bits in pairs, then nibbles, then bytes, then adds the bytes with a multiply
+	word = word - ((word >> 1) & 0x5555555555555555);
+	word = (word & 0x3333333333333333) + ((word >> 2) & 0x3333333333333333);
+	word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0f;
+	return (unsigned int) ((word * 0x0101010101010101) >> 56);
+}